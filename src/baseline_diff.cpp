@@ -0,0 +1,245 @@
+#include "baseline_diff.h"
+
+#include "binary_archive.h"
+
+namespace {
+
+constexpr std::string_view kKeyMembers[] = {"simfile", "steps_type", "difficulty", "description"};
+
+// Nesting deeper than the harness ever prints means the file is something else.
+constexpr int kMaxDepth = 16;
+
+// Reads the harness's own JSON back just far enough to split charts into
+// members. Values are copied without the whitespace between tokens, which
+// turns the indented layout into the compact one; strings are kept escaped.
+class CompactReader {
+public:
+    explicit CompactReader(std::string_view text) : text_(text) {}
+
+    size_t offset() const { return pos_; }
+
+    bool at_end() {
+        skip_whitespace();
+        return pos_ == text_.size();
+    }
+
+    bool consume(char c) {
+        skip_whitespace();
+        if (pos_ == text_.size() || text_[pos_] != c) return false;
+        ++pos_;
+        return true;
+    }
+
+    // Appends a string token, quotes and escapes included.
+    bool string(std::string& out) {
+        skip_whitespace();
+        if (pos_ == text_.size() || text_[pos_] != '"') return false;
+        const size_t start = pos_++;
+        while (pos_ < text_.size()) {
+            const char c = text_[pos_++];
+            if (c == '\\') {
+                if (pos_ == text_.size()) return false;
+                ++pos_;
+            } else if (c == '"') {
+                out.append(text_.substr(start, pos_ - start));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool value(std::string& out, int depth = 0) {
+        if (depth > kMaxDepth) return false;
+        skip_whitespace();
+        if (pos_ == text_.size()) return false;
+        const char c = text_[pos_];
+        if (c == '"') return string(out);
+        if (c == '{' || c == '[') {
+            const char close = c == '{' ? '}' : ']';
+            ++pos_;
+            out.push_back(c);
+            if (consume(close)) {
+                out.push_back(close);
+                return true;
+            }
+            do {
+                if (c == '{') {
+                    if (!string(out) || !consume(':')) return false;
+                    out.push_back(':');
+                }
+                if (!value(out, depth + 1)) return false;
+                if (!consume(',')) break;
+                out.push_back(',');
+            } while (true);
+            if (!consume(close)) return false;
+            out.push_back(close);
+            return true;
+        }
+        // Numbers, true, false and null.
+        const size_t start = pos_;
+        while (pos_ < text_.size() && is_literal_char(text_[pos_])) ++pos_;
+        if (pos_ == start) return false;
+        out.append(text_.substr(start, pos_ - start));
+        return true;
+    }
+
+private:
+    static bool is_literal_char(char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' ||
+               c == '+' || c == '.';
+    }
+
+    void skip_whitespace() {
+        while (pos_ < text_.size() &&
+               (text_[pos_] == ' ' || text_[pos_] == '\n' || text_[pos_] == '\r' || text_[pos_] == '\t')) {
+            ++pos_;
+        }
+    }
+
+    std::string_view text_;
+    size_t pos_ = 0;
+};
+
+using Members = std::vector<std::pair<std::string, std::string>>;
+
+// Reads one chart object into its members.
+bool read_chart(CompactReader& reader, Members& members) {
+    if (!reader.consume('{')) return false;
+    if (reader.consume('}')) return true;
+    do {
+        std::string name;
+        std::string value;
+        if (!reader.string(name) || !reader.consume(':') || !reader.value(value)) return false;
+        // Field names never need escapes, so the quotes are all there is to strip.
+        members.emplace_back(name.substr(1, name.size() - 2), std::move(value));
+    } while (reader.consume(','));
+    return reader.consume('}');
+}
+
+const std::string* find_member(const Members& members, std::string_view name) {
+    for (const auto& [member, value] : members) {
+        if (member == name) return &value;
+    }
+    return nullptr;
+}
+
+// The key members as record text; false if one is missing.
+bool key_of(const Members& members, std::string& key) {
+    for (std::string_view name : kKeyMembers) {
+        const std::string* value = find_member(members, name);
+        if (!value) return false;
+        if (!key.empty()) key.push_back(',');
+        key.push_back('"');
+        key.append(name);
+        key.append("\":");
+        key.append(*value);
+    }
+    return true;
+}
+
+std::string delta(std::string_view change, const std::string& key) {
+    std::string record = "{\"change\":\"";
+    record.append(change);
+    record.append("\",");
+    record.append(key);
+    return record;
+}
+
+} // namespace
+
+bool BaselineDiff::load(const std::string& path, std::string* error) {
+    std::string text;
+    if (!read_file(path, text)) {
+        if (error) *error = "cannot read " + path;
+        return false;
+    }
+
+    CompactReader reader(text);
+    const bool array = reader.consume('[');
+    bool valid = true;
+    if (array ? !reader.consume(']') : !reader.at_end()) {
+        do {
+            Chart chart;
+            if (!read_chart(reader, chart.members)) {
+                valid = false;
+                break;
+            }
+            if (!key_of(chart.members, chart.key)) {
+                if (error) {
+                    *error = path + ": chart " + std::to_string(charts_.size() + 1) +
+                             " has no simfile, steps_type, difficulty or description";
+                }
+                return false;
+            }
+            by_key_[chart.key].push_back(charts_.size());
+            charts_.push_back(std::move(chart));
+        } while (array ? reader.consume(',') : !reader.at_end());
+        if (valid && array) valid = reader.consume(']');
+    }
+    if (!valid || !reader.at_end()) {
+        if (error) *error = path + ": not harness JSON output (at byte " + std::to_string(reader.offset()) + ")";
+        return false;
+    }
+    return true;
+}
+
+// Takes the baseline chart with the key and ordinal. A key appears more than
+// once when a simfile has several charts with the same steps type, difficulty
+// and description (usually edits); they can differ in every other field, so
+// each is paired with the one at the same position rather than whichever
+// finished first.
+BaselineDiff::Chart* BaselineDiff::claim(const std::string& key, size_t ordinal) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = by_key_.find(key);
+    if (it == by_key_.end() || ordinal >= it->second.size()) return nullptr;
+    Chart& chart = charts_[it->second[ordinal]];
+    if (chart.matched) return nullptr;
+    chart.matched = true;
+    return &chart;
+}
+
+std::string BaselineDiff::compare(std::string_view chart_json, size_t ordinal) {
+    CompactReader reader(chart_json);
+    Members current;
+    std::string key;
+    if (!read_chart(reader, current) || !key_of(current, key)) return {};
+
+    // A claimed chart is only read from here on, so no lock is needed.
+    const Chart* before = claim(key, ordinal);
+    if (!before) {
+        std::string record = delta("added", key);
+        record.append(",\"chart\":");
+        record.append(chart_json);
+        record.push_back('}');
+        return record;
+    }
+
+    std::string fields;
+    for (const auto& [name, value] : current) {
+        const std::string* old = find_member(before->members, name);
+        if (old && *old == value) continue;
+        fields.push_back(fields.empty() ? '{' : ',');
+        fields.push_back('"');
+        fields.append(name);
+        fields.append("\":{\"old\":");
+        fields.append(old ? *old : "null");
+        fields.append(",\"new\":");
+        fields.append(value);
+        fields.push_back('}');
+    }
+    if (fields.empty()) return {};
+    std::string record = delta("changed", key);
+    record.append(",\"fields\":");
+    record.append(fields);
+    record.append("}}");
+    return record;
+}
+
+std::vector<std::string> BaselineDiff::removed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> records;
+    for (const Chart& chart : charts_) {
+        if (!chart.matched) records.push_back(delta("removed", chart.key) + "}");
+    }
+    return records;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Compares charts against the output of an earlier run (--baseline), so a
+// re-analysis of a library only reports what changed. Charts are matched by
+// (simfile, steps_type, difficulty, description) and, among the charts of a
+// simfile that share those, by their order (like the --sqlite chart_ordinal).
+// Values are compared in
+// their compact JSON text: both runs print numbers in the shortest round-trip
+// form, so equal text means equal values.
+//
+// Every delta is one compact JSON object that starts with "change" and the
+// four key members:
+//   {"change":"added",<key>,"chart":{...}}
+//   {"change":"changed",<key>,"fields":{"<name>":{"old":...,"new":...},...}}
+//   {"change":"removed",<key>}
+// "old" is null for a key the baseline did not print (e.g. another --fields).
+class BaselineDiff {
+public:
+    // Reads a JSON array, an NDJSON file or a single chart object as printed
+    // by the harness (indented or compact). Every chart must have the four
+    // key members. On failure returns false and describes the problem.
+    bool load(const std::string& path, std::string* error);
+
+    size_t size() const { return charts_.size(); }
+
+    // chart_json is one chart as a compact JSON object with the key members
+    // (the --ndjson line without its newline); ordinal counts the charts
+    // before it in its simfile with the same key. Returns its delta, or an
+    // empty string when it is unchanged. Safe to call from several threads.
+    std::string compare(std::string_view chart_json, size_t ordinal);
+
+    // Deltas for the baseline charts that no compare() call matched, in
+    // baseline order. Call once every chart has been compared.
+    std::vector<std::string> removed() const;
+
+private:
+    struct Chart {
+        // "simfile":...,"steps_type":...,"difficulty":...,"description":...
+        std::string key;
+        // Member names and compact values, in output order.
+        std::vector<std::pair<std::string, std::string>> members;
+        bool matched = false;
+    };
+
+    Chart* claim(const std::string& key, size_t ordinal);
+
+    std::vector<Chart> charts_;
+    // Indexes into charts_ per key, in file order, so by ordinal.
+    std::unordered_map<std::string, std::vector<size_t>> by_key_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,103 @@
+#include "binary_archive.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+std::string temp_file_suffix() {
+    static const uint64_t nonce = []() {
+        std::random_device random;
+        return (uint64_t(random()) << 32) ^ random() ^
+               static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    }();
+    static std::atomic<uint64_t> next{0};
+    return std::string(kTempFileMarker) + std::to_string(nonce) + "-" + std::to_string(next++);
+}
+
+} // namespace
+
+void ContentHash::add(std::string_view bytes) {
+    word(bytes.size());
+    size_t i = 0;
+    for (; i + 8 <= bytes.size(); i += 8) {
+        uint64_t w = 0;
+        std::memcpy(&w, bytes.data() + i, 8);
+        word(w);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+    word(tail);
+}
+
+std::string ContentHash::hex() const {
+    static constexpr char kHex[] = "0123456789abcdef";
+    const uint64_t halves[2] = {fmix64(a_ ^ rotl(b_, 32)), fmix64(b_ + a_)};
+    std::string out;
+    for (uint64_t half : halves) {
+        for (int shift = 60; shift >= 0; shift -= 4) out.push_back(kHex[(half >> shift) & 0x0F]);
+    }
+    return out;
+}
+
+void ContentHash::word(uint64_t w) {
+    a_ = rotl(a_ ^ w, 31) * 0x9e3779b97f4a7c15ULL;
+    b_ = rotl(b_ + w, 27) * 0xc2b2ae3d27d4eb4fULL + a_;
+}
+
+std::string content_key(std::initializer_list<std::string_view> parts) {
+    ContentHash hash;
+    for (std::string_view part : parts) hash.add(part);
+    return hash.hex();
+}
+
+bool read_file(const std::string& path, std::string& bytes) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    const std::streamoff size = in.tellg();
+    if (size < 0) return false;
+    bytes.resize(static_cast<size_t>(size));
+    in.seekg(0, std::ios::beg);
+    return static_cast<bool>(in.read(bytes.data(), size));
+}
+
+bool write_file_atomically(const std::string& path, std::string_view bytes, std::string* error) {
+    const std::string temp = path + temp_file_suffix();
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!out.good()) {
+            out.close();
+            fs::remove(temp, ec);
+            if (error) *error = "cannot write " + temp;
+            return false;
+        }
+    }
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        if (error) *error = "cannot rename " + temp + " to " + path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What the harness's on-disk formats (result cache entries, compiled
+// simfiles) have in common: content hashing, a simple binary archive and
+// whole-file reads and atomic writes. Files are in host byte order; they
+// belong to the machine that wrote them.
+
+// Two multiply-rotate lanes over 8-byte words: a few cycles per word, which
+// keeps hashing a large library well below the cost of reading it. Not
+// cryptographic.
+class ContentHash {
+public:
+    // Each part is length-prefixed, so part boundaries matter.
+    void add(std::string_view bytes);
+    // 32 hex digits.
+    std::string hex() const;
+
+private:
+    void word(uint64_t w);
+
+    uint64_t a_ = 0x243f6a8885a308d3ULL;
+    uint64_t b_ = 0x13198a2e03707344ULL;
+};
+
+// ContentHash over the parts.
+std::string content_key(std::initializer_list<std::string_view> parts);
+
+// Serializes values for BinaryReader. Lists are a 32-bit count followed by
+// their elements. A function that lists a type's members once, for either
+// archive, keeps reading in step with writing:
+//
+//   template <typename Archive, typename Thing>
+//   void thing_members(Archive& ar, Thing& t) { ar(t.name); ar(t.values); }
+class BinaryWriter {
+public:
+    void operator()(const std::string& value) {
+        count(value.size());
+        out_.append(value);
+    }
+    void operator()(int32_t value) { raw(&value, sizeof(value)); }
+    void operator()(uint64_t value) { raw(&value, sizeof(value)); }
+    void operator()(float value) { raw(&value, sizeof(value)); }
+    void operator()(double value) { raw(&value, sizeof(value)); }
+    void operator()(bool value) { out_.push_back(value ? 1 : 0); }
+    void operator()(const std::vector<bool>& values) {
+        count(values.size());
+        for (bool value : values) (*this)(value);
+    }
+    template <typename T>
+    void operator()(const std::vector<T>& values) {
+        count(values.size());
+        for (const T& value : values) (*this)(value);
+    }
+
+    // The count of a list whose elements the caller writes itself.
+    template <typename T>
+    void count(const std::vector<T>& values) {
+        count(values.size());
+    }
+    void count(size_t n) {
+        const uint32_t value = static_cast<uint32_t>(n);
+        raw(&value, sizeof(value));
+    }
+    void raw(const void* data, size_t size) { out_.append(static_cast<const char*>(data), size); }
+
+    std::string& str() { return out_; }
+
+private:
+    std::string out_;
+};
+
+// Reads what BinaryWriter wrote. Running past the end, or a count larger
+// than the bytes left, marks the data bad instead of reading further.
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view data) : data_(data) {}
+
+    bool ok() const { return ok_; }
+    bool at_end() const { return pos_ == data_.size(); }
+    size_t remaining() const { return data_.size() - pos_; }
+
+    void operator()(std::string& value) {
+        const size_t n = count();
+        if (!ok_) return;
+        value.assign(data_.substr(pos_, n));
+        pos_ += n;
+    }
+    void operator()(int32_t& value) { raw(&value, sizeof(value)); }
+    void operator()(uint64_t& value) { raw(&value, sizeof(value)); }
+    void operator()(float& value) { raw(&value, sizeof(value)); }
+    void operator()(double& value) { raw(&value, sizeof(value)); }
+    void operator()(bool& value) {
+        char byte = 0;
+        raw(&byte, 1);
+        value = byte != 0;
+    }
+    void operator()(std::vector<bool>& values) {
+        values.assign(count(), false);
+        for (size_t i = 0; i < values.size() && ok_; ++i) {
+            bool value = false;
+            (*this)(value);
+            values[i] = value;
+        }
+    }
+    template <typename T>
+    void operator()(std::vector<T>& values) {
+        count(values);
+        for (T& value : values) {
+            if (!ok_) return;
+            (*this)(value);
+        }
+    }
+
+    // Sizes the list; the caller reads the elements itself.
+    template <typename T>
+    void count(std::vector<T>& values) {
+        values.resize(count());
+    }
+    size_t count() {
+        uint32_t value = 0;
+        raw(&value, sizeof(value));
+        if (value > data_.size() - pos_) ok_ = false;
+        return ok_ ? value : 0;
+    }
+    void raw(void* out, size_t size) {
+        if (!ok_ || size > data_.size() - pos_) {
+            ok_ = false;
+            return;
+        }
+        std::memcpy(out, data_.data() + pos_, size);
+        pos_ += size;
+    }
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+// The whole file, or false.
+bool read_file(const std::string& path, std::string& bytes);
+
+// write_file_atomically writes to path + kTempFileMarker + a suffix unique to
+// the process and call, then renames that over path, so readers never see a
+// partial file. A temporary file that lingers was left by a process that died
+// in between.
+inline constexpr std::string_view kTempFileMarker = ".tmp";
+
+// Creates path's directory if needed. On failure nothing is left behind;
+// returns false and describes the problem in error.
+bool write_file_atomically(const std::string& path, std::string_view bytes, std::string* error = nullptr);
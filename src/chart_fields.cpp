@@ -0,0 +1,92 @@
+#include "chart_fields.h"
+
+#include <iterator>
+
+namespace {
+
+constexpr std::string_view kChartFieldNames[] = {
+    "status",
+    "simfile",
+    "title",
+    "subtitle",
+    "artist",
+    "title_translated",
+    "subtitle_translated",
+    "artist_translated",
+    "step_artist",
+    "description",
+    "steps_type",
+    "difficulty",
+    "meter",
+    "bpms",
+    "hash_bpms",
+    "bpm_min",
+    "bpm_max",
+    "display_bpm",
+    "display_bpm_min",
+    "display_bpm_max",
+    "hash",
+    "duration_seconds",
+    "streams_breakdown",
+    "streams_breakdown_level1",
+    "streams_breakdown_level2",
+    "streams_breakdown_level3",
+    "total_stream_measures",
+    "total_break_measures",
+    "total_steps",
+    "notes_per_measure",
+    "nps_per_measure",
+    "equally_spaced_per_measure",
+    "peak_nps",
+    "stream_sequences",
+    "holds",
+    "mines",
+    "rolls",
+    "taps_and_holds",
+    "notes",
+    "lifts",
+    "fakes",
+    "jumps",
+    "hands",
+    "quads",
+    "timing",
+    "tech_counts",
+};
+
+static_assert(std::size(kChartFieldNames) == kChartFieldCount, "one name per ChartField");
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+} // namespace
+
+ChartFieldSet all_chart_fields() {
+    return ChartFieldSet().set();
+}
+
+std::string_view chart_field_name(ChartField field) {
+    return kChartFieldNames[static_cast<size_t>(field)];
+}
+
+std::optional<ChartFieldSet> parse_chart_field_list(std::string_view list, std::string* bad_name) {
+    ChartFieldSet fields;
+    for (;;) {
+        const size_t comma = list.find(',');
+        const std::string_view name = trim(list.substr(0, comma));
+
+        size_t index = 0;
+        while (index < kChartFieldCount && kChartFieldNames[index] != name) ++index;
+        if (index == kChartFieldCount) {
+            if (bad_name) *bad_name = std::string(name);
+            return std::nullopt;
+        }
+        fields.set(index);
+
+        if (comma == std::string_view::npos) break;
+        list.remove_prefix(comma + 1);
+    }
+    return fields;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Top-level keys of a chart's JSON object, in output order. timing and
+// tech_counts each cover their whole nested object.
+enum class ChartField {
+    Status,
+    Simfile,
+    Title,
+    Subtitle,
+    Artist,
+    TitleTranslated,
+    SubtitleTranslated,
+    ArtistTranslated,
+    StepArtist,
+    Description,
+    StepsType,
+    Difficulty,
+    Meter,
+    Bpms,
+    HashBpms,
+    BpmMin,
+    BpmMax,
+    DisplayBpm,
+    DisplayBpmMin,
+    DisplayBpmMax,
+    Hash,
+    DurationSeconds,
+    StreamsBreakdown,
+    StreamsBreakdownLevel1,
+    StreamsBreakdownLevel2,
+    StreamsBreakdownLevel3,
+    TotalStreamMeasures,
+    TotalBreakMeasures,
+    TotalSteps,
+    NotesPerMeasure,
+    NpsPerMeasure,
+    EquallySpacedPerMeasure,
+    PeakNps,
+    StreamSequences,
+    Holds,
+    Mines,
+    Rolls,
+    TapsAndHolds,
+    Notes,
+    Lifts,
+    Fakes,
+    Jumps,
+    Hands,
+    Quads,
+    Timing,
+    TechCounts,
+    Count,
+};
+
+constexpr size_t kChartFieldCount = static_cast<size_t>(ChartField::Count);
+
+using ChartFieldSet = std::bitset<kChartFieldCount>;
+
+inline bool has_field(const ChartFieldSet& fields, ChartField field) {
+    return fields.test(static_cast<size_t>(field));
+}
+
+inline void set_field(ChartFieldSet& fields, ChartField field, bool value = true) {
+    fields.set(static_cast<size_t>(field), value);
+}
+
+ChartFieldSet all_chart_fields();
+
+// The JSON key, e.g. "peak_nps".
+std::string_view chart_field_name(ChartField field);
+
+// Parses a comma-separated list of JSON keys (whitespace around names is
+// ignored). On an unknown or empty name, returns nullopt and stores it in
+// bad_name.
+std::optional<ChartFieldSet> parse_chart_field_list(std::string_view list, std::string* bad_name);
@@ -0,0 +1,498 @@
+#include "columnar_export.h"
+
+#include "json_writer.h"
+#include "text_encoding.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <system_error>
+#include <type_traits>
+
+namespace {
+
+constexpr size_t kFlushBytes = 1 << 20;
+
+// One little-endian array on disk, buffered so small appends stay cheap.
+class ColumnFile {
+public:
+    explicit ColumnFile(std::string name) : name_(std::move(name)) {}
+
+    bool open(const std::filesystem::path& dir) {
+        out_.open(dir / name_, std::ios::binary | std::ios::trunc);
+        return static_cast<bool>(out_);
+    }
+
+    const std::string& name() const { return name_; }
+
+    void u8(uint8_t value) { buffer_.push_back(static_cast<char>(value)); maybe_flush(); }
+    void i32(int32_t value) { little_endian(static_cast<uint32_t>(value), 4); }
+    void u64(uint64_t value) { little_endian(value, 8); }
+    void f64(double value) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(bits));
+        little_endian(bits, 8);
+    }
+    void bytes(std::string_view value) { buffer_.append(value); maybe_flush(); }
+
+    bool close() {
+        flush();
+        out_.close();
+        return !out_.fail();
+    }
+
+private:
+    void little_endian(uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            buffer_.push_back(static_cast<char>(value >> (i * 8)));
+        }
+        maybe_flush();
+    }
+
+    void maybe_flush() {
+        if (buffer_.size() >= kFlushBytes) flush();
+    }
+
+    void flush() {
+        out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+
+    std::string name_;
+    std::ofstream out_;
+    std::string buffer_;
+};
+
+// A running offsets file: starts with 0 and gets the end of every entry.
+struct Offsets {
+    explicit Offsets(std::string name) : file(std::move(name)) {}
+
+    bool open(const std::filesystem::path& dir) {
+        if (!file.open(dir)) return false;
+        file.u64(0);
+        return true;
+    }
+    void advance(uint64_t count) {
+        end += count;
+        file.u64(end);
+    }
+
+    ColumnFile file;
+    uint64_t end = 0;
+};
+
+} // namespace
+
+// One logical column: its files and how a chart is appended to them.
+class ColumnarExport::Column {
+public:
+    Column(std::string name, std::string kind, std::string type)
+        : name_(std::move(name)), kind_(std::move(kind)), type_(std::move(type)) {}
+    virtual ~Column() = default;
+
+    virtual bool open(const std::filesystem::path& dir) = 0;
+    virtual void add(const ChartMetrics& m) = 0;
+    virtual bool close() = 0;
+    virtual std::vector<std::string> files() const = 0;
+
+    void describe(JsonWriter& out) const {
+        out.raw("{\"name\":");
+        out.string(name_);
+        out.raw(",\"kind\":");
+        out.string(kind_);
+        out.raw(",\"type\":");
+        out.string(type_);
+        out.raw(",\"files\":[");
+        bool first = true;
+        for (const std::string& file : files()) {
+            if (!first) out.raw(',');
+            first = false;
+            out.string(file);
+        }
+        out.raw("]}");
+    }
+
+private:
+    std::string name_;
+    std::string kind_;
+    std::string type_;
+};
+
+namespace {
+
+using Column = ColumnarExport::Column;
+
+template <typename T>
+class ScalarColumn : public Column {
+public:
+    ScalarColumn(std::string name, std::function<T(const ChartMetrics&)> get)
+        : Column(name, "scalar", type_name()), file_(name + "." + type_name()), get_(std::move(get)) {}
+
+    bool open(const std::filesystem::path& dir) override { return file_.open(dir); }
+    void add(const ChartMetrics& m) override {
+        if constexpr (std::is_same_v<T, double>) {
+            file_.f64(get_(m));
+        } else {
+            file_.i32(get_(m));
+        }
+    }
+    bool close() override { return file_.close(); }
+    std::vector<std::string> files() const override { return {file_.name()}; }
+
+private:
+    static std::string type_name() { return std::is_same_v<T, double> ? "f64" : "i32"; }
+
+    ColumnFile file_;
+    std::function<T(const ChartMetrics&)> get_;
+};
+
+class StringColumn : public Column {
+public:
+    StringColumn(std::string name, std::function<const std::string&(const ChartMetrics&)> get)
+        : Column(name, "string", "utf8"),
+          offsets_(name + ".offsets.u64"),
+          bytes_(name + ".bytes"),
+          get_(std::move(get)) {}
+
+    bool open(const std::filesystem::path& dir) override {
+        return offsets_.open(dir) && bytes_.open(dir);
+    }
+    void add(const ChartMetrics& m) override {
+        const std::string_view text = as_utf8(get_(m), scratch_);
+        bytes_.bytes(text);
+        offsets_.advance(text.size());
+    }
+    bool close() override { return offsets_.file.close() && bytes_.close(); }
+    std::vector<std::string> files() const override { return {offsets_.file.name(), bytes_.name()}; }
+
+private:
+    Offsets offsets_;
+    ColumnFile bytes_;
+    std::function<const std::string&(const ChartMetrics&)> get_;
+    std::string scratch_;
+};
+
+// Variable-length list per chart; T is int, double or bool (stored as u8).
+template <typename T>
+class ListColumn : public Column {
+public:
+    ListColumn(std::string name, std::function<const std::vector<T>&(const ChartMetrics&)> get)
+        : Column(name, "list", type_name()),
+          offsets_(name + ".offsets.u64"),
+          values_(name + ".values." + type_name()),
+          get_(std::move(get)) {}
+
+    bool open(const std::filesystem::path& dir) override {
+        return offsets_.open(dir) && values_.open(dir);
+    }
+    void add(const ChartMetrics& m) override {
+        const std::vector<T>& values = get_(m);
+        for (const T value : values) {
+            if constexpr (std::is_same_v<T, double>) {
+                values_.f64(value);
+            } else if constexpr (std::is_same_v<T, bool>) {
+                values_.u8(value ? 1 : 0);
+            } else {
+                values_.i32(value);
+            }
+        }
+        offsets_.advance(values.size());
+    }
+    bool close() override { return offsets_.file.close() && values_.close(); }
+    std::vector<std::string> files() const override { return {offsets_.file.name(), values_.name()}; }
+
+private:
+    static std::string type_name() {
+        if (std::is_same_v<T, double>) return "f64";
+        if (std::is_same_v<T, bool>) return "u8";
+        return "i32";
+    }
+
+    Offsets offsets_;
+    ColumnFile values_;
+    std::function<const std::vector<T>&(const ChartMetrics&)> get_;
+};
+
+// Timing segments: chart -> rows -> numbers, as two levels of offsets.
+class TableColumn : public Column {
+public:
+    TableColumn(std::string name, std::function<const std::vector<std::vector<double>>&(const ChartMetrics&)> get)
+        : Column(name, "table", "f64"),
+          offsets_(name + ".offsets.u64"),
+          row_offsets_(name + ".row_offsets.u64"),
+          values_(name + ".values.f64"),
+          get_(std::move(get)) {}
+
+    bool open(const std::filesystem::path& dir) override {
+        return offsets_.open(dir) && row_offsets_.open(dir) && values_.open(dir);
+    }
+    void add(const ChartMetrics& m) override {
+        const std::vector<std::vector<double>>& rows = get_(m);
+        for (const std::vector<double>& row : rows) {
+            for (const double value : row) values_.f64(value);
+            row_offsets_.advance(row.size());
+        }
+        offsets_.advance(rows.size());
+    }
+    bool close() override {
+        return offsets_.file.close() && row_offsets_.file.close() && values_.close();
+    }
+    std::vector<std::string> files() const override {
+        return {offsets_.file.name(), row_offsets_.file.name(), values_.name()};
+    }
+
+private:
+    Offsets offsets_;
+    Offsets row_offsets_;
+    ColumnFile values_;
+    std::function<const std::vector<std::vector<double>>&(const ChartMetrics&)> get_;
+};
+
+class LabelsColumn : public Column {
+public:
+    explicit LabelsColumn(std::string name)
+        : Column(name, "labels", "f64,utf8"),
+          offsets_(name + ".offsets.u64"),
+          beats_(name + ".beat.f64"),
+          text_offsets_(name + ".label.offsets.u64"),
+          text_(name + ".label.bytes") {}
+
+    bool open(const std::filesystem::path& dir) override {
+        return offsets_.open(dir) && beats_.open(dir) && text_offsets_.open(dir) && text_.open(dir);
+    }
+    void add(const ChartMetrics& m) override {
+        for (const TimingLabelOut& label : m.timing_labels) {
+            beats_.f64(label.beat);
+            const std::string_view text = as_utf8(label.label, scratch_);
+            text_.bytes(text);
+            text_offsets_.advance(text.size());
+        }
+        offsets_.advance(m.timing_labels.size());
+    }
+    bool close() override {
+        return offsets_.file.close() && beats_.close() && text_offsets_.file.close() && text_.close();
+    }
+    std::vector<std::string> files() const override {
+        return {offsets_.file.name(), beats_.name(), text_offsets_.file.name(), text_.name()};
+    }
+
+private:
+    Offsets offsets_;
+    ColumnFile beats_;
+    Offsets text_offsets_;
+    ColumnFile text_;
+    std::string scratch_;
+};
+
+class StreamSequencesColumn : public Column {
+public:
+    explicit StreamSequencesColumn(std::string name)
+        : Column(name, "stream_sequences", "i32,i32,u8"),
+          offsets_(name + ".offsets.u64"),
+          starts_(name + ".stream_start.i32"),
+          ends_(name + ".stream_end.i32"),
+          breaks_(name + ".is_break.u8") {}
+
+    bool open(const std::filesystem::path& dir) override {
+        return offsets_.open(dir) && starts_.open(dir) && ends_.open(dir) && breaks_.open(dir);
+    }
+    void add(const ChartMetrics& m) override {
+        for (const StreamSequenceOut& seq : m.stream_sequences) {
+            starts_.i32(seq.stream_start);
+            ends_.i32(seq.stream_end);
+            breaks_.u8(seq.is_break ? 1 : 0);
+        }
+        offsets_.advance(m.stream_sequences.size());
+    }
+    bool close() override {
+        return offsets_.file.close() && starts_.close() && ends_.close() && breaks_.close();
+    }
+    std::vector<std::string> files() const override {
+        return {offsets_.file.name(), starts_.name(), ends_.name(), breaks_.name()};
+    }
+
+private:
+    Offsets offsets_;
+    ColumnFile starts_;
+    ColumnFile ends_;
+    ColumnFile breaks_;
+};
+
+std::unique_ptr<Column> string_column(std::string name, std::string ChartMetrics::*member) {
+    return std::make_unique<StringColumn>(
+        std::move(name), [member](const ChartMetrics& m) -> const std::string& { return m.*member; });
+}
+
+std::unique_ptr<Column> int_column(std::string name, int ChartMetrics::*member) {
+    return std::make_unique<ScalarColumn<int>>(
+        std::move(name), [member](const ChartMetrics& m) { return m.*member; });
+}
+
+std::unique_ptr<Column> double_column(std::string name, double ChartMetrics::*member) {
+    return std::make_unique<ScalarColumn<double>>(
+        std::move(name), [member](const ChartMetrics& m) { return m.*member; });
+}
+
+std::unique_ptr<Column> table_column(std::string name, std::vector<std::vector<double>> ChartMetrics::*member) {
+    return std::make_unique<TableColumn>(
+        std::move(name),
+        [member](const ChartMetrics& m) -> const std::vector<std::vector<double>>& { return m.*member; });
+}
+
+std::unique_ptr<Column> tech_column(std::string name, int TechCountsOut::*member) {
+    return std::make_unique<ScalarColumn<int>>(
+        std::move(name), [member](const ChartMetrics& m) { return m.tech.*member; });
+}
+
+// Columns for one field, named after its JSON key (nested keys joined by '.').
+void add_field_columns(ChartField field, std::vector<std::unique_ptr<Column>>& out) {
+    const std::string name(chart_field_name(field));
+    switch (field) {
+        case ChartField::Status: out.push_back(string_column(name, &ChartMetrics::status)); break;
+        case ChartField::Simfile: out.push_back(string_column(name, &ChartMetrics::simfile)); break;
+        case ChartField::Title: out.push_back(string_column(name, &ChartMetrics::title)); break;
+        case ChartField::Subtitle: out.push_back(string_column(name, &ChartMetrics::subtitle)); break;
+        case ChartField::Artist: out.push_back(string_column(name, &ChartMetrics::artist)); break;
+        case ChartField::TitleTranslated: out.push_back(string_column(name, &ChartMetrics::title_translated)); break;
+        case ChartField::SubtitleTranslated: out.push_back(string_column(name, &ChartMetrics::subtitle_translated)); break;
+        case ChartField::ArtistTranslated: out.push_back(string_column(name, &ChartMetrics::artist_translated)); break;
+        case ChartField::StepArtist: out.push_back(string_column(name, &ChartMetrics::step_artist)); break;
+        case ChartField::Description: out.push_back(string_column(name, &ChartMetrics::description)); break;
+        case ChartField::StepsType: out.push_back(string_column(name, &ChartMetrics::steps_type)); break;
+        case ChartField::Difficulty: out.push_back(string_column(name, &ChartMetrics::difficulty)); break;
+        case ChartField::Meter: out.push_back(int_column(name, &ChartMetrics::meter)); break;
+        case ChartField::Bpms: out.push_back(string_column(name, &ChartMetrics::bpms)); break;
+        case ChartField::HashBpms: out.push_back(string_column(name, &ChartMetrics::hash_bpms)); break;
+        case ChartField::BpmMin: out.push_back(double_column(name, &ChartMetrics::bpm_min)); break;
+        case ChartField::BpmMax: out.push_back(double_column(name, &ChartMetrics::bpm_max)); break;
+        case ChartField::DisplayBpm: out.push_back(string_column(name, &ChartMetrics::display_bpm)); break;
+        case ChartField::DisplayBpmMin: out.push_back(double_column(name, &ChartMetrics::display_bpm_min)); break;
+        case ChartField::DisplayBpmMax: out.push_back(double_column(name, &ChartMetrics::display_bpm_max)); break;
+        case ChartField::Hash: out.push_back(string_column(name, &ChartMetrics::hash)); break;
+        case ChartField::DurationSeconds: out.push_back(double_column(name, &ChartMetrics::duration_seconds)); break;
+        case ChartField::StreamsBreakdown: out.push_back(string_column(name, &ChartMetrics::streams_breakdown)); break;
+        case ChartField::StreamsBreakdownLevel1: out.push_back(string_column(name, &ChartMetrics::streams_breakdown_level1)); break;
+        case ChartField::StreamsBreakdownLevel2: out.push_back(string_column(name, &ChartMetrics::streams_breakdown_level2)); break;
+        case ChartField::StreamsBreakdownLevel3: out.push_back(string_column(name, &ChartMetrics::streams_breakdown_level3)); break;
+        case ChartField::TotalStreamMeasures: out.push_back(int_column(name, &ChartMetrics::total_stream_measures)); break;
+        case ChartField::TotalBreakMeasures: out.push_back(int_column(name, &ChartMetrics::total_break_measures)); break;
+        case ChartField::TotalSteps: out.push_back(int_column(name, &ChartMetrics::total_steps)); break;
+        case ChartField::NotesPerMeasure:
+            out.push_back(std::make_unique<ListColumn<int>>(
+                name, [](const ChartMetrics& m) -> const std::vector<int>& { return m.notes_per_measure; }));
+            break;
+        case ChartField::NpsPerMeasure:
+            out.push_back(std::make_unique<ListColumn<double>>(
+                name, [](const ChartMetrics& m) -> const std::vector<double>& { return m.nps_per_measure; }));
+            break;
+        case ChartField::EquallySpacedPerMeasure:
+            out.push_back(std::make_unique<ListColumn<bool>>(
+                name, [](const ChartMetrics& m) -> const std::vector<bool>& { return m.equally_spaced_per_measure; }));
+            break;
+        case ChartField::PeakNps: out.push_back(double_column(name, &ChartMetrics::peak_nps)); break;
+        case ChartField::StreamSequences: out.push_back(std::make_unique<StreamSequencesColumn>(name)); break;
+        case ChartField::Holds: out.push_back(int_column(name, &ChartMetrics::holds)); break;
+        case ChartField::Mines: out.push_back(int_column(name, &ChartMetrics::mines)); break;
+        case ChartField::Rolls: out.push_back(int_column(name, &ChartMetrics::rolls)); break;
+        case ChartField::TapsAndHolds: out.push_back(int_column(name, &ChartMetrics::taps_and_holds)); break;
+        case ChartField::Notes: out.push_back(int_column(name, &ChartMetrics::notes)); break;
+        case ChartField::Lifts: out.push_back(int_column(name, &ChartMetrics::lifts)); break;
+        case ChartField::Fakes: out.push_back(int_column(name, &ChartMetrics::fakes)); break;
+        case ChartField::Jumps: out.push_back(int_column(name, &ChartMetrics::jumps)); break;
+        case ChartField::Hands: out.push_back(int_column(name, &ChartMetrics::hands)); break;
+        case ChartField::Quads: out.push_back(int_column(name, &ChartMetrics::quads)); break;
+        case ChartField::Timing:
+            out.push_back(double_column("timing.beat0_offset_seconds", &ChartMetrics::beat0_offset_seconds));
+            out.push_back(double_column("timing.beat0_group_offset_seconds", &ChartMetrics::beat0_group_offset_seconds));
+            out.push_back(table_column("timing.bpms", &ChartMetrics::timing_bpms));
+            out.push_back(table_column("timing.stops", &ChartMetrics::timing_stops));
+            out.push_back(table_column("timing.delays", &ChartMetrics::timing_delays));
+            out.push_back(table_column("timing.time_signatures", &ChartMetrics::timing_time_signatures));
+            out.push_back(table_column("timing.warps", &ChartMetrics::timing_warps));
+            out.push_back(std::make_unique<LabelsColumn>("timing.labels"));
+            out.push_back(table_column("timing.tickcounts", &ChartMetrics::timing_tickcounts));
+            out.push_back(table_column("timing.combos", &ChartMetrics::timing_combos));
+            out.push_back(table_column("timing.speeds", &ChartMetrics::timing_speeds));
+            out.push_back(table_column("timing.scrolls", &ChartMetrics::timing_scrolls));
+            out.push_back(table_column("timing.fakes", &ChartMetrics::timing_fakes));
+            break;
+        case ChartField::TechCounts:
+            out.push_back(tech_column("tech_counts.crossovers", &TechCountsOut::crossovers));
+            out.push_back(tech_column("tech_counts.footswitches", &TechCountsOut::footswitches));
+            out.push_back(tech_column("tech_counts.sideswitches", &TechCountsOut::sideswitches));
+            out.push_back(tech_column("tech_counts.jacks", &TechCountsOut::jacks));
+            out.push_back(tech_column("tech_counts.brackets", &TechCountsOut::brackets));
+            out.push_back(tech_column("tech_counts.doublesteps", &TechCountsOut::doublesteps));
+            break;
+        case ChartField::Count: break;
+    }
+}
+
+} // namespace
+
+ColumnarExport::ColumnarExport(std::string dir, const ChartFieldSet& fields)
+    : dir_(std::move(dir)), fields_(fields) {}
+
+ColumnarExport::~ColumnarExport() = default;
+
+bool ColumnarExport::open(std::string* error) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    if (ec) {
+        if (error) *error = "cannot create " + dir_ + ": " + ec.message();
+        return false;
+    }
+    // A schema left over from an earlier export would describe files that are
+    // about to be rewritten.
+    std::filesystem::remove(std::filesystem::path(dir_) / "schema.json", ec);
+
+    for (size_t i = 0; i < kChartFieldCount; ++i) {
+        const ChartField field = static_cast<ChartField>(i);
+        if (has_field(fields_, field)) add_field_columns(field, columns_);
+    }
+    for (const auto& column : columns_) {
+        if (!column->open(dir_)) {
+            if (error) *error = "cannot create column files in " + dir_;
+            return false;
+        }
+    }
+    return true;
+}
+
+void ColumnarExport::add(const ChartMetrics& m) {
+    for (const auto& column : columns_) column->add(m);
+    ++rows_;
+}
+
+bool ColumnarExport::finish(std::string_view harness_version, std::string* error) {
+    bool ok = true;
+    for (const auto& column : columns_) ok = column->close() && ok;
+    if (!ok) {
+        if (error) *error = "failed writing column files in " + dir_;
+        return false;
+    }
+
+    JsonWriter schema;
+    schema.raw("{\"format\":\"itgmania-reference-columns\",\"version\":1,\"harness_version\":");
+    schema.string(harness_version);
+    schema.raw(",\"byte_order\":\"little\",\"rows\":");
+    schema.raw(std::to_string(rows_));
+    schema.raw(",\"columns\":[");
+    for (size_t i = 0; i < columns_.size(); ++i) {
+        if (i > 0) schema.raw(',');
+        schema.raw("\n  ");
+        columns_[i]->describe(schema);
+    }
+    schema.raw("\n]}\n");
+
+    std::ofstream out(std::filesystem::path(dir_) / "schema.json", std::ios::binary | std::ios::trunc);
+    schema.flush_to(out);
+    out.close();
+    if (!out) {
+        if (error) *error = "cannot write " + dir_ + "/schema.json";
+        return false;
+    }
+    return true;
+}
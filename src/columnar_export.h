@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chart_fields.h"
+#include "itgmania_adapter.h"
+
+// Writes charts as a directory of column files, one row per chart, so corpus
+// queries can mmap just the columns they read. All files are little-endian
+// arrays with no header:
+//   <name>.i32 / <name>.f64                    one value per chart
+//   <name>.offsets.u64 + <name>.bytes          strings (UTF-8), n + 1 offsets
+//   <name>.offsets.u64 + <name>.values.<type>  per-chart lists
+//   <name>.offsets.u64 + <name>.row_offsets.u64 + <name>.values.f64
+//                                              timing tables (rows of numbers)
+// Offsets start at 0 and have one more entry than the level they index.
+// schema.json lists every column with its kind, value type and files, plus
+// the row count; it is written last, so a directory without it is incomplete.
+class ColumnarExport {
+public:
+    ColumnarExport(std::string dir, const ChartFieldSet& fields);
+    ~ColumnarExport();
+
+    ColumnarExport(const ColumnarExport&) = delete;
+    ColumnarExport& operator=(const ColumnarExport&) = delete;
+
+    // Creates the directory and column files. On failure returns false and
+    // describes the problem in error.
+    bool open(std::string* error);
+
+    void add(const ChartMetrics& m);
+
+    // Flushes every column and writes schema.json.
+    bool finish(std::string_view harness_version, std::string* error);
+
+    class Column;
+
+private:
+    std::string dir_;
+    ChartFieldSet fields_;
+    std::vector<std::unique_ptr<Column>> columns_;
+    size_t rows_ = 0;
+};
@@ -0,0 +1,203 @@
+#include "compiled_simfile.h"
+
+#include "binary_archive.h"
+
+#include <cstring>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[4] = {'I', 'T', 'G', 'C'};
+// Bump when the layout or what is stored changes.
+constexpr uint32_t kFormatVersion = 3;
+constexpr size_t kKeySize = 32;
+// magic, version, key, note count, metadata size; the note array follows
+// (4-byte aligned), then the metadata.
+constexpr size_t kHeaderSize = sizeof(kMagic) + sizeof(uint32_t) + kKeySize + 2 * sizeof(uint64_t);
+static_assert(kHeaderSize % alignof(CompiledTapNote) == 0, "note array must stay aligned");
+
+// Everything but the note rows, in file order. Both archives below take the
+// same lists, so reading always mirrors writing.
+template <typename Archive, typename Timing>
+void timing_members(Archive& ar, Timing& t) {
+    ar(t.beat0_offset);
+    ar(t.beat0_group_offset);
+    ar.count(t.segments);
+    for (auto& segment : t.segments) {
+        ar(segment.type);
+        ar(segment.row);
+        ar.count(segment.values);
+        for (auto& value : segment.values) ar(value);
+        ar(segment.label);
+    }
+}
+
+template <typename Archive, typename Chart>
+void chart_members(Archive& ar, Chart& c) {
+    ar(c.steps_type);
+    ar(c.steps_type_name);
+    ar(c.difficulty);
+    ar(c.meter);
+    ar(c.description);
+    ar(c.chart_name);
+    ar(c.credit);
+    ar(c.display_bpm);
+    ar(c.min_bpm);
+    ar(c.max_bpm);
+    ar(c.own_timing);
+    timing_members(ar, c.timing);
+    ar(c.num_tracks);
+    ar(c.first_note);
+    ar(c.note_count);
+    ar(c.note_text);
+}
+
+template <typename Archive, typename Song>
+void song_members(Archive& ar, Song& s) {
+    ar(s.main_title);
+    ar(s.sub_title);
+    ar(s.artist);
+    ar(s.main_title_translit);
+    ar(s.sub_title_translit);
+    ar(s.artist_translit);
+    ar(s.genre);
+    ar(s.credit);
+    ar(s.display_bpm);
+    ar(s.specified_bpm_min);
+    ar(s.specified_bpm_max);
+    timing_members(ar, s.timing);
+    ar.count(s.charts);
+    for (auto& chart : s.charts) chart_members(ar, chart);
+}
+
+} // namespace
+
+std::string compiled_simfile_key(std::string_view extension, std::string_view simfile_bytes) {
+    return content_key({"itgc", extension, simfile_bytes});
+}
+
+std::string compiled_simfile_path(const std::string& dir, const std::string& key) {
+    return (fs::path(dir) / key.substr(0, 2) / (key + ".itgc")).string();
+}
+
+bool write_compiled_simfile(const std::string& path, const std::string& key, CompiledSong song,
+                            std::string* error) {
+    if (key.size() != kKeySize) {
+        if (error) *error = "bad key";
+        return false;
+    }
+    std::vector<CompiledTapNote> notes;
+    for (CompiledChart& chart : song.charts) {
+        chart.first_note = notes.size();
+        chart.note_count = chart.notes.size();
+        notes.insert(notes.end(), chart.notes.begin(), chart.notes.end());
+        chart.notes.clear();
+    }
+    BinaryWriter meta;
+    song_members(meta, song);
+
+    BinaryWriter file;
+    file.raw(kMagic, sizeof(kMagic));
+    file.raw(&kFormatVersion, sizeof(kFormatVersion));
+    file.raw(key.data(), kKeySize);
+    file(static_cast<uint64_t>(notes.size()));
+    file(static_cast<uint64_t>(meta.str().size()));
+    file.raw(notes.data(), notes.size() * sizeof(CompiledTapNote));
+    file.raw(meta.str().data(), meta.str().size());
+
+    return write_file_atomically(path, file.str(), error);
+}
+
+CompiledSimfile::~CompiledSimfile() {
+    close();
+}
+
+void CompiledSimfile::close() {
+#ifdef _WIN32
+    contents_.clear();
+#else
+    if (data_) munmap(const_cast<char*>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    notes_ = nullptr;
+    song_ = CompiledSong();
+}
+
+bool CompiledSimfile::open(const std::string& path, const std::string& key, std::string* error) {
+    close();
+#ifdef _WIN32
+    if (!read_file(path, contents_)) {
+        if (error) *error = "cannot read " + path;
+        return false;
+    }
+    data_ = contents_.data();
+    size_ = contents_.size();
+#else
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st {};
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) ::close(fd);
+            if (error) *error = "cannot read " + path;
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        void* mapped = size_ ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            size_ = 0;
+            if (error) *error = "cannot map " + path;
+            return false;
+        }
+        data_ = static_cast<const char*>(mapped);
+    }
+#endif
+
+    BinaryReader header(std::string_view(data_, size_));
+    char magic[sizeof(kMagic)] = {};
+    uint32_t version = 0;
+    char stored_key[kKeySize] = {};
+    uint64_t note_count = 0;
+    uint64_t meta_size = 0;
+    header.raw(magic, sizeof(magic));
+    header.raw(&version, sizeof(version));
+    header.raw(stored_key, sizeof(stored_key));
+    header(note_count);
+    header(meta_size);
+    const uint64_t body = size_ - kHeaderSize;
+    if (!header.ok() || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kFormatVersion ||
+        key.size() != kKeySize || std::memcmp(stored_key, key.data(), kKeySize) != 0 ||
+        note_count > body / sizeof(CompiledTapNote) || meta_size != body - note_count * sizeof(CompiledTapNote)) {
+        close();
+        if (error) *error = path + " is not a compiled form of this simfile";
+        return false;
+    }
+
+    BinaryReader meta(std::string_view(data_ + size_ - meta_size, meta_size));
+    song_members(meta, song_);
+    bool ok = meta.ok() && meta.at_end();
+    for (const CompiledChart& chart : song_.charts) {
+        if (chart.first_note > note_count || chart.note_count > note_count - chart.first_note) ok = false;
+    }
+    if (!ok) {
+        close();
+        if (error) *error = path + " is damaged";
+        return false;
+    }
+    notes_ = reinterpret_cast<const CompiledTapNote*>(data_ + kHeaderSize);
+    return true;
+}
+
+const CompiledTapNote* CompiledSimfile::notes(size_t chart) const {
+    return notes_ + song_.charts[chart].first_note;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A simfile after ITGmania's loader has parsed it, in a binary file that is
+// mapped and read back without any text parsing: the song's metadata, every
+// TimingData segment and every chart's note rows, i.e. what the analyses read
+// from Song and Steps. Note rows are stored as a packed array and used in
+// place from the mapping. Host byte order, like the result cache.
+
+// One non-empty TapNote. The enums are stored as their ITGmania values.
+struct CompiledTapNote {
+    int32_t row = 0;
+    int32_t duration = 0;
+    uint8_t track = 0;
+    uint8_t type = 0;
+    uint8_t sub_type = 0;
+    uint8_t source = 0;
+};
+static_assert(sizeof(CompiledTapNote) == 12, "CompiledTapNote is stored as-is");
+
+struct CompiledTimingSegment {
+    int32_t type = 0;  // TimingSegmentType
+    int32_t row = 0;
+    std::vector<float> values;  // TimingSegment::GetValues()
+    std::string label;          // LabelSegment only
+};
+
+struct CompiledTiming {
+    float beat0_offset = 0.0f;
+    float beat0_group_offset = 0.0f;
+    std::vector<CompiledTimingSegment> segments;
+};
+
+struct CompiledChart {
+    // Steps types and difficulties are stored by name; steps_type is empty
+    // for a steps type ITGmania does not know, steps_type_name is the
+    // simfile's spelling.
+    std::string steps_type;
+    std::string steps_type_name;
+    std::string difficulty;
+    int32_t meter = 0;
+    std::string description;
+    std::string chart_name;
+    std::string credit;
+    int32_t display_bpm = 0;  // DisplayBPM
+    float min_bpm = 0.0f;
+    float max_bpm = 0.0f;
+    // Charts without split timing use the song's.
+    bool own_timing = false;
+    CompiledTiming timing;
+    int32_t num_tracks = 0;
+    // Where the chart's rows sit in the file's note array; filled in by
+    // write_compiled_simfile.
+    uint64_t first_note = 0;
+    uint64_t note_count = 0;
+    // The rows to write, track by track. Empty on charts read back; see
+    // CompiledSimfile::notes().
+    std::vector<CompiledTapNote> notes;
+    // The note text as the loader kept it (Steps::GetSMNoteData). Not decoded
+    // on load; only read by what SL hashes or counts from the text itself.
+    std::string note_text;
+};
+
+struct CompiledSong {
+    std::string main_title;
+    std::string sub_title;
+    std::string artist;
+    std::string main_title_translit;
+    std::string sub_title_translit;
+    std::string artist_translit;
+    std::string genre;
+    std::string credit;
+    int32_t display_bpm = 0;  // DisplayBPM
+    float specified_bpm_min = 0.0f;
+    float specified_bpm_max = 0.0f;
+    CompiledTiming timing;
+    std::vector<CompiledChart> charts;
+};
+
+// Compiled files are found by content: a content_key over the simfile's
+// extension (which picks the loader) and bytes. An edited simfile simply has
+// no compiled file until it is compiled again.
+std::string compiled_simfile_key(std::string_view extension, std::string_view simfile_bytes);
+
+// <dir>/<2 hex digits>/<key>.itgc
+std::string compiled_simfile_path(const std::string& dir, const std::string& key);
+
+// Writes to a temporary name and renames, so readers never see half a file.
+// On failure returns false and describes the problem in error.
+bool write_compiled_simfile(const std::string& path, const std::string& key, CompiledSong song,
+                            std::string* error);
+
+// A compiled file mapped into memory.
+class CompiledSimfile {
+public:
+    CompiledSimfile() = default;
+    ~CompiledSimfile();
+
+    CompiledSimfile(const CompiledSimfile&) = delete;
+    CompiledSimfile& operator=(const CompiledSimfile&) = delete;
+
+    // Maps the file and reads the metadata. Fails (describing why in error)
+    // when the file is missing, damaged, from another format version or
+    // compiled from other bytes than key.
+    bool open(const std::string& path, const std::string& key, std::string* error);
+
+    const CompiledSong& song() const { return song_; }
+
+    // The note rows of song().charts[chart], in place in the mapping.
+    const CompiledTapNote* notes(size_t chart) const;
+
+private:
+    void close();
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    std::string contents_;
+#endif
+    const CompiledTapNote* notes_ = nullptr;
+    CompiledSong song_;
+};
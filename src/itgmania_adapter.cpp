@@ -5,13 +5,24 @@ extern "C" {
 }
 
 #include "itgmania_adapter.h"
+#include "binary_archive.h"
+#include "compiled_simfile.h"
+#include "result_cache.h"
+#include "simfile_buffer.h"
+#include "sl_stream_engine.h"
+#include "thread_pool.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
 #include <iomanip>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -23,9 +34,13 @@ extern "C" {
 #include <optional>
 #include <unordered_map>
 #include <cstdio>
+#include <mutex>
 #include <tomcrypt.h>
 
 #include "embedded_lua.h"
+#ifdef HARNESS_SL_BYTECODE
+#include "embedded_lua_bytecode.h"
+#endif
 
 #ifdef ITGMANIA_HARNESS
 #include "global.h"
@@ -63,65 +78,127 @@ extern "C" {
 #include "TimingData.h"
 
 static void init_singletons(int argc, char** argv) {
-    static bool initialized = false;
-    static int stored_argc = 0;
-    static char** stored_argv = nullptr;
-    static char default_prog[] = "itgmania-reference-harness";
-    static char* default_argv[] = {default_prog, nullptr};
+    static std::once_flag once;
+    std::call_once(once, [argc, argv]() {
+        static char default_prog[] = "itgmania-reference-harness";
+        static char* default_argv[] = {default_prog, nullptr};
 
-    if (initialized) return;
+        if (argv != nullptr) {
+            SetCommandlineArguments(argc, argv);
+        } else {
+            SetCommandlineArguments(1, default_argv);
+        }
 
-    if (argv != nullptr) {
-        stored_argc = argc;
-        stored_argv = argv;
-    }
-    if (stored_argv == nullptr) {
-        stored_argc = 1;
-        stored_argv = default_argv;
-    }
+        if (!LOG) {
+            LOG = new RageLog;
+            LOG->SetLogToDisk(false);
+            LOG->SetInfoToDisk(false);
+            LOG->SetUserLogToDisk(false);
+            LOG->SetShowLogOutput(false);
+        }
 
-    SetCommandlineArguments(stored_argc, stored_argv);
+        if (!PREFSMAN) {
+#ifdef ITGMANIA_HARNESS_SOURCE
+            // Harness provides a minimal PREFSMAN in stubs.
+            (void)0;
+#else
+            PREFSMAN = new PrefsManager;
+            PREFSMAN->m_bLogToDisk.Set(false);
+            PREFSMAN->m_bForceLogFlush.Set(false);
+#endif
+        }
 
-    if (!LOG) {
-        LOG = new RageLog;
-        LOG->SetLogToDisk(false);
-        LOG->SetInfoToDisk(false);
-        LOG->SetUserLogToDisk(false);
-        LOG->SetShowLogOutput(false);
-    }
+        if (!MESSAGEMAN) {
+            MESSAGEMAN = new MessageManager;
+        }
 
-    if (!PREFSMAN) {
+        if (!GAMEMAN) {
+            GAMEMAN = new GameManager;
+        }
+
+        if (!GAMESTATE) {
+            GAMESTATE = new GameState;
+        }
+    });
+}
+
+void init_itgmania_runtime(int argc, char** argv) {
+    init_singletons(argc, argv);
+}
+
+bool itgmania_runtime_is_thread_safe() {
 #ifdef ITGMANIA_HARNESS_SOURCE
-        // Harness provides a minimal PREFSMAN in stubs.
-    (void)0;
+    // The harness stubs keep GAMESTATE's processed timing per thread and back
+    // RageMutex/RageThread with real primitives.
+    return true;
 #else
-        PREFSMAN = new PrefsManager;
-        PREFSMAN->m_bLogToDisk.Set(false);
-        PREFSMAN->m_bForceLogFlush.Set(false);
+    // A prebuilt engine has one process-wide GameState.
+    return false;
 #endif
-    }
+}
 
-    if (!MESSAGEMAN) {
-        MESSAGEMAN = new MessageManager;
+// Serializes analysis when the engine singletons are process-global.
+static std::unique_lock<std::mutex> lock_runtime_if_shared() {
+    static std::mutex mutex;
+    if (itgmania_runtime_is_thread_safe()) {
+        return std::unique_lock<std::mutex>(mutex, std::defer_lock);
     }
+    return std::unique_lock<std::mutex>(mutex);
+}
 
-    if (!GAMEMAN) {
-        GAMEMAN = new GameManager;
-    }
+static std::string& sl_scripts_dir() {
+    static std::string dir;
+    return dir;
+}
 
-    if (!GAMESTATE) {
-        GAMESTATE = new GameState;
-    }
+void set_sl_scripts_dir(const std::string& dir) {
+    sl_scripts_dir() = dir;
+}
 
-    initialized = true;
+static std::string_view embedded_sl_chart_parser() {
+    return embedded_lua::kSLChartParserLua;
 }
 
-void init_itgmania_runtime(int argc, char** argv) {
-    init_singletons(argc, argv);
+static std::string_view embedded_sl_chart_parser_helpers() {
+    return embedded_lua::kSLChartParserHelpersLua;
+}
+
+// Precompiled Lua bytecode of the embedded scripts when the build could
+// produce it (see sl_bytecode_compiler), empty otherwise.
+static std::string_view embedded_sl_chart_parser_bytecode() {
+#ifdef HARNESS_SL_BYTECODE
+    return embedded_lua::kSLChartParserBytecode;
+#else
+    return {};
+#endif
 }
 
-static bool load_lua_chunk(lua_State* L, const std::string& path, std::string_view embedded_src, const char* label) {
-    if (std::filesystem::exists(path)) {
+static std::string_view embedded_sl_chart_parser_helpers_bytecode() {
+#ifdef HARNESS_SL_BYTECODE
+    return embedded_lua::kSLChartParserHelpersBytecode;
+#else
+    return {};
+#endif
+}
+
+// Loads and runs one embedded chunk, leaving the Lua error message in err.
+static bool run_embedded_chunk(lua_State* L, std::string_view chunk, const char* label, std::string& err) {
+    if (luaL_loadbuffer(L, chunk.data(), chunk.size(), label) != 0 || lua_pcall(L, 0, 0, 0) != 0) {
+        err = lua_tostring(L, -1) ? lua_tostring(L, -1) : "";
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+// Runs the embedded copy of a script unless --sl-scripts named a directory to
+// load it from; a script that fails to load from disk falls back to the
+// embedded copy. The embedded bytecode is tried before the embedded source,
+// which still loads when the bytecode doesn't fit this Lua build.
+static bool load_lua_chunk(lua_State* L, const char* script_name, std::string_view embedded_bytecode,
+                           std::string_view embedded_src, const char* label) {
+    if (!sl_scripts_dir().empty()) {
+        const std::string path = (std::filesystem::path(sl_scripts_dir()) / script_name).string();
         if (luaL_dofile(L, path.c_str()) == 0) return true;
 
         std::string err = lua_tostring(L, -1) ? lua_tostring(L, -1) : "";
@@ -134,24 +211,19 @@ static bool load_lua_chunk(lua_State* L, const std::string& path, std::string_vi
 
         std::fprintf(stderr, "lua load error (%s): %s; using embedded copy\n", label, err.c_str());
     } else if (embedded_src.empty()) {
-        std::fprintf(stderr, "lua load error (%s): missing %s and no embedded copy\n", label, path.c_str());
+        std::fprintf(stderr, "lua load error (%s): no embedded copy; pass --sl-scripts <dir>\n", label);
         return false;
     }
 
-    if (luaL_loadbuffer(L, embedded_src.data(), embedded_src.size(), label) != 0) {
-        std::fprintf(stderr, "embedded lua compile error (%s): %s\n", label,
-            lua_tostring(L, -1) ? lua_tostring(L, -1) : "");
-        lua_pop(L, 1);
-        return false;
+    std::string err;
+    if (!embedded_bytecode.empty()) {
+        if (run_embedded_chunk(L, embedded_bytecode, label, err)) return true;
+        std::fprintf(stderr, "embedded lua bytecode error (%s): %s; using embedded source\n", label, err.c_str());
     }
-
-    if (lua_pcall(L, 0, 0, 0) != 0) {
-        std::fprintf(stderr, "embedded lua runtime error (%s): %s\n", label,
-            lua_tostring(L, -1) ? lua_tostring(L, -1) : "");
-        lua_pop(L, 1);
+    if (!run_embedded_chunk(L, embedded_src, label, err)) {
+        std::fprintf(stderr, "embedded lua error (%s): %s\n", label, err.c_str());
         return false;
     }
-
     return true;
 }
 
@@ -287,14 +359,19 @@ static bool extract_tag_value(
 
 static RawSimfileMetadataTags read_simfile_metadata_tags(const std::string& simfile_path) {
     RawSimfileMetadataTags out;
-    std::ifstream in(simfile_path, std::ios::binary);
-    if (!in) {
-        return out;
+    const SimfileBytes buffered = find_simfile_buffer(simfile_path);
+    std::string from_disk;
+    if (!buffered) {
+        std::ifstream in(simfile_path, std::ios::binary);
+        if (!in) {
+            return out;
+        }
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        from_disk = ss.str();
     }
 
-    std::ostringstream ss;
-    ss << in.rdbuf();
-    const std::string data = ss.str();
+    const std::string& data = buffered ? *buffered : from_disk;
     if (data.empty()) {
         return out;
     }
@@ -471,7 +548,243 @@ static void get_bpm_ranges_like_simply_love(
     out_display_str = stringify_display_bpms_like_simply_love(out_display_min, out_display_max, music_rate);
 }
 
-static bool load_song(const std::string& simfile_path, Song& song) {
+static std::string& compiled_simfile_dir() {
+    static std::string dir;
+    return dir;
+}
+
+void set_compiled_simfile_dir(const std::string& dir) {
+    compiled_simfile_dir() = dir;
+}
+
+// Charts built from a compiled file get their rows through SetNoteData and so
+// have no note text: GetSMNoteData would write one from the rows, without
+// what SL hashes and counts from the loader's text (its spelling, empty
+// measures at the end). Their text stays with the mapped file and is listed
+// here while the song is loaded.
+static std::mutex& compiled_note_texts_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::unordered_map<const Steps*, const std::string*>& compiled_note_texts() {
+    static std::unordered_map<const Steps*, const std::string*> texts;
+    return texts;
+}
+
+// The note text the loader kept for steps, for what is hashed or counted
+// from it rather than from the notes.
+static void get_chart_note_text(const Steps* steps, RString& out) {
+    {
+        std::lock_guard<std::mutex> lock(compiled_note_texts_mutex());
+        const auto it = compiled_note_texts().find(steps);
+        if (it != compiled_note_texts().end()) {
+            out = RString(it->second->data(), it->second->size());
+            return;
+        }
+    }
+    steps->GetSMNoteData(out);
+}
+
+// Keeps a compiled file mapped, and the note texts of the charts built from
+// it listed, while their song is analyzed. Declared after the Song, so the
+// texts are dropped before its Steps are freed.
+class CompiledSongScope {
+public:
+    CompiledSongScope() = default;
+    CompiledSongScope(const CompiledSongScope&) = delete;
+    CompiledSongScope& operator=(const CompiledSongScope&) = delete;
+
+    ~CompiledSongScope() {
+        std::lock_guard<std::mutex> lock(compiled_note_texts_mutex());
+        for (const Steps* steps : charts_) compiled_note_texts().erase(steps);
+    }
+
+    CompiledSimfile& file() { return file_; }
+
+    void add_chart(const Steps* steps, const std::string& note_text) {
+        std::lock_guard<std::mutex> lock(compiled_note_texts_mutex());
+        compiled_note_texts()[steps] = &note_text;
+        charts_.push_back(steps);
+    }
+
+private:
+    CompiledSimfile file_;
+    std::vector<const Steps*> charts_;
+};
+
+static std::string compiled_key_for(const std::string& simfile_path, const std::string& bytes) {
+    RString ext = GetExtension(simfile_path);
+    ext.MakeLower();
+    return compiled_simfile_key(ext.c_str(), bytes);
+}
+
+static CompiledTiming compile_timing(const TimingData& td) {
+    CompiledTiming out;
+    out.beat0_offset = td.m_fBeat0OffsetInSeconds;
+    out.beat0_group_offset = td.m_fBeat0GroupOffsetInSeconds;
+    for (int type = 0; type < NUM_TimingSegmentType; ++type) {
+        for (TimingSegment* seg : td.GetTimingSegments(static_cast<TimingSegmentType>(type))) {
+            CompiledTimingSegment segment;
+            segment.type = type;
+            segment.row = seg->GetRow();
+            if (type == SEGMENT_LABEL) {
+                segment.label = ToLabel(seg)->GetLabel().c_str();
+            } else {
+                segment.values = seg->GetValues();
+            }
+            out.segments.push_back(std::move(segment));
+        }
+    }
+    return out;
+}
+
+// The segments were already merged and sorted by the loader that compiled
+// them, so adding them back in order rebuilds the same TimingData.
+static void load_compiled_timing(TimingData& td, const CompiledTiming& in) {
+    td.m_fBeat0OffsetInSeconds = in.beat0_offset;
+    td.m_fBeat0GroupOffsetInSeconds = in.beat0_group_offset;
+    for (const CompiledTimingSegment& seg : in.segments) {
+        auto value = [&](size_t i) { return i < seg.values.size() ? seg.values[i] : 0.0f; };
+        auto int_value = [&](size_t i) { return static_cast<int>(std::lround(value(i))); };
+        switch (static_cast<TimingSegmentType>(seg.type)) {
+        case SEGMENT_BPM: td.AddSegment(BPMSegment(seg.row, value(0))); break;
+        case SEGMENT_STOP: td.AddSegment(StopSegment(seg.row, value(0))); break;
+        case SEGMENT_DELAY: td.AddSegment(DelaySegment(seg.row, value(0))); break;
+        case SEGMENT_TIME_SIG: td.AddSegment(TimeSignatureSegment(seg.row, int_value(0), int_value(1))); break;
+        case SEGMENT_WARP: td.AddSegment(WarpSegment(seg.row, value(0))); break;
+        case SEGMENT_LABEL: td.AddSegment(LabelSegment(seg.row, seg.label.c_str())); break;
+        case SEGMENT_TICKCOUNT: td.AddSegment(TickcountSegment(seg.row, int_value(0))); break;
+        case SEGMENT_COMBO: td.AddSegment(ComboSegment(seg.row, int_value(0), int_value(1))); break;
+        case SEGMENT_SPEED:
+            td.AddSegment(SpeedSegment(seg.row, value(0), value(1),
+                                       static_cast<SpeedSegment::BaseUnit>(int_value(2))));
+            break;
+        case SEGMENT_SCROLL: td.AddSegment(ScrollSegment(seg.row, value(0))); break;
+        case SEGMENT_FAKE: td.AddSegment(FakeSegment(seg.row, value(0))); break;
+        default: break;
+        }
+    }
+}
+
+// What the analyses read from a loaded song; banners, music paths and the
+// like are left out.
+static CompiledSong compile_song(const Song& song) {
+    CompiledSong out;
+    out.main_title = song.m_sMainTitle.c_str();
+    out.sub_title = song.m_sSubTitle.c_str();
+    out.artist = song.m_sArtist.c_str();
+    out.main_title_translit = song.m_sMainTitleTranslit.c_str();
+    out.sub_title_translit = song.m_sSubTitleTranslit.c_str();
+    out.artist_translit = song.m_sArtistTranslit.c_str();
+    out.genre = song.m_sGenre.c_str();
+    out.credit = song.m_sCredit.c_str();
+    out.display_bpm = static_cast<int32_t>(song.m_DisplayBPMType);
+    out.specified_bpm_min = song.m_fSpecifiedBPMMin;
+    out.specified_bpm_max = song.m_fSpecifiedBPMMax;
+    out.timing = compile_timing(song.m_SongTiming);
+
+    for (const Steps* steps : song.GetAllSteps()) {
+        CompiledChart chart;
+        if (steps->m_StepsType != StepsType_Invalid) {
+            chart.steps_type = StepsTypeToString(steps->m_StepsType).c_str();
+        }
+        chart.steps_type_name = steps->m_StepsTypeStr.c_str();
+        chart.difficulty = DifficultyToString(steps->GetDifficulty()).c_str();
+        chart.meter = steps->GetMeter();
+        chart.description = steps->GetDescription().c_str();
+        chart.chart_name = steps->GetChartName().c_str();
+        chart.credit = steps->GetCredit().c_str();
+        chart.display_bpm = static_cast<int32_t>(steps->GetDisplayBPM());
+        chart.min_bpm = steps->GetMinBPM();
+        chart.max_bpm = steps->GetMaxBPM();
+        chart.own_timing = !steps->m_Timing.empty();
+        if (chart.own_timing) chart.timing = compile_timing(steps->m_Timing);
+
+        NoteData nd;
+        steps->GetNoteData(nd);
+        chart.num_tracks = nd.GetNumTracks();
+        for (int track = 0; track < nd.GetNumTracks(); ++track) {
+            for (auto it = nd.begin(track); it != nd.end(track); ++it) {
+                const TapNote& tn = it->second;
+                if (tn.type == TapNoteType_Empty) continue;
+                CompiledTapNote note;
+                note.row = it->first;
+                note.duration = tn.iDuration;
+                note.track = static_cast<uint8_t>(track);
+                note.type = static_cast<uint8_t>(tn.type);
+                note.sub_type = static_cast<uint8_t>(tn.subType);
+                note.source = static_cast<uint8_t>(tn.source);
+                chart.notes.push_back(note);
+            }
+        }
+        RString text;
+        steps->GetSMNoteData(text);
+        chart.note_text = text.c_str();
+        out.charts.push_back(std::move(chart));
+    }
+    return out;
+}
+
+// Builds the song from its compiled form under --compiled, when there is one
+// for these exact bytes. scope keeps the file mapped while the song is used.
+static bool load_compiled_song(const std::string& simfile_path, Song& song, CompiledSongScope& scope) {
+    if (compiled_simfile_dir().empty()) return false;
+    const SimfileBytes bytes = find_simfile_buffer(simfile_path);
+    if (!bytes) return false;
+    const std::string key = compiled_key_for(simfile_path, *bytes);
+    CompiledSimfile& compiled = scope.file();
+    if (!compiled.open(compiled_simfile_path(compiled_simfile_dir(), key), key, nullptr)) return false;
+
+    const CompiledSong& in = compiled.song();
+    song.m_sMainTitle = in.main_title.c_str();
+    song.m_sSubTitle = in.sub_title.c_str();
+    song.m_sArtist = in.artist.c_str();
+    song.m_sMainTitleTranslit = in.main_title_translit.c_str();
+    song.m_sSubTitleTranslit = in.sub_title_translit.c_str();
+    song.m_sArtistTranslit = in.artist_translit.c_str();
+    song.m_sGenre = in.genre.c_str();
+    song.m_sCredit = in.credit.c_str();
+    song.m_DisplayBPMType = static_cast<DisplayBPM>(in.display_bpm);
+    song.m_fSpecifiedBPMMin = in.specified_bpm_min;
+    song.m_fSpecifiedBPMMax = in.specified_bpm_max;
+    load_compiled_timing(song.m_SongTiming, in.timing);
+
+    for (size_t i = 0; i < in.charts.size(); ++i) {
+        const CompiledChart& chart = in.charts[i];
+        Steps* steps = song.CreateSteps();
+        steps->m_StepsType = chart.steps_type.empty() ? StepsType_Invalid
+                                                      : GAMEMAN->StringToStepsType(chart.steps_type.c_str());
+        steps->m_StepsTypeStr = chart.steps_type_name.c_str();
+        steps->SetDifficulty(StringToDifficulty(chart.difficulty.c_str()));
+        steps->SetMeter(chart.meter);
+        steps->SetDescription(chart.description.c_str());
+        steps->SetChartName(chart.chart_name.c_str());
+        steps->SetCredit(chart.credit.c_str());
+        steps->SetDisplayBPM(static_cast<DisplayBPM>(chart.display_bpm));
+        steps->SetMinBPM(chart.min_bpm);
+        steps->SetMaxBPM(chart.max_bpm);
+        if (chart.own_timing) load_compiled_timing(steps->m_Timing, chart.timing);
+
+        NoteData nd;
+        nd.SetNumTracks(chart.num_tracks);
+        const CompiledTapNote* notes = compiled.notes(i);
+        for (uint64_t n = 0; n < chart.note_count; ++n) {
+            TapNote tn;
+            tn.type = static_cast<TapNoteType>(notes[n].type);
+            tn.subType = static_cast<TapNoteSubType>(notes[n].sub_type);
+            tn.source = static_cast<TapNoteSource>(notes[n].source);
+            tn.iDuration = notes[n].duration;
+            nd.SetTapNote(notes[n].track, notes[n].row, tn);
+        }
+        steps->SetNoteData(nd);
+        scope.add_chart(steps, chart.note_text);
+        song.AddSteps(steps);
+    }
+    return true;
+}
+
+static bool load_song_from_text(const std::string& simfile_path, Song& song) {
     RString ext = GetExtension(simfile_path);
     ext.MakeLower();
     if (ext == "ssc" || ext == "ats") {
@@ -485,12 +798,18 @@ static bool load_song(const std::string& simfile_path, Song& song) {
     return false;
 }
 
+static bool load_song(const std::string& simfile_path, Song& song, CompiledSongScope& compiled) {
+    return load_compiled_song(simfile_path, song, compiled) || load_song_from_text(simfile_path, song);
+}
+
 static std::string raw_bpms_from_msd(const std::string& simfile_path,
                                      const std::string& steps_type,
                                      const std::string& difficulty,
                                      const std::string& description) {
     MsdFile msd;
-    if (!msd.ReadFile(simfile_path, true)) {
+    if (const SimfileBytes buffered = find_simfile_buffer(simfile_path)) {
+        msd.ReadFromString(*buffered, true);
+    } else if (!msd.ReadFile(simfile_path, true)) {
         return {};
     }
 
@@ -598,13 +917,22 @@ static int lua_normalize_float_digits_override(lua_State* L) {
     return 1;
 }
 
-static bool install_normalize_bpms_override(lua_State* L, FallbackBpmOverride* ov) {
+// An upvalue of GetSimfileChartString (itself an upvalue of ParseChartInfo)
+// swapped out for one chart. The Lua state outlives the chart, so the original
+// has to be put back afterwards.
+struct NestedUpvalueOverride {
+    int owner_ref = LUA_NOREF;
+    int index = 0;
+    int original_ref = LUA_NOREF;
+};
+
+static NestedUpvalueOverride install_normalize_bpms_override(lua_State* L, FallbackBpmOverride* ov) {
+    NestedUpvalueOverride out;
     lua_getglobal(L, "ParseChartInfo");
     if (!lua_isfunction(L, -1)) {
         lua_pop(L, 1);
-        return false;
+        return out;
     }
-    bool replaced = false;
     for (int i = 1;; ++i) {
         const char* upname = lua_getupvalue(L, -1, i);
         if (!upname) break;
@@ -613,11 +941,13 @@ static bool install_normalize_bpms_override(lua_State* L, FallbackBpmOverride* o
                 const char* inner = lua_getupvalue(L, -1, j);
                 if (!inner) break;
                 if (std::string_view(inner) == "NormalizeFloatDigits") {
-                    lua_pop(L, 1);
+                    out.original_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+                    lua_pushvalue(L, -1);
+                    out.owner_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+                    out.index = j;
                     lua_pushlightuserdata(L, ov);
                     lua_pushcclosure(L, lua_normalize_float_digits_override, 1);
                     lua_setupvalue(L, -2, j);
-                    replaced = true;
                     break;
                 }
                 lua_pop(L, 1);
@@ -628,7 +958,20 @@ static bool install_normalize_bpms_override(lua_State* L, FallbackBpmOverride* o
         lua_pop(L, 1);
     }
     lua_pop(L, 1);
-    return replaced;
+    return out;
+}
+
+static void restore_normalize_bpms_override(lua_State* L, NestedUpvalueOverride& ov) {
+    if (ov.index <= 0) return;
+
+    const int top = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ov.owner_ref);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ov.original_ref);
+    lua_setupvalue(L, -2, ov.index);
+    luaL_unref(L, LUA_REGISTRYINDEX, ov.owner_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, ov.original_ref);
+    lua_settop(L, top);
+    ov = NestedUpvalueOverride{};
 }
 
 // ---------------------------------------------------------------------------
@@ -721,6 +1064,12 @@ static void push_steps_userdata(lua_State* L, LuaStepsCtx* ctx) {
 static int lua_ragefile_open(lua_State* L) {
     luaL_checktype(L, 1, LUA_TTABLE);
     const char* path = luaL_checkstring(L, 2);
+    if (const SimfileBytes buffered = find_simfile_buffer(path)) {
+        lua_pushstring(L, buffered->c_str());
+        lua_setfield(L, 1, "_contents");
+        lua_pushboolean(L, 1);
+        return 1;
+    }
     std::ifstream in(path, std::ios::binary);
     if (!in) {
         lua_pushboolean(L, 0);
@@ -815,7 +1164,8 @@ static bool extract_sl_hash_bpms(lua_State* L,
                                  const std::string& steps_type,
                                  const std::string& difficulty,
                                  const std::string& description,
-                                 std::string* out_hash_bpms) {
+                                 std::string* out_hash_bpms,
+                                 std::string* out_chart_string = nullptr) {
     if (!out_hash_bpms) return false;
     out_hash_bpms->clear();
 
@@ -893,6 +1243,9 @@ static bool extract_sl_hash_bpms(lua_State* L,
     if (lua_isstring(L, -1)) {
         *out_hash_bpms = lua_tostring(L, -1) ? lua_tostring(L, -1) : "";
     }
+    if (out_chart_string) {
+        *out_chart_string = lua_tostring(L, -2) ? lua_tostring(L, -2) : "";
+    }
     lua_pop(L, 2);
 
     cleanup();
@@ -1119,7 +1472,7 @@ static std::string fallback_hash_from_notes(lua_State* L,
     if (!L || !steps || hash_bpms.empty()) return "";
 
     RString note_data_raw;
-    steps->GetSMNoteData(note_data_raw);
+    get_chart_note_text(steps, note_data_raw);
     if (note_data_raw.empty()) return "";
 
     const std::string simfile_stub =
@@ -1148,7 +1501,7 @@ static bool fallback_parse_from_notes(lua_State* L,
     if (!L || !ctx || !steps || hash_bpms.empty()) return false;
 
     RString note_data_raw;
-    steps->GetSMNoteData(note_data_raw);
+    get_chart_note_text(steps, note_data_raw);
     if (note_data_raw.empty()) return false;
 
     FallbackSimfileOverride simfile_override;
@@ -1184,25 +1537,39 @@ static bool fallback_parse_from_notes(lua_State* L,
     return ok;
 }
 
-static std::string compute_hash_with_lua(const std::string& simfile_path,
-                                         const std::string& steps_type,
-                                         const std::string& difficulty,
-                                         const std::string& description,
-                                         const Steps* steps,
-                                         TimingData* timing,
-                                         bool force_steps_parse,
-                                         std::string* out_hash_bpms,
-                                         std::string* breakdown_text,
-                                         std::vector<std::string>* breakdown_levels,
-                                         int* stream_measures,
-                                         int* break_measures,
-                                         std::vector<StreamSequenceOut>* stream_sequences,
-                                         std::vector<int>* lua_notes_per_measure,
-                                         std::vector<double>* lua_nps_per_measure,
-                                         std::vector<bool>* lua_equally_spaced,
-                                         double* lua_peak_nps) {
+// Puts back the globals a chart parse writes (the per-player Streams cache in
+// particular), so a reused state parses the next chart exactly like a fresh
+// one would.
+static void reset_sl_lua_state(lua_State* L) {
+    lua_settop(L, 0);
+
+    lua_getglobal(L, "SL");
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_newtable(L);
+        lua_setfield(L, -2, "Global");
+        lua_pushvalue(L, -1);
+        lua_setglobal(L, "SL");
+    }
+    lua_getfield(L, -1, "Global");
+    if (lua_istable(L, -1)) {
+        lua_pushnumber(L, 0);
+        lua_setfield(L, -2, "ColumnCueMinTime");
+    }
+    lua_pop(L, 1);
+    lua_newtable(L); lua_newtable(L); lua_setfield(L, -2, "Streams"); lua_setfield(L, -2, "P1");
+    lua_newtable(L); lua_newtable(L); lua_setfield(L, -2, "Streams"); lua_setfield(L, -2, "P2");
+    lua_pop(L, 1);
+
+    lua_pushstring(L, "P1");
+    lua_setglobal(L, "player");
+}
+
+// Registers the engine shims and loads both SL chart parser scripts.
+static lua_State* create_sl_lua_state() {
     lua_State* L = luaL_newstate();
-    if (!L) return "";
+    if (!L) return nullptr;
     luaL_openlibs(L);
 
     lua_newtable(L);
@@ -1245,16 +1612,55 @@ static std::string compute_hash_with_lua(const std::string& simfile_path,
     lua_pushstring(L, "P1");
     lua_setglobal(L, "player");
 
-    const std::string parser_path = "src/extern/itgmania/Themes/Simply Love/Scripts/SL-ChartParser.lua";
-    if (!load_lua_chunk(L, parser_path, embedded_lua::kSLChartParserLua, "@SL-ChartParser.lua")) {
+    if (!load_lua_chunk(L, "SL-ChartParser.lua", embedded_sl_chart_parser_bytecode(), embedded_sl_chart_parser(),
+                        "@SL-ChartParser.lua")) {
         lua_close(L);
-        return "";
+        return nullptr;
     }
-    const std::string helper_path = "src/extern/itgmania/Themes/Simply Love/Scripts/SL-ChartParserHelpers.lua";
-    if (!load_lua_chunk(L, helper_path, embedded_lua::kSLChartParserHelpersLua, "@SL-ChartParserHelpers.lua")) {
+    if (!load_lua_chunk(L, "SL-ChartParserHelpers.lua", embedded_sl_chart_parser_helpers_bytecode(),
+                        embedded_sl_chart_parser_helpers(), "@SL-ChartParserHelpers.lua")) {
         lua_close(L);
-        return "";
+        return nullptr;
+    }
+
+    return L;
+}
+
+struct LuaStateCloser {
+    void operator()(lua_State* L) const { lua_close(L); }
+};
+
+// Each thread keeps one state with the scripts loaded; a state that failed to
+// load is retried on the next chart.
+static lua_State* acquire_sl_lua_state() {
+    thread_local std::unique_ptr<lua_State, LuaStateCloser> state;
+    if (!state) {
+        state.reset(create_sl_lua_state());
+        return state.get();
     }
+    reset_sl_lua_state(state.get());
+    return state.get();
+}
+
+static std::string compute_hash_with_lua(const std::string& simfile_path,
+                                         const std::string& steps_type,
+                                         const std::string& difficulty,
+                                         const std::string& description,
+                                         const Steps* steps,
+                                         TimingData* timing,
+                                         bool force_steps_parse,
+                                         std::string* out_hash_bpms,
+                                         std::string* breakdown_text,
+                                         std::vector<std::string>* breakdown_levels,
+                                         int* stream_measures,
+                                         int* break_measures,
+                                         std::vector<StreamSequenceOut>* stream_sequences,
+                                         std::vector<int>* lua_notes_per_measure,
+                                         std::vector<double>* lua_nps_per_measure,
+                                         std::vector<bool>* lua_equally_spaced,
+                                         double* lua_peak_nps) {
+    lua_State* L = acquire_sl_lua_state();
+    if (!L) return "";
 
     LuaStepsCtx ctx{simfile_path, steps_type, difficulty, description, timing};
     const bool allow_force_parse = force_steps_parse && steps && out_hash_bpms;
@@ -1264,6 +1670,12 @@ static std::string compute_hash_with_lua(const std::string& simfile_path,
     const bool has_hash_bpms = !allow_force_parse
         && extract_sl_hash_bpms(L, &ctx, steps_type, difficulty, description, out_hash_bpms);
     FallbackBpmOverride bpm_override;
+    NestedUpvalueOverride bpm_upvalue;
+    auto finish = [&](std::string hash) {
+        restore_normalize_bpms_override(L, bpm_upvalue);
+        lua_settop(L, 0);
+        return hash;
+    };
     if (!has_hash_bpms) {
         std::string fallback_bpms;
         if (timing) {
@@ -1277,7 +1689,7 @@ static std::string compute_hash_with_lua(const std::string& simfile_path,
                 *out_hash_bpms = fallback_bpms;
             }
             bpm_override.bpms = fallback_bpms;
-            install_normalize_bpms_override(L, &bpm_override);
+            bpm_upvalue = install_normalize_bpms_override(L, &bpm_override);
         }
     }
     bool parsed = false;
@@ -1295,9 +1707,7 @@ static std::string compute_hash_with_lua(const std::string& simfile_path,
         push_steps_userdata(L, &ctx);
         lua_pushstring(L, "P1");
         if (lua_pcall(L, 2, 0, errfunc) != 0) {
-            lua_pop(L, 1);
-            lua_close(L);
-            return "";
+            return finish("");
         }
         lua_pop(L, 1); // pop traceback handler
     }
@@ -1438,8 +1848,38 @@ static std::string compute_hash_with_lua(const std::string& simfile_path,
         }
     }
 
-    lua_close(L);
-    return result;
+    return finish(std::move(result));
+}
+
+// The hash is SHA1(chart string .. BPMs) over what GetSimfileChartString
+// returns, so --hash and the native stream engine can stop there instead of
+// running ParseChartInfo's stream analysis. Charts that need one of
+// compute_hash_with_lua's fallbacks (duplicate chart keys, no BPMs, no chart
+// string) still go through it.
+static std::string compute_hash_only_with_lua(const std::string& simfile_path,
+                                              const std::string& steps_type,
+                                              const std::string& difficulty,
+                                              const std::string& description,
+                                              const Steps* steps,
+                                              TimingData* timing,
+                                              bool force_steps_parse,
+                                              std::string* out_hash_bpms) {
+    if (!force_steps_parse) {
+        lua_State* L = acquire_sl_lua_state();
+        if (!L) return "";
+
+        LuaStepsCtx ctx{simfile_path, steps_type, difficulty, description, timing};
+        std::string chart_string;
+        std::string hash;
+        if (extract_sl_hash_bpms(L, &ctx, steps_type, difficulty, description, out_hash_bpms, &chart_string)) {
+            hash = compute_sl_hash(L, chart_string, *out_hash_bpms);
+        }
+        lua_settop(L, 0);
+        if (!hash.empty()) return hash;
+    }
+    return compute_hash_with_lua(simfile_path, steps_type, difficulty, description, steps, timing,
+                                 force_steps_parse, out_hash_bpms, nullptr, nullptr, nullptr, nullptr, nullptr,
+                                 nullptr, nullptr, nullptr, nullptr);
 }
 } // namespace
 
@@ -1476,12 +1916,72 @@ static bool steps_supports_itgmania_notedata(const Steps* steps) {
     return GAMEMAN->GetStepsTypeInfo(steps->m_StepsType).iNumTracks > 0;
 }
 
-static void prepare_steps_for_metrics(Steps* steps, TimingData* timing) {
-    (void)timing;
-    steps->CalculateStepStats(0.0f);
-    steps->CalculateGrooveStatsHash();
-    steps->CalculateTechCounts();
-    steps->CalculateMeasureInfo();
+// Which parts of build_metrics_for_steps the requested fields need, so that
+// e.g. leaving out tech_counts also skips the step parity pass.
+struct MetricsPlan {
+    bool step_stats = false;
+    bool tech_counts = false;
+    bool measure_info = false;
+    bool breakdown = false;
+    bool breakdown_levels = false;
+    bool stream_sequences = false;
+    bool stream_totals = false;
+    bool hash = false;
+    bool timing = false;
+
+    bool any_streams() const {
+        return measure_info || breakdown || breakdown_levels || stream_sequences || stream_totals;
+    }
+};
+
+static MetricsPlan plan_metrics(const ChartFieldSet& fields, bool can_compute_notedata_metrics) {
+    auto any = [&](std::initializer_list<ChartField> list) {
+        for (ChartField field : list) {
+            if (has_field(fields, field)) return true;
+        }
+        return false;
+    };
+
+    MetricsPlan plan;
+    plan.step_stats = any({ChartField::Holds, ChartField::Mines, ChartField::Rolls, ChartField::TapsAndHolds,
+                           ChartField::Notes, ChartField::Lifts, ChartField::Fakes, ChartField::Jumps,
+                           ChartField::Hands, ChartField::Quads});
+    plan.tech_counts = has_field(fields, ChartField::TechCounts);
+    // Without note data the duration is derived from the measure count.
+    plan.measure_info = any({ChartField::NotesPerMeasure, ChartField::NpsPerMeasure,
+                             ChartField::EquallySpacedPerMeasure, ChartField::PeakNps, ChartField::TotalSteps})
+        || (!can_compute_notedata_metrics && has_field(fields, ChartField::DurationSeconds));
+    plan.breakdown = has_field(fields, ChartField::StreamsBreakdown);
+    plan.breakdown_levels = any({ChartField::StreamsBreakdownLevel1, ChartField::StreamsBreakdownLevel2,
+                                 ChartField::StreamsBreakdownLevel3});
+    plan.stream_sequences = has_field(fields, ChartField::StreamSequences);
+    plan.stream_totals = any({ChartField::TotalStreamMeasures, ChartField::TotalBreakMeasures});
+    plan.hash = any({ChartField::Hash, ChartField::HashBpms});
+    plan.timing = has_field(fields, ChartField::Timing);
+    return plan;
+}
+
+// Fields build_hash_for_steps fills; a request for nothing else takes that path.
+static ChartFieldSet hash_line_fields() {
+    ChartFieldSet fields;
+    for (ChartField field : {ChartField::Status, ChartField::Simfile, ChartField::StepsType, ChartField::Difficulty,
+                             ChartField::Description, ChartField::Meter, ChartField::Hash, ChartField::HashBpms}) {
+        set_field(fields, field);
+    }
+    return fields;
+}
+
+static void prepare_steps_for_metrics(Steps* steps, const MetricsPlan& plan) {
+    if (plan.step_stats) {
+        steps->CalculateStepStats(0.0f);
+        steps->CalculateGrooveStatsHash();
+    }
+    if (plan.tech_counts) {
+        steps->CalculateTechCounts();
+    }
+    if (plan.measure_info) {
+        steps->CalculateMeasureInfo();
+    }
 }
 
 struct MeasureStatsOut {
@@ -1569,17 +2069,295 @@ static void fill_tech_counts(ChartMetrics& out, const TechCounts& tech) {
     out.tech.doublesteps = static_cast<int>(tech[TechCountsCategory_Doublesteps]);
 }
 
+// Step parity only sees the note rows, the timing (row times, fakes, warps)
+// and the StageLayout of the steps type, so tech counts are memoized under
+// those: the same chart in a re-release, a mirror pack or copied into another
+// difficulty runs the parity search once. The layout is named by its steps
+// type; the cache salt (harness version) covers changes to the layouts.
+static std::string tech_counts_key(Steps* steps, const TimingData* td, ResultCache& cache) {
+    NoteData nd;
+    steps->GetNoteData(nd);
+    std::string notes;
+    for (int track = 0; track < nd.GetNumTracks(); ++track) {
+        for (auto it = nd.begin(track); it != nd.end(track); ++it) {
+            const TapNote& tn = it->second;
+            if (tn.type == TapNoteType_Empty) continue;
+            const int32_t note[5] = {it->first, track, static_cast<int32_t>(tn.type),
+                                     static_cast<int32_t>(tn.subType), tn.iDuration};
+            notes.append(reinterpret_cast<const char*>(note), sizeof(note));
+        }
+    }
+
+    std::string timing;
+    const float offsets[2] = {td->m_fBeat0OffsetInSeconds, td->m_fBeat0GroupOffsetInSeconds};
+    timing.append(reinterpret_cast<const char*>(offsets), sizeof(offsets));
+    for (int type = 0; type < NUM_TimingSegmentType; ++type) {
+        const std::vector<TimingSegment*>& segs = td->GetTimingSegments(static_cast<TimingSegmentType>(type));
+        const int32_t header[2] = {type, static_cast<int32_t>(segs.size())};
+        timing.append(reinterpret_cast<const char*>(header), sizeof(header));
+        for (TimingSegment* seg : segs) {
+            const int32_t row = seg->GetRow();
+            timing.append(reinterpret_cast<const char*>(&row), sizeof(row));
+            if (type == SEGMENT_LABEL) continue;
+            const std::vector<float> values = seg->GetValues();
+            timing.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+        }
+    }
+    return cache.key({"tech-counts", steps_type_string(steps), notes, timing});
+}
+
+static SLEngine& sl_engine_setting_storage() {
+    static SLEngine engine = SLEngine::Lua;
+    return engine;
+}
+
+static SLEngine sl_engine_setting() {
+    return sl_engine_setting_storage();
+}
+
+void set_sl_engine(SLEngine engine) {
+    sl_engine_setting_storage() = engine;
+}
+
+static std::atomic<size_t> g_sl_engine_mismatches{0};
+
+size_t sl_engine_mismatch_count() {
+    return g_sl_engine_mismatches.load();
+}
+
+// How many measures SL's GetMeasureInfo walks: one per measure of the chart
+// text, empty measures at the end included, which NoteData keeps no trace
+// of. Routine charts count P1's half, the part before the first '&'.
+static int sl_measure_count(const Steps* steps, const NoteData& nd) {
+    constexpr int kRowsPerMeasure = ROWS_PER_BEAT * 4;
+    const int from_rows = nd.IsEmpty() ? 1 : nd.GetLastRow() / kRowsPerMeasure + 1;
+
+    RString text;
+    get_chart_note_text(steps, text);
+    std::string_view notes(text.data(), text.size());
+    notes = notes.substr(0, notes.find('&'));
+    if (notes.find_first_not_of(" \t\r\n,;") == std::string_view::npos) return from_rows;
+    const int from_text = static_cast<int>(std::count(notes.begin(), notes.end(), ',')) + 1;
+    return std::max(from_text, from_rows);
+}
+
+// Native counterpart of GetMeasureInfo in SL-ChartParser.lua, read from
+// ITGMania's NoteData instead of the chart text. Like the Lua pattern [124],
+// a row counts once if any column holds a tap or a hold/roll head; lifts,
+// mines and fakes don't. A measure is equally spaced when the gaps between
+// its note rows are all the same.
+static SLStreamInfo native_sl_stream_info(Steps* steps, TimingData* timing) {
+    constexpr int kRowsPerMeasure = ROWS_PER_BEAT * 4;
+
+    NoteData nd;
+    steps->GetNoteData(nd);
+    const int measures = sl_measure_count(steps, nd);
+
+    SLStreamInfo info;
+    info.notes_per_measure.assign(measures, 0);
+    info.equally_spaced_per_measure.assign(measures, true);
+    std::vector<int> last_note_row(measures, -1);
+    std::vector<int> note_spacing(measures, 0);
+
+    const int tracks = nd.GetNumTracks();
+    int row = -1;
+    while (nd.GetNextTapNoteRowForAllTracks(row)) {
+        bool counts = false;
+        for (int track = 0; track < tracks && !counts; ++track) {
+            const TapNoteType type = nd.GetTapNote(track, row).type;
+            counts = type == TapNoteType_Tap || type == TapNoteType_HoldHead;
+        }
+        if (!counts) continue;
+
+        const int measure = row / kRowsPerMeasure;
+        if (measure >= measures) break;
+        ++info.notes_per_measure[measure];
+        if (last_note_row[measure] >= 0) {
+            const int gap = row - last_note_row[measure];
+            if (note_spacing[measure] == 0) {
+                note_spacing[measure] = gap;
+            } else if (note_spacing[measure] != gap) {
+                info.equally_spaced_per_measure[measure] = false;
+            }
+        }
+        last_note_row[measure] = row;
+    }
+
+    // Same arithmetic as the Lua side: float beats through the timing shim,
+    // then doubles.
+    info.nps_per_measure.resize(measures);
+    for (int measure = 0; measure < measures; ++measure) {
+        const double start = timing->GetElapsedTimeFromBeat(static_cast<float>(measure * 4));
+        const double end = timing->GetElapsedTimeFromBeat(static_cast<float>((measure + 1) * 4));
+        const double nps = info.notes_per_measure[measure] / (end - start);
+        info.nps_per_measure[measure] = nps;
+        if (nps > info.peak_nps) info.peak_nps = nps;
+    }
+
+    sl_fill_derived_stream_info(info);
+    return info;
+}
+
+static void report_sl_engine_mismatches(
+    const std::string& simfile_path,
+    const std::string& steps_type,
+    const std::string& difficulty,
+    const std::string& description,
+    const SLStreamInfo& lua,
+    const SLStreamInfo& native) {
+    const std::vector<std::string> mismatches = sl_stream_info_mismatches(lua, native);
+    if (mismatches.empty()) return;
+    g_sl_engine_mismatches.fetch_add(1);
+
+    std::string chart = simfile_path + " " + steps_type + " " + difficulty;
+    if (!description.empty()) chart += " \"" + description + "\"";
+    std::string text;
+    for (const std::string& mismatch : mismatches) {
+        text += "sl-engine mismatch: " + chart + ": " + mismatch + "\n";
+    }
+    // One write per chart keeps reports from concurrent workers apart.
+    std::fputs(text.c_str(), stderr);
+}
+
+// Only what a hash line shows: no step stats, parity, measure info, radar
+// values or timing tables. Without with_hash (a --fields subset such as
+// meter alone) the SL parser doesn't run either.
+static ChartMetrics build_hash_for_steps(const std::string& simfile_path, Steps* steps, bool force_steps_parse,
+                                         bool with_hash) {
+    ChartMetrics out;
+    out.status = steps_supports_itgmania_notedata(steps) ? "ok" : "unsupported_steps_type";
+    out.simfile = simfile_path;
+    out.steps_type = steps_type_string(steps);
+    out.difficulty = diff_string(steps->GetDifficulty());
+    out.description = steps->GetDescription();
+    out.meter = steps->GetMeter();
+    if (with_hash) {
+        out.hash = compute_hash_only_with_lua(simfile_path, out.steps_type, out.difficulty, out.description, steps,
+                                              steps->GetTimingData(), force_steps_parse, &out.hash_bpms);
+    }
+    return out;
+}
+
+// Content hash of the timing tables in m: the first 16 hex digits of a SHA-1
+// over the numbers and labels, so identical timing gets the same id in any song.
+static std::string timing_content_id(const ChartMetrics& m) {
+    std::string bytes;
+    auto add = [&](const void* data, size_t size) { bytes.append(static_cast<const char*>(data), size); };
+    auto add_count = [&](uint64_t count) { add(&count, sizeof(count)); };
+    auto add_table = [&](const std::vector<std::vector<double>>& table) {
+        add_count(table.size());
+        for (const std::vector<double>& row : table) {
+            add_count(row.size());
+            add(row.data(), row.size() * sizeof(double));
+        }
+    };
+    add(&m.beat0_offset_seconds, sizeof(double));
+    add(&m.beat0_group_offset_seconds, sizeof(double));
+    for (const auto* table : {&m.timing_bpms, &m.timing_stops, &m.timing_delays, &m.timing_time_signatures,
+                              &m.timing_warps, &m.timing_tickcounts, &m.timing_combos, &m.timing_speeds,
+                              &m.timing_scrolls, &m.timing_fakes}) {
+        add_table(*table);
+    }
+    add_count(m.timing_labels.size());
+    for (const TimingLabelOut& label : m.timing_labels) {
+        add(&label.beat, sizeof(double));
+        add_count(label.label.size());
+        bytes += label.label;
+    }
+
+    unsigned char digest[20];
+    hash_state hs;
+    sha1_init(&hs);
+    sha1_process(&hs, reinterpret_cast<const unsigned char*>(bytes.data()), static_cast<unsigned long>(bytes.size()));
+    sha1_done(&hs, digest);
+    static const char* hex = "0123456789abcdef";
+    std::string id;
+    for (size_t i = 0; i < 8; ++i) {
+        id.push_back(hex[digest[i] >> 4]);
+        id.push_back(hex[digest[i] & 0x0F]);
+    }
+    return id;
+}
+
+static void move_timing_tables(ChartMetrics& out, ChartMetrics&& from) {
+    out.beat0_offset_seconds = from.beat0_offset_seconds;
+    out.beat0_group_offset_seconds = from.beat0_group_offset_seconds;
+    out.timing_bpms = std::move(from.timing_bpms);
+    out.timing_stops = std::move(from.timing_stops);
+    out.timing_delays = std::move(from.timing_delays);
+    out.timing_time_signatures = std::move(from.timing_time_signatures);
+    out.timing_warps = std::move(from.timing_warps);
+    out.timing_labels = std::move(from.timing_labels);
+    out.timing_tickcounts = std::move(from.timing_tickcounts);
+    out.timing_combos = std::move(from.timing_combos);
+    out.timing_speeds = std::move(from.timing_speeds);
+    out.timing_scrolls = std::move(from.timing_scrolls);
+    out.timing_fakes = std::move(from.timing_fakes);
+}
+
+// A chart's timing under ChartParseOptions::share_timing, worked out once per
+// song before the charts are built. Only the first chart with an id holds the
+// tables.
+struct SharedChartTiming {
+    std::string id;
+    std::optional<ChartMetrics> tables;
+};
+
+static std::vector<SharedChartTiming> plan_shared_timing(const std::vector<Steps*>& selected) {
+    std::vector<SharedChartTiming> out(selected.size());
+    // Charts without split timing all point at the song's TimingData, so the
+    // tables are filled once per distinct TimingData and then deduplicated by
+    // content.
+    std::unordered_map<const TimingData*, size_t> first_by_timing;
+    std::unordered_map<std::string, size_t> first_by_id;
+    for (size_t i = 0; i < selected.size(); ++i) {
+        TimingData* const td = selected[i]->GetTimingData();
+        const auto known = first_by_timing.find(td);
+        if (known != first_by_timing.end()) {
+            out[i].id = out[known->second].id;
+            continue;
+        }
+        first_by_timing.emplace(td, i);
+        ChartMetrics tables;
+        fill_timing_tables(tables, td);
+        out[i].id = timing_content_id(tables);
+        if (first_by_id.emplace(out[i].id, i).second) {
+            out[i].tables = std::move(tables);
+        }
+    }
+    return out;
+}
+
+// Callers tidy the timing data first: steps without their own timing share the
+// song's, so it must not be tidied while several charts are being built.
+// shared_timing comes from plan_shared_timing when options.share_timing is on.
 static ChartMetrics build_metrics_for_steps(const std::string& simfile_path, Steps* steps, const Song& song,
-                                            bool force_steps_parse) {
+                                            bool force_steps_parse, const ChartParseOptions& options,
+                                            SharedChartTiming* shared_timing = nullptr) {
+    const ChartFieldSet& fields = options.fields;
+    if (options.hash_only || (fields & ~hash_line_fields()).none()) {
+        const bool with_hash =
+            options.hash_only || has_field(fields, ChartField::Hash) || has_field(fields, ChartField::HashBpms);
+        return build_hash_for_steps(simfile_path, steps, force_steps_parse, with_hash);
+    }
+
     TimingData* const td = steps->GetTimingData();
-    td->TidyUpData(false);
 
     const std::string st_str = steps_type_string(steps);
     const std::string diff_str = diff_string(steps->GetDifficulty());
 
     const bool can_compute_notedata_metrics = steps_supports_itgmania_notedata(steps);
+    const MetricsPlan plan = plan_metrics(fields, can_compute_notedata_metrics);
+    std::string tech_key;
+    std::optional<TechCountsOut> memo_tech;
+    if (can_compute_notedata_metrics && plan.tech_counts && options.cache) {
+        tech_key = tech_counts_key(steps, td, *options.cache);
+        memo_tech = options.cache->load_tech_counts(tech_key);
+    }
     if (can_compute_notedata_metrics) {
-        prepare_steps_for_metrics(steps, td);
+        MetricsPlan prepare = plan;
+        if (memo_tech) prepare.tech_counts = false;
+        prepare_steps_for_metrics(steps, prepare);
     }
 
     ChartMetrics out;
@@ -1596,20 +2374,46 @@ static ChartMetrics build_metrics_for_steps(const std::string& simfile_path, Ste
         out.artist_translated);
     out.step_artist = steps->GetCredit();
     out.description = steps->GetDescription();
-    std::vector<int> lua_notes_pm;
-    std::vector<double> lua_nps_pm;
-    std::vector<bool> lua_equally_spaced;
-    double lua_peak_nps = 0.0;
-    std::vector<std::string> breakdown_levels;
-    int stream_measures = 0;
-    int break_measures = 0;
-    std::vector<StreamSequenceOut> stream_sequences;
-    out.hash = compute_hash_with_lua(simfile_path, st_str, diff_str, steps->GetDescription(), steps, td,
-                                     force_steps_parse,
-                                     &out.hash_bpms,
-                                     &out.streams_breakdown, &breakdown_levels, &stream_measures, &break_measures,
-                                     &stream_sequences,
-                                     &lua_notes_pm, &lua_nps_pm, &lua_equally_spaced, &lua_peak_nps);
+    // The full SL parser only runs when Lua supplies the stream data; a hash
+    // on its own (the native engine, or no stream fields) takes the short
+    // path that stops at the chart string.
+    const SLEngine engine = can_compute_notedata_metrics ? sl_engine_setting() : SLEngine::Lua;
+    SLStreamInfo lua_streams;
+    SLStreamInfo* const lua_out = plan.any_streams() && engine != SLEngine::Native ? &lua_streams : nullptr;
+    // Verify compares every stream field, so it asks Lua for all of them.
+    const bool all_lua = engine == SLEngine::Verify;
+    if (plan.hash && !lua_out) {
+        out.hash = compute_hash_only_with_lua(simfile_path, st_str, diff_str, steps->GetDescription(), steps, td,
+                                              force_steps_parse, &out.hash_bpms);
+    } else if (lua_out) {
+        out.hash = compute_hash_with_lua(
+            simfile_path, st_str, diff_str, steps->GetDescription(), steps, td, force_steps_parse,
+            &out.hash_bpms,
+            lua_out && (all_lua || plan.breakdown) ? &out.streams_breakdown : nullptr,
+            lua_out && (all_lua || plan.breakdown_levels) ? &lua_out->breakdown_levels : nullptr,
+            lua_out && (all_lua || plan.stream_totals) ? &lua_out->stream_measures : nullptr,
+            lua_out && (all_lua || plan.stream_totals) ? &lua_out->break_measures : nullptr,
+            lua_out && (all_lua || plan.stream_sequences) ? &lua_out->stream_sequences : nullptr,
+            lua_out && (all_lua || plan.measure_info) ? &lua_out->notes_per_measure : nullptr,
+            lua_out && (all_lua || plan.measure_info) ? &lua_out->nps_per_measure : nullptr,
+            lua_out && (all_lua || plan.measure_info) ? &lua_out->equally_spaced_per_measure : nullptr,
+            lua_out && (all_lua || plan.measure_info) ? &lua_out->peak_nps : nullptr);
+    }
+
+    SLStreamInfo sl_streams;
+    if (engine == SLEngine::Lua || !plan.any_streams()) {
+        sl_streams = std::move(lua_streams);
+    } else {
+        SLStreamInfo native_streams = native_sl_stream_info(steps, td);
+        if (engine == SLEngine::Verify) {
+            report_sl_engine_mismatches(simfile_path, st_str, diff_str, steps->GetDescription(), lua_streams,
+                                        native_streams);
+            sl_streams = std::move(lua_streams);
+        } else {
+            out.streams_breakdown = native_streams.breakdown_levels[0];
+            sl_streams = std::move(native_streams);
+        }
+    }
     out.steps_type = st_str;
     out.difficulty = diff_str;
     out.meter = steps->GetMeter();
@@ -1617,32 +2421,35 @@ static ChartMetrics build_metrics_for_steps(const std::string& simfile_path, Ste
     get_bpm_ranges_like_simply_love(steps, 1.0, out.bpm_min, out.bpm_max, out.display_bpm_min, out.display_bpm_max,
                                    out.display_bpm);
 
-    const MeasureStatsOut measures = get_measure_stats(
-        steps, std::move(lua_notes_pm), std::move(lua_nps_pm), std::move(lua_equally_spaced), lua_peak_nps,
-        can_compute_notedata_metrics);
-    out.total_steps = measures.total_steps;
-    out.notes_per_measure = measures.notes_per_measure;
-    out.nps_per_measure = measures.nps_per_measure;
-    out.equally_spaced_per_measure = measures.equally_spaced_per_measure;
-    out.peak_nps = measures.peak_nps;
+    if (plan.measure_info) {
+        const MeasureStatsOut measures = get_measure_stats(
+            steps, std::move(sl_streams.notes_per_measure), std::move(sl_streams.nps_per_measure),
+            std::move(sl_streams.equally_spaced_per_measure), sl_streams.peak_nps, can_compute_notedata_metrics);
+        out.total_steps = measures.total_steps;
+        out.notes_per_measure = measures.notes_per_measure;
+        out.nps_per_measure = measures.nps_per_measure;
+        out.equally_spaced_per_measure = measures.equally_spaced_per_measure;
+        out.peak_nps = measures.peak_nps;
+    }
 
-    if (can_compute_notedata_metrics) {
-        out.duration_seconds = get_duration_seconds(steps, td);
-    } else {
-        out.duration_seconds = get_duration_seconds_from_measure_count(td, out.notes_per_measure.size());
+    if (has_field(fields, ChartField::DurationSeconds)) {
+        if (can_compute_notedata_metrics) {
+            out.duration_seconds = get_duration_seconds(steps, td);
+        } else {
+            out.duration_seconds = get_duration_seconds_from_measure_count(td, out.notes_per_measure.size());
+        }
     }
 
-    out.stream_sequences = std::move(stream_sequences);
-    if (breakdown_levels.size() == 4) {
-        out.streams_breakdown_level1 = breakdown_levels[1];
-        out.streams_breakdown_level2 = breakdown_levels[2];
-        out.streams_breakdown_level3 = breakdown_levels[3];
+    out.stream_sequences = std::move(sl_streams.stream_sequences);
+    if (sl_streams.breakdown_levels.size() == 4) {
+        out.streams_breakdown_level1 = sl_streams.breakdown_levels[1];
+        out.streams_breakdown_level2 = sl_streams.breakdown_levels[2];
+        out.streams_breakdown_level3 = sl_streams.breakdown_levels[3];
     }
-    out.total_stream_measures = stream_measures;
-    out.total_break_measures = break_measures;
+    out.total_stream_measures = sl_streams.stream_measures;
+    out.total_break_measures = sl_streams.break_measures;
 
-    if (can_compute_notedata_metrics) {
-        const TechCounts& tech = steps->GetTechCounts(PLAYER_1);
+    if (can_compute_notedata_metrics && plan.step_stats) {
         const RadarValues radar = steps->GetRadarValues(PLAYER_1);
         const RadarCountsOut radar_counts = get_radar_counts(radar);
 
@@ -1656,13 +2463,159 @@ static ChartMetrics build_metrics_for_steps(const std::string& simfile_path, Ste
         out.jumps = radar_counts.jumps;
         out.hands = radar_counts.hands;
         out.quads = radar_counts.quads;
+    }
+    if (can_compute_notedata_metrics && plan.tech_counts) {
+        if (memo_tech) {
+            out.tech = *memo_tech;
+        } else {
+            fill_tech_counts(out, steps->GetTechCounts(PLAYER_1));
+            if (!tech_key.empty()) options.cache->store_tech_counts(tech_key, out.tech);
+        }
+    }
+    if (plan.timing && shared_timing) {
+        out.timing_id = shared_timing->id;
+        if (shared_timing->tables) {
+            move_timing_tables(out, std::move(*shared_timing->tables));
+        } else {
+            out.timing_shared = true;
+        }
+    } else if (plan.timing) {
+        fill_timing_tables(out, td);
+        if (options.share_timing) out.timing_id = timing_content_id(out);
+    }
+    return out;
+}
 
-        fill_tech_counts(out, tech);
+// The Simply Love scripts the parser runs, as a key part: the embedded
+// copies, or the files --sl-scripts points at.
+static std::string sl_scripts_key() {
+    if (sl_scripts_dir().empty()) {
+        return content_key({embedded_sl_chart_parser(), embedded_sl_chart_parser_helpers()});
+    }
+    std::string scripts[2];
+    const char* names[2] = {"SL-ChartParser.lua", "SL-ChartParserHelpers.lua"};
+    for (int i = 0; i < 2; ++i) {
+        std::ifstream in(std::filesystem::path(sl_scripts_dir()) / names[i], std::ios::binary);
+        scripts[i].assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    return content_key({"sl-scripts", scripts[0], scripts[1]});
+}
+
+// The parse options that shape cached charts, as a key part.
+static std::string cache_settings(const ChartParseOptions& options) {
+    std::string settings = options.fields.to_string();
+    settings += options.hash_only ? 'h' : '-';
+    settings += options.share_timing ? 's' : '-';
+    settings += sl_engine_setting() == SLEngine::Native ? 'n' : 'l';
+    return settings;
+}
+
+// Name of the folder a simfile sits in. A song without a #TITLE is titled
+// after it (apply_song_metadata_fallback), so it is part of the cache keys.
+static std::string song_folder_name(const std::string& simfile_path) {
+    return std::filesystem::path(simfile_path).parent_path().filename().string();
+}
+
+// Cache key of a whole simfile: its bytes plus everything else that shapes
+// the charts built from them.
+static std::string simfile_cache_key(
+    const std::string& simfile_path,
+    const std::string& bytes,
+    const ChartParseOptions& options) {
+    static const std::string scripts = sl_scripts_key();
+    return options.cache->key({scripts, cache_settings(options), song_folder_name(simfile_path), bytes});
+}
+
+// A simfile's tags split into the song's (everything outside the charts) and
+// each chart's own, in file order, each flattened to one string.
+struct SimfileChartTexts {
+    std::string song;
+    std::vector<std::string> charts;
+    std::vector<std::string> steps_types;
+};
+
+// ITGmania's loaders keep their MsdFile to themselves, so this parses the
+// bytes once more; it only runs once the simfile's own entry has missed.
+static SimfileChartTexts split_simfile_charts(const std::string& simfile_path, const std::string& bytes) {
+    MsdFile msd;
+    msd.ReadFromString(bytes, true);
+
+    RString ext = GetExtension(simfile_path);
+    ext.MakeLower();
+    const bool ssc = ext == "ssc" || ext == "ats";
+
+    SimfileChartTexts out;
+    // In .ssc every tag from #NOTEDATA up to the next belongs to that chart;
+    // in .sm a chart is one #NOTES tag and all other tags are the song's.
+    bool in_chart = false;
+    const unsigned values = msd.GetNumValues();
+    for (unsigned i = 0; i < values; ++i) {
+        RString tag = msd.GetParam(i, 0);
+        tag.MakeUpper();
+        std::string* text = &out.song;
+        if (ssc) {
+            if (tag == "NOTEDATA") {
+                in_chart = true;
+                out.charts.emplace_back();
+                out.steps_types.emplace_back();
+            }
+            if (in_chart) {
+                text = &out.charts.back();
+                if (tag == "STEPSTYPE") {
+                    RString steps_type = msd.GetParam(i, 1);
+                    Trim(steps_type);
+                    out.steps_types.back() = normalize_steps_type_string(steps_type.c_str());
+                }
+            }
+        } else if (tag == "NOTES" || tag == "NOTES2") {
+            RString steps_type = msd.GetParam(i, 1);
+            Trim(steps_type);
+            out.charts.emplace_back();
+            out.steps_types.push_back(normalize_steps_type_string(steps_type.c_str()));
+            text = &out.charts.back();
+        }
+        const unsigned params = msd.GetNumParams(i);
+        for (unsigned j = 0; j < params; ++j) {
+            text->append(msd.GetParam(i, j).c_str());
+            text->push_back('\x1f');
+        }
+        text->push_back('\x1e');
     }
-    fill_timing_tables(out, td);
     return out;
 }
 
+// Cache keys of single charts, one per entry of GetAllSteps(): the chart's own
+// tags (note data, split timing, difficulty, ...), the song's tags (song
+// timing and metadata), its folder's name and the parse settings, so editing
+// one chart leaves the keys of the others alone. Empty when the simfile's
+// charts cannot be matched up with the loaded steps (the loader skipped or
+// reordered one).
+static std::vector<std::string> chart_cache_keys(
+    const std::string& simfile_path,
+    const std::string& bytes,
+    const std::vector<Steps*>& all_steps,
+    const std::unordered_map<std::string, int>& key_counts,
+    const ChartParseOptions& options) {
+    static const std::string scripts = sl_scripts_key();
+    const SimfileChartTexts texts = split_simfile_charts(simfile_path, bytes);
+    if (texts.charts.size() != all_steps.size()) return {};
+    for (size_t i = 0; i < all_steps.size(); ++i) {
+        if (texts.steps_types[i] != steps_type_string(all_steps[i])) return {};
+    }
+
+    const std::string settings = cache_settings(options);
+    const std::string folder = song_folder_name(simfile_path);
+    std::vector<std::string> keys;
+    keys.reserve(all_steps.size());
+    for (size_t i = 0; i < all_steps.size(); ++i) {
+        // A chart that shares its steps type and difficulty with another is
+        // hashed from its own notes rather than the simfile's text.
+        const std::string_view duplicate = key_counts.at(sl_chart_key(all_steps[i])) > 1 ? "dup" : "one";
+        keys.push_back(options.cache->key({"chart", scripts, settings, folder, texts.song, texts.charts[i], duplicate}));
+    }
+    return keys;
+}
+
 static Steps* select_steps(
     const std::vector<Steps*>& steps,
     const std::string& steps_type_req,
@@ -1687,15 +2640,19 @@ std::optional<ChartMetrics> parse_chart_with_itgmania(
     const std::string& simfile_path,
     const std::string& steps_type_req,
     const std::string& difficulty_req,
-    const std::string& description_req) {
+    const std::string& description_req,
+    const ChartParseOptions& options) {
+    auto runtime_lock = lock_runtime_if_shared();
+    const SimfileBufferScope simfile_bytes(simfile_path);
     // Ensure the engine singletons exist.
     init_singletons(0, nullptr);
 
     Song song;
     song.m_sSongFileName = simfile_path;
     song.SetSongDir(std::filesystem::path(simfile_path).parent_path().string().c_str());
+    CompiledSongScope compiled;
 
-    if (!load_song(simfile_path, song)) {
+    if (!load_song(simfile_path, song, compiled)) {
         std::fprintf(stderr, "LoadFromSimfile failed for %s\n", simfile_path.c_str());
         return std::nullopt;
     }
@@ -1720,25 +2677,78 @@ std::optional<ChartMetrics> parse_chart_with_itgmania(
         force_steps_parse = true;
     }
 
-    return build_metrics_for_steps(simfile_path, steps, song, force_steps_parse);
+    steps->GetTimingData()->TidyUpData(false);
+    return build_metrics_for_steps(simfile_path, steps, song, force_steps_parse, options);
 }
 
-std::vector<ChartMetrics> parse_all_charts_with_itgmania(
+bool compile_simfile_with_itgmania(const std::string& simfile_path, const std::string& out_dir, std::string* error) {
+    auto runtime_lock = lock_runtime_if_shared();
+    const SimfileBufferScope simfile_bytes(simfile_path);
+    if (!simfile_bytes.bytes()) {
+        if (error) *error = "cannot read " + simfile_path;
+        return false;
+    }
+    init_singletons(0, nullptr);
+
+    Song song;
+    song.m_sSongFileName = simfile_path;
+    song.SetSongDir(std::filesystem::path(simfile_path).parent_path().string().c_str());
+    if (!load_song_from_text(simfile_path, song)) {
+        if (error) *error = "LoadFromSimfile failed for " + simfile_path;
+        return false;
+    }
+    const std::string key = compiled_key_for(simfile_path, *simfile_bytes.bytes());
+    return write_compiled_simfile(compiled_simfile_path(out_dir, key), key, compile_song(song), error);
+}
+
+size_t for_each_chart_unordered_with_itgmania(
     const std::string& simfile_path,
     const std::string& steps_type_req,
     const std::string& difficulty_req,
-    const std::string& description_req) {
+    const std::string& description_req,
+    const IndexedChartCallback& on_chart,
+    WorkStealingPool* pool,
+    const ChartParseOptions& options) {
+    auto runtime_lock = lock_runtime_if_shared();
+    const SimfileBufferScope simfile_bytes(simfile_path);
+
+    // The cache stores the charts under the simfile's content, so the path
+    // they were analyzed under is replaced with this one. The simfile's entry
+    // lists its charts' keys; with any of them evicted, it counts as a miss.
+    const bool cached = options.cache && simfile_bytes.bytes() && steps_type_req.empty() &&
+                        difficulty_req.empty() && description_req.empty() &&
+                        sl_engine_setting() != SLEngine::Verify;
+    std::string cache_key;
+    if (cached) {
+        cache_key = simfile_cache_key(simfile_path, *simfile_bytes.bytes(), options);
+        if (std::optional<std::vector<std::string>> keys = options.cache->load_keys(cache_key)) {
+            std::vector<ChartMetrics> charts;
+            charts.reserve(keys->size());
+            for (const std::string& key : *keys) {
+                std::optional<std::vector<ChartMetrics>> chart = options.cache->load(key);
+                if (!chart || chart->size() != 1) break;
+                charts.push_back(std::move(chart->front()));
+            }
+            if (charts.size() == keys->size()) {
+                for (size_t i = 0; i < charts.size(); ++i) {
+                    charts[i].simfile = simfile_path;
+                    on_chart(i, std::move(charts[i]));
+                }
+                return charts.size();
+            }
+        }
+    }
+
     init_singletons(0, nullptr);
 
     Song song;
     song.m_sSongFileName = simfile_path;
     song.SetSongDir(std::filesystem::path(simfile_path).parent_path().string().c_str());
+    CompiledSongScope compiled;
 
-    std::vector<ChartMetrics> out;
-
-    if (!load_song(simfile_path, song)) {
+    if (!load_song(simfile_path, song, compiled)) {
         std::fprintf(stderr, "LoadFromSimfile failed for %s\n", simfile_path.c_str());
-        return out;
+        return 0;
     }
 
     const auto& all_steps = song.GetAllSteps();
@@ -1748,39 +2758,207 @@ std::vector<ChartMetrics> parse_all_charts_with_itgmania(
         key_counts[sl_chart_key(steps)] += 1;
     }
 
-    for (Steps* steps : all_steps) {
+    std::vector<Steps*> selected;
+    std::vector<size_t> selected_index;
+    std::vector<bool> force_steps_parse;
+    for (size_t index = 0; index < all_steps.size(); ++index) {
+        Steps* const steps = all_steps[index];
         std::string st_str = steps_type_string(steps);
         std::string diff_str = diff_string(steps->GetDifficulty());
         if (!steps_type_req.empty() && st_str != steps_type_req) continue;
         if (!difficulty_req.empty() && diff_str != difficulty_req) continue;
         if (steps->GetDifficulty() == Difficulty_Edit && !description_req.empty() && steps->GetDescription() != description_req) continue;
 
-        const std::string key = sl_chart_key(steps);
-        const bool force_steps_parse = key_counts[key] > 1;
-        out.push_back(build_metrics_for_steps(simfile_path, steps, song, force_steps_parse));
+        selected.push_back(steps);
+        selected_index.push_back(index);
+        force_steps_parse.push_back(key_counts[sl_chart_key(steps)] > 1);
+        steps->GetTimingData()->TidyUpData(false);
+    }
+
+    std::vector<SharedChartTiming> shared_timing;
+    if (options.share_timing && !options.hash_only && has_field(options.fields, ChartField::Timing)) {
+        shared_timing = plan_shared_timing(selected);
+    }
+    // A changed simfile still reuses the charts that did not change. Shared
+    // timing ties each chart to the ones before it, so it is built whole.
+    std::vector<std::string> chart_keys;
+    if (options.cache && simfile_bytes.bytes() && shared_timing.empty() &&
+        sl_engine_setting() != SLEngine::Verify) {
+        chart_keys = chart_cache_keys(simfile_path, *simfile_bytes.bytes(), all_steps, key_counts, options);
+    }
+    // The keys the simfile's entry will list. Charts without a key of their
+    // own (shared timing, or texts that do not match the loaded steps) are
+    // stored under the simfile's key and their position.
+    std::vector<std::string> manifest(cached ? selected.size() : 0);
+    auto deliver = [&](size_t i) {
+        std::string chart_key;
+        if (!chart_keys.empty()) {
+            chart_key = chart_keys[selected_index[i]];
+        } else if (cached) {
+            chart_key = options.cache->key({"simfile-chart", cache_key, std::to_string(i)});
+        }
+        std::optional<std::vector<ChartMetrics>> reused;
+        if (!chart_key.empty()) reused = options.cache->load(chart_key);
+        ChartMetrics m;
+        if (reused && reused->size() == 1) {
+            m = std::move(reused->front());
+            m.simfile = simfile_path;
+        } else {
+            m = build_metrics_for_steps(simfile_path, selected[i], song, force_steps_parse[i], options,
+                                        shared_timing.empty() ? nullptr : &shared_timing[i]);
+            if (!chart_key.empty()) options.cache->store(chart_key, {m});
+        }
+        if (cached) manifest[i] = std::move(chart_key);
+        on_chart(i, std::move(m));
+    };
+
+    if (pool && selected.size() > 1 && itgmania_runtime_is_thread_safe()) {
+        // Charts only share the loaded Song read-only, so each one is built as
+        // its own pool task and handed to on_chart by that task.
+        TaskGroup group(*pool);
+        for (size_t i = 0; i < selected.size(); ++i) {
+            group.run([&, i]() { deliver(i); });
+        }
+        group.wait();
+    } else {
+        for (size_t i = 0; i < selected.size(); ++i) {
+            deliver(i);
+        }
     }
 
+    if (cached) {
+        options.cache->store_keys(cache_key, manifest);
+    }
+    return selected.size();
+}
+
+size_t for_each_chart_with_itgmania(
+    const std::string& simfile_path,
+    const std::string& steps_type_req,
+    const std::string& difficulty_req,
+    const std::string& description_req,
+    const ChartCallback& on_chart,
+    WorkStealingPool* pool,
+    const ChartParseOptions& options) {
+    // Whichever task completes the next chart in GetAllSteps() order hands
+    // it, and any finished charts after it, to on_chart.
+    std::vector<std::optional<ChartMetrics>> done;
+    size_t next = 0;
+    std::mutex done_mutex;
+    return for_each_chart_unordered_with_itgmania(
+        simfile_path, steps_type_req, difficulty_req, description_req,
+        [&](size_t index, ChartMetrics&& metrics) {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            if (done.size() <= index) done.resize(index + 1);
+            done[index] = std::move(metrics);
+            for (; next < done.size() && done[next]; ++next) {
+                on_chart(std::move(*done[next]));
+                done[next].reset();
+            }
+        },
+        pool, options);
+}
+
+std::vector<ChartMetrics> parse_all_charts_with_itgmania(
+    const std::string& simfile_path,
+    const std::string& steps_type_req,
+    const std::string& difficulty_req,
+    const std::string& description_req,
+    WorkStealingPool* pool,
+    const ChartParseOptions& options) {
+    std::vector<ChartMetrics> out;
+    for_each_chart_with_itgmania(
+        simfile_path, steps_type_req, difficulty_req, description_req,
+        [&](ChartMetrics&& metrics) { out.push_back(std::move(metrics)); }, pool, options);
     return out;
 }
 
 #else
+bool itgmania_runtime_is_thread_safe() {
+    return true;
+}
+
+void set_sl_scripts_dir(const std::string& dir) {
+    (void)dir;
+}
+
+void set_sl_engine(SLEngine engine) {
+    (void)engine;
+}
+
+size_t sl_engine_mismatch_count() {
+    return 0;
+}
+
+void set_compiled_simfile_dir(const std::string& dir) {
+    (void)dir;
+}
+
+bool compile_simfile_with_itgmania(const std::string& simfile_path, const std::string& out_dir, std::string* error) {
+    (void)out_dir;
+    if (error) *error = "compiling needs the ITGmania loaders: " + simfile_path;
+    return false;
+}
+
 std::optional<ChartMetrics> parse_chart_with_itgmania(
     const std::string& simfile_path,
     const std::string& steps_type,
     const std::string& difficulty,
-    const std::string& description) {
+    const std::string& description,
+    const ChartParseOptions& options) {
     (void)simfile_path;
     (void)steps_type;
     (void)difficulty;
     (void)description;
+    (void)options;
     return std::nullopt;
 }
+size_t for_each_chart_with_itgmania(
+    const std::string& simfile_path,
+    const std::string& steps_type,
+    const std::string& difficulty,
+    const std::string& description,
+    const ChartCallback& on_chart,
+    WorkStealingPool* pool,
+    const ChartParseOptions& options) {
+    (void)simfile_path;
+    (void)on_chart;
+    (void)pool;
+    (void)options;
+    (void)steps_type;
+    (void)difficulty;
+    (void)description;
+    return 0;
+}
+
+size_t for_each_chart_unordered_with_itgmania(
+    const std::string& simfile_path,
+    const std::string& steps_type,
+    const std::string& difficulty,
+    const std::string& description,
+    const IndexedChartCallback& on_chart,
+    WorkStealingPool* pool,
+    const ChartParseOptions& options) {
+    (void)simfile_path;
+    (void)on_chart;
+    (void)pool;
+    (void)options;
+    (void)steps_type;
+    (void)difficulty;
+    (void)description;
+    return 0;
+}
+
 std::vector<ChartMetrics> parse_all_charts_with_itgmania(
     const std::string& simfile_path,
     const std::string& steps_type,
     const std::string& difficulty,
-    const std::string& description) {
+    const std::string& description,
+    WorkStealingPool* pool,
+    const ChartParseOptions& options) {
     (void)simfile_path;
+    (void)pool;
+    (void)options;
     (void)steps_type;
     (void)difficulty;
     (void)description;
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <iosfwd>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "chart_fields.h"
+
+class ResultCache;
+class WorkStealingPool;
+
 struct TechCountsOut {
     int crossovers = 0;
     int footswitches = 0;
@@ -84,21 +91,116 @@ struct ChartMetrics {
     std::vector<std::vector<double>> timing_speeds;
     std::vector<std::vector<double>> timing_scrolls;
     std::vector<std::vector<double>> timing_fakes;
+    // Set with ChartParseOptions::share_timing: a content hash of the timing
+    // tables. When timing_shared is true the tables above are left empty and
+    // an earlier chart of the same song with this id carries them.
+    std::string timing_id;
+    bool timing_shared = false;
+};
+
+struct ChartParseOptions {
+    // Fill only status, simfile, steps_type, difficulty, description, meter,
+    // hash and hash_bpms; the note data is never analyzed.
+    bool hash_only = false;
+    // Fields the caller will read. Work that only feeds other fields (step
+    // parity for tech_counts, SL breakdowns, timing tables, ...) is skipped
+    // and those fields keep their defaults.
+    ChartFieldSet fields = all_chart_fields();
+    // Compute each distinct timing of a song once: the first chart (in song
+    // order) with it gets the tables, later charts with identical timing only
+    // its timing_id.
+    bool share_timing = false;
+    // Whole-simfile requests (no steps type, difficulty or description) are
+    // read from and stored into this cache; null disables it. Not used with
+    // SLEngine::Verify, which has to run both engines to report mismatches.
+    // Tech counts are memoized here by note data for every request.
+    ResultCache* cache = nullptr;
 };
 
 std::optional<ChartMetrics> parse_chart_with_itgmania(
     const std::string& simfile_path,
     const std::string& steps_type,
     const std::string& difficulty,
-    const std::string& description);
+    const std::string& description,
+    const ChartParseOptions& options = {});
+// With a pool, the charts of the simfile are analyzed concurrently (when the
+// runtime is thread safe); results keep the song's chart order either way.
 std::vector<ChartMetrics> parse_all_charts_with_itgmania(
     const std::string& simfile_path,
     const std::string& steps_type,
     const std::string& difficulty,
-    const std::string& description);
+    const std::string& description,
+    WorkStealingPool* pool = nullptr,
+    const ChartParseOptions& options = {});
+
+using ChartCallback = std::function<void(ChartMetrics&&)>;
+
+// Same selection and order as parse_all_charts_with_itgmania, but each chart
+// is handed to on_chart as soon as it and every chart before it are done, so
+// callers can stream results instead of holding the whole song. on_chart is
+// never called concurrently. Returns the number of charts delivered (0 when
+// the simfile fails to load).
+size_t for_each_chart_with_itgmania(
+    const std::string& simfile_path,
+    const std::string& steps_type,
+    const std::string& difficulty,
+    const std::string& description,
+    const ChartCallback& on_chart,
+    WorkStealingPool* pool = nullptr,
+    const ChartParseOptions& options = {});
+
+using IndexedChartCallback = std::function<void(size_t index, ChartMetrics&&)>;
+
+// Same selection as for_each_chart_with_itgmania, but with a pool each chart
+// goes to on_chart from the worker that built it, concurrently and in
+// completion order; index is its position in the song's chart order. Lets
+// callers do per-chart work such as serialization in parallel and restore the
+// order themselves. Returns the number of charts (0 when the simfile fails
+// to load).
+size_t for_each_chart_unordered_with_itgmania(
+    const std::string& simfile_path,
+    const std::string& steps_type,
+    const std::string& difficulty,
+    const std::string& description,
+    const IndexedChartCallback& on_chart,
+    WorkStealingPool* pool = nullptr,
+    const ChartParseOptions& options = {});
 
 void init_itgmania_runtime(int argc, char** argv);
 
+// Load SL-ChartParser.lua and SL-ChartParserHelpers.lua from dir instead of the
+// copies embedded at build time. Call before the first parse.
+void set_sl_scripts_dir(const std::string& dir);
+
+// Under dir, compiled forms of simfiles (see compiled_simfile.h) are used in
+// place of parsing the simfile text whenever one matches the simfile's bytes;
+// other simfiles are parsed as usual. Call before the first parse.
+void set_compiled_simfile_dir(const std::string& dir);
+
+// Parses the simfile with ITGmania's loader and writes its compiled form
+// under out_dir. On failure returns false and describes the problem in error.
+bool compile_simfile_with_itgmania(const std::string& simfile_path, const std::string& out_dir, std::string* error);
+
+// Which implementation produces Simply Love's per-measure stream data: the SL
+// chart parser scripts, the native port (sl_stream_engine), or both, keeping
+// the Lua results and reporting every disagreement on stderr.
+enum class SLEngine {
+    Lua,
+    Native,
+    Verify,
+};
+
+// Call before the first parse. Charts whose steps type ITGMania can't build
+// note data for always use Lua.
+void set_sl_engine(SLEngine engine);
+
+// Charts where the native engine disagreed with Lua under SLEngine::Verify.
+size_t sl_engine_mismatch_count();
+
+// True when charts can be analyzed from several threads at once; otherwise the
+// parse functions serialize callers internally.
+bool itgmania_runtime_is_thread_safe();
+
 bool emit_step_parity_dump(
     std::ostream& out,
     const std::string& simfile_path,
@@ -38,27 +38,37 @@ extern "C" {
 #include "NotesLoaderKSF.h"
 #include "NotesLoaderBMS.h"
 #include "RageSoundReader_FileReader.h"
+#include "RageTimer.h"
 #include "RageTypes.h"
 #include "arch/ArchHooks/ArchHooks.h"
 #include "arch/Threads/Threads.h"
 #include "StdString.h"
 
+#include "simfile_buffer.h"
+
 #include <tomcrypt.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cctype>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
 #include <cwctype>
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <new>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include <ctime>
 #include <cstdlib>
@@ -378,16 +388,138 @@ void GetDirListing(const RString& path, std::vector<RString>& out, bool onlyDirs
 
 RageSoundReader_FileReader* RageSoundReader_FileReader::OpenFile(RString, RString& error, bool*) { error = ""; return nullptr; }
 
-ThreadImpl* MakeThread(int (*)(void*), void*, uint64_t* piThreadID) { if (piThreadID) *piThreadID = 0; return nullptr; }
-ThreadImpl* MakeThisThread() { return nullptr; }
-MutexImpl* MakeMutex(RageMutex*) { return nullptr; }
-EventImpl* MakeEvent(MutexImpl*) { return nullptr; }
-SemaImpl* MakeSemaphore(int) { return nullptr; }
-uint64_t GetThisThreadId() { return 0; }
+// ---------------------------------------------------------------------------
+// Thread primitives backed by the standard library, so RageMutex, RageEvent
+// and RageThread behave when charts are analyzed on several workers.
+namespace {
+uint64_t allocate_thread_id() {
+	static std::atomic<uint64_t> next_id{1};
+	return next_id.fetch_add(1);
+}
+
+thread_local const uint64_t tThisThreadId = allocate_thread_id();
+
+class ThreadImpl_Std final : public ThreadImpl {
+  public:
+	ThreadImpl_Std(int (*fn)(void*), void* data, uint64_t* piThreadID) {
+		std::promise<uint64_t> started;
+		std::future<uint64_t> id = started.get_future();
+		m_Thread = std::thread([this, fn, data, piThreadID, started = std::move(started)]() mutable {
+			// Publish the id before running, like the pthreads backend does.
+			if (piThreadID) *piThreadID = GetThisThreadId();
+			started.set_value(GetThisThreadId());
+			m_iResult = fn(data);
+		});
+		m_iThreadId = id.get();
+	}
+	~ThreadImpl_Std() override {
+		if (m_Thread.joinable()) m_Thread.detach();
+	}
+	void Halt(bool) override {}
+	void Resume() override {}
+	uint64_t GetThreadId() const override { return m_iThreadId; }
+	int Wait() override {
+		if (m_Thread.joinable()) m_Thread.join();
+		return m_iResult;
+	}
+
+  private:
+	std::thread m_Thread;
+	uint64_t m_iThreadId = 0;
+	int m_iResult = 0;
+};
+
+class ThisThreadImpl_Std final : public ThreadImpl {
+  public:
+	void Halt(bool) override {}
+	void Resume() override {}
+	uint64_t GetThreadId() const override { return m_iThreadId; }
+	int Wait() override { return 0; }
+
+  private:
+	uint64_t m_iThreadId = GetThisThreadId();
+};
+
+class MutexImpl_Std final : public MutexImpl {
+  public:
+	explicit MutexImpl_Std(RageMutex* pParent) : MutexImpl(pParent) {}
+	bool Lock() override { m_Mutex.lock(); return true; }
+	bool TryLock() override { return m_Mutex.try_lock(); }
+	void Unlock() override { m_Mutex.unlock(); }
+
+	std::mutex m_Mutex;
+};
+
+// Waits on the mutex the owning RageEvent already holds.
+class EventImpl_Std final : public EventImpl {
+  public:
+	explicit EventImpl_Std(MutexImpl_Std* pParent) : m_pParent(pParent) {}
+	bool Wait(RageTimer* pTimeout) override {
+		std::unique_lock<std::mutex> lock(m_pParent->m_Mutex, std::adopt_lock);
+		bool bSignaled = true;
+		if (pTimeout != nullptr) {
+			const float fSeconds = std::max(0.0f, -pTimeout->Ago());
+			bSignaled = m_Cond.wait_for(lock, std::chrono::duration<float>(fSeconds)) == std::cv_status::no_timeout;
+		} else {
+			m_Cond.wait(lock);
+		}
+		lock.release();
+		return bSignaled;
+	}
+	void Signal() override { m_Cond.notify_one(); }
+	void Broadcast() override { m_Cond.notify_all(); }
+	bool WaitTimeoutSupported() const override { return true; }
+
+  private:
+	MutexImpl_Std* m_pParent;
+	std::condition_variable m_Cond;
+};
+
+class SemaImpl_Std final : public SemaImpl {
+  public:
+	explicit SemaImpl_Std(int iInitialValue) : m_iValue(iInitialValue) {}
+	int GetValue() const override {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_iValue;
+	}
+	void Post() override {
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			++m_iValue;
+		}
+		m_Cond.notify_one();
+	}
+	bool Wait() override {
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Cond.wait(lock, [this]() { return m_iValue > 0; });
+		--m_iValue;
+		return true;
+	}
+	bool TryWait() override {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_iValue == 0) return false;
+		--m_iValue;
+		return true;
+	}
+
+  private:
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_Cond;
+	int m_iValue;
+};
+} // namespace
+
+ThreadImpl* MakeThread(int (*fn)(void*), void* data, uint64_t* piThreadID) { return new ThreadImpl_Std(fn, data, piThreadID); }
+ThreadImpl* MakeThisThread() { return new ThisThreadImpl_Std; }
+MutexImpl* MakeMutex(RageMutex* pParent) { return new MutexImpl_Std(pParent); }
+EventImpl* MakeEvent(MutexImpl* pMutex) { return new EventImpl_Std(static_cast<MutexImpl_Std*>(pMutex)); }
+SemaImpl* MakeSemaphore(int iInitialValue) { return new SemaImpl_Std(iInitialValue); }
+uint64_t GetThisThreadId() { return tThisThreadId; }
 uint64_t GetInvalidThreadId() { return 0; }
 
 // ---------------------------------------------------------------------------
-// Minimal RageFile backed by std::ifstream
+// Minimal RageFile backed by std::ifstream, or by the shared simfile bytes
+// when the path is registered in the simfile buffer.
 class RageFileStd final : public RageFileBasic {
   public:
 	RageFileStd() : m_size(-1) {}
@@ -471,6 +603,14 @@ class RageFileStd final : public RageFileBasic {
 	bool Open(const RString& path, int /*mode*/) {
 		m_path = path;
 		m_error.clear();
+		m_stream.reset();
+		m_buffer.reset();
+		if (SimfileBytes bytes = find_simfile_buffer(path.c_str())) {
+			m_buffer.reset(new SimfileBufferStreamBuf(std::move(bytes)));
+			m_stream.reset(new std::istream(m_buffer.get()));
+			m_size = -1;
+			return true;
+		}
 		m_stream.reset(new std::ifstream(path.c_str(), std::ios::binary));
 		if (!*m_stream) {
 			m_error = "open failed";
@@ -485,7 +625,8 @@ class RageFileStd final : public RageFileBasic {
 	RString m_path;
 	mutable int m_size;
 	RString m_error;
-	std::unique_ptr<std::ifstream> m_stream;
+	std::unique_ptr<SimfileBufferStreamBuf> m_buffer;
+	std::unique_ptr<std::istream> m_stream;
 };
 
 RageFile::RageFile() : m_File(nullptr), m_Mode(0) {}
@@ -739,8 +880,11 @@ bool GameState::ChangePreferredDifficulty(PlayerNumber, int) { return false; }
 bool GameState::ChangePreferredCourseDifficultyAndStepsType(PlayerNumber, CourseDifficulty, StepsType) { return false; }
 bool GameState::ChangePreferredCourseDifficulty(PlayerNumber, int) { return false; }
 const Style* GameState::GetCurrentStyle(PlayerNumber) const { return nullptr; }
-void GameState::SetProcessedTimingData(TimingData* td) { processedTiming = td; }
-TimingData* GameState::GetProcessedTimingData() const { return processedTiming; }
+// Processed timing is only set around one chart's analysis, so each thread
+// keeps its own instead of sharing the GameState member.
+static thread_local TimingData* tProcessedTiming = nullptr;
+void GameState::SetProcessedTimingData(TimingData* td) { tProcessedTiming = td; }
+TimingData* GameState::GetProcessedTimingData() const { return tProcessedTiming; }
 bool GameState::IsCourseDifficultyShown(CourseDifficulty) { return true; }
 
 GameManager::GameManager() = default;
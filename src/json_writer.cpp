@@ -0,0 +1,74 @@
+#include "json_writer.h"
+
+#include "text_encoding.h"
+
+#include <charconv>
+#include <cmath>
+#include <ostream>
+
+namespace {
+
+void append_unicode_escape(std::string& out, unsigned int value) {
+    static const char* hex = "0123456789abcdef";
+    out += "\\u";
+    out.push_back(hex[(value >> 12) & 0x0F]);
+    out.push_back(hex[(value >> 8) & 0x0F]);
+    out.push_back(hex[(value >> 4) & 0x0F]);
+    out.push_back(hex[value & 0x0F]);
+}
+
+// Appends s with JSON escapes; legacy bytes are transcoded when s is not
+// valid UTF-8.
+void append_escaped(std::string& out, std::string_view s) {
+    const bool utf8 = is_valid_utf8(s);
+    for (unsigned char uc : s) {
+        switch (uc) {
+            case '\\': out += "\\\\"; break;
+            case '"': out += "\\\""; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (uc < 0x20) {
+                    append_unicode_escape(out, uc);
+                } else if (uc < 0x80 || utf8) {
+                    out.push_back(static_cast<char>(uc));
+                } else {
+                    append_utf8(out, cp1252_to_unicode(uc));
+                }
+        }
+    }
+}
+
+} // namespace
+
+void JsonWriter::string(std::string_view value) {
+    buffer_.reserve(buffer_.size() + value.size() + 2);
+    buffer_.push_back('"');
+    append_escaped(buffer_, value);
+    buffer_.push_back('"');
+}
+
+void JsonWriter::number(double value) {
+    if (!std::isfinite(value)) {
+        null();
+        return;
+    }
+    // Shortest round-trip form; 32 bytes covers every double.
+    char digits[32];
+    const std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer_.append(digits, result.ptr);
+}
+
+void JsonWriter::number(int value) {
+    char digits[16];
+    const std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer_.append(digits, result.ptr);
+}
+
+void JsonWriter::flush_to(std::ostream& out) {
+    out.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    buffer_.clear();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Append-only JSON text buffer. Values are formatted straight into the buffer:
+// strings are escaped in place (invalid UTF-8 is read as Windows-1252, which is
+// what older simfiles use), doubles use the shortest representation that
+// round-trips, and NaN/infinity become null. The output depends only on the
+// values written, never on the stream locale or precision.
+class JsonWriter {
+public:
+    void raw(std::string_view text) { buffer_.append(text); }
+    void raw(char c) { buffer_.push_back(c); }
+
+    void string(std::string_view value);
+    void number(double value);
+    void number(int value);
+    void boolean(bool value) { raw(value ? "true" : "false"); }
+    void null() { raw("null"); }
+
+    const std::string& str() const { return buffer_; }
+    size_t size() const { return buffer_.size(); }
+    bool empty() const { return buffer_.empty(); }
+    void clear() { buffer_.clear(); }
+    // Moves the contents out, leaving the writer empty.
+    std::string take() { return std::exchange(buffer_, std::string()); }
+
+    // Writes the buffer to out and empties it.
+    void flush_to(std::ostream& out);
+
+private:
+    std::string buffer_;
+};
@@ -1,153 +1,177 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 #include <iomanip>
 
+#include "baseline_diff.h"
+#include "binary_archive.h"
+#include "build_id.h"
+#include "columnar_export.h"
 #include "itgmania_adapter.h"
+#include "json_writer.h"
+#include "msgpack_writer.h"
+#include "ordered_output.h"
+#include "result_cache.h"
+#include "simfile_buffer.h"
+#include "simfile_scan.h"
+#include "simfile_watch.h"
+#include "sqlite_sink.h"
+#include "thread_pool.h"
+#include "zstd_output.h"
 
-static constexpr std::string_view kVersion = "0.1.19";
+static constexpr std::string_view kVersion = "0.1.21";
 
-static bool is_valid_utf8(std::string_view s) {
-    size_t i = 0;
-    while (i < s.size()) {
-        const unsigned char c = static_cast<unsigned char>(s[i]);
-        if (c < 0x80) {
-            ++i;
-            continue;
-        }
-        if (c < 0xC2) {
-            return false;
-        }
-        int len = 0;
-        if ((c & 0xE0) == 0xC0) {
-            len = 2;
-        } else if ((c & 0xF0) == 0xE0) {
-            len = 3;
-        } else if ((c & 0xF8) == 0xF0) {
-            len = 4;
-        } else {
-            return false;
-        }
-        if (i + static_cast<size_t>(len) > s.size()) {
-            return false;
+// Whitespace of the JSON output: the indented document layout, or everything
+// on one line for --ndjson.
+struct JsonLayout {
+    bool compact = false;
+
+    // Separator between the items of an inline array.
+    std::string_view item_separator() const { return compact ? "," : ", "; }
+
+    void key(JsonWriter& out, std::string_view name) const {
+        out.string(name);
+        out.raw(compact ? ":" : ": ");
+    }
+
+    // Starts a member of an object whose members sit at indent ind.
+    void member(JsonWriter& out, const std::string& ind, bool first, std::string_view name) const {
+        if (!first) out.raw(',');
+        if (!compact) {
+            out.raw('\n');
+            out.raw(ind);
         }
-        for (int j = 1; j < len; ++j) {
-            const unsigned char cc = static_cast<unsigned char>(s[i + j]);
-            if ((cc & 0xC0) != 0x80) {
-                return false;
-            }
+        key(out, name);
+    }
+
+    // Closes an object whose closing brace sits at indent ind.
+    void close(JsonWriter& out, const std::string& ind) const {
+        if (!compact) {
+            out.raw('\n');
+            out.raw(ind);
         }
-        i += static_cast<size_t>(len);
+        out.raw('}');
     }
-    return true;
+};
+
+template <typename T, typename EmitOneFn>
+static void emit_inline_array(
+    JsonWriter& out,
+    const JsonLayout& layout,
+    const std::vector<T>& values,
+    const EmitOneFn& emit_one) {
+    out.raw('[');
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i) out.raw(layout.item_separator());
+        emit_one(out, values[i]);
+    }
+    out.raw(']');
 }
 
-static void append_unicode_escape(std::string& out, unsigned int value) {
-    static const char* hex = "0123456789abcdef";
-    out += "\\u";
-    out.push_back(hex[(value >> 12) & 0x0F]);
-    out.push_back(hex[(value >> 8) & 0x0F]);
-    out.push_back(hex[(value >> 4) & 0x0F]);
-    out.push_back(hex[value & 0x0F]);
+static void emit_number_table(JsonWriter& out, const JsonLayout& layout, const std::vector<std::vector<double>>& table) {
+    emit_inline_array(out, layout, table, [&](JsonWriter& out, const std::vector<double>& row) {
+        emit_inline_array(out, layout, row, [](JsonWriter& out, double v) { out.number(v); });
+    });
 }
 
-static void append_utf8(std::string& out, unsigned int value) {
-    if (value <= 0x7F) {
-        out.push_back(static_cast<char>(value));
-    } else if (value <= 0x7FF) {
-        out.push_back(static_cast<char>(0xC0 | (value >> 6)));
-        out.push_back(static_cast<char>(0x80 | (value & 0x3F)));
-    } else if (value <= 0xFFFF) {
-        out.push_back(static_cast<char>(0xE0 | (value >> 12)));
-        out.push_back(static_cast<char>(0x80 | ((value >> 6) & 0x3F)));
-        out.push_back(static_cast<char>(0x80 | (value & 0x3F)));
-    } else {
-        out.push_back(static_cast<char>(0xF0 | (value >> 18)));
-        out.push_back(static_cast<char>(0x80 | ((value >> 12) & 0x3F)));
-        out.push_back(static_cast<char>(0x80 | ((value >> 6) & 0x3F)));
-        out.push_back(static_cast<char>(0x80 | (value & 0x3F)));
-    }
+static void emit_labels_table(JsonWriter& out, const JsonLayout& layout, const std::vector<TimingLabelOut>& labels) {
+    emit_inline_array(out, layout, labels, [&](JsonWriter& out, const TimingLabelOut& label) {
+        out.raw('[');
+        out.number(label.beat);
+        out.raw(layout.item_separator());
+        out.string(label.label);
+        out.raw(']');
+    });
 }
 
-static unsigned int cp1252_to_unicode(unsigned char value) {
-    static const unsigned int kMap[32] = {
-        0x20AC, 0xFFFD, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
-        0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0xFFFD, 0x017D, 0xFFFD,
-        0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
-        0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0xFFFD, 0x017E, 0x0178
-    };
-    if (value < 0x80 || value > 0x9F) {
-        return value;
-    }
-    return kMap[value - 0x80];
-}
-
-static std::string json_escape(std::string_view s) {
-    std::string out;
-    out.reserve(s.size());
-    if (!is_valid_utf8(s)) {
-        for (unsigned char uc : s) {
-            switch (uc) {
-                case '\\': out += "\\\\"; break;
-                case '"': out += "\\\""; break;
-                case '\b': out += "\\b"; break;
-                case '\f': out += "\\f"; break;
-                case '\n': out += "\\n"; break;
-                case '\r': out += "\\r"; break;
-                case '\t': out += "\\t"; break;
-                default:
-                    if (uc < 0x20) {
-                        append_unicode_escape(out, uc);
-                    } else if (uc < 0x80) {
-                        out.push_back(static_cast<char>(uc));
-                    } else {
-                        append_utf8(out, cp1252_to_unicode(uc));
-                    }
-            }
-        }
-        return out;
-    }
-    for (unsigned char uc : s) {
-        switch (uc) {
-            case '\\': out += "\\\\"; break;
-            case '"': out += "\\\""; break;
-            case '\b': out += "\\b"; break;
-            case '\f': out += "\\f"; break;
-            case '\n': out += "\\n"; break;
-            case '\r': out += "\\r"; break;
-            case '\t': out += "\\t"; break;
-            default:
-                if (uc < 0x20) {
-                    append_unicode_escape(out, uc);
-                } else {
-                    out.push_back(static_cast<char>(uc));
-                }
+// How the per-measure arrays are printed: one item per measure, or
+// (--compact-measures) runs of equal values as [value, count] pairs and the
+// equally-spaced flags as a bitset.
+enum class MeasureEncoding {
+    Full,
+    Compact,
+};
+
+// Runs of equal consecutive values, as (value, count).
+template <typename T>
+static std::vector<std::pair<T, int>> measure_runs(const std::vector<T>& values) {
+    std::vector<std::pair<T, int>> runs;
+    for (const T& value : values) {
+        if (!runs.empty() && runs.back().first == value) {
+            ++runs.back().second;
+        } else {
+            runs.emplace_back(value, 1);
         }
     }
-    return out;
+    return runs;
 }
 
-template <typename T, typename EmitOneFn>
-static void emit_inline_array(std::ostream& out, const std::vector<T>& values, const EmitOneFn& emit_one) {
-    out << "[";
-    for (size_t i = 0; i < values.size(); ++i) {
-        if (i) out << ", ";
-        emit_one(out, values[i]);
+// Measure i is bit i % 8 of byte i / 8.
+static std::string measure_bits(const std::vector<bool>& flags) {
+    std::string bits((flags.size() + 7) / 8, '\0');
+    for (size_t i = 0; i < flags.size(); ++i) {
+        if (flags[i]) bits[i / 8] = static_cast<char>(bits[i / 8] | (1 << (i % 8)));
     }
-    out << "]";
+    return bits;
 }
 
-static void emit_number_table(std::ostream& out, const std::vector<std::vector<double>>& table) {
-    emit_inline_array(out, table, [](std::ostream& out, const std::vector<double>& row) {
-        emit_inline_array(out, row, [](std::ostream& out, double v) { out << v; });
+template <typename T>
+static void emit_measure_array(
+    JsonWriter& out,
+    const JsonLayout& layout,
+    const std::vector<T>& values,
+    MeasureEncoding measures) {
+    if (measures == MeasureEncoding::Full) {
+        emit_inline_array(out, layout, values, [](JsonWriter& out, T v) { out.number(v); });
+        return;
+    }
+    emit_inline_array(out, layout, measure_runs(values), [&](JsonWriter& out, const std::pair<T, int>& run) {
+        out.raw('[');
+        out.number(run.first);
+        out.raw(layout.item_separator());
+        out.number(run.second);
+        out.raw(']');
     });
 }
 
-static void emit_labels_table(std::ostream& out, const std::vector<TimingLabelOut>& labels) {
-    emit_inline_array(out, labels, [](std::ostream& out, const TimingLabelOut& label) {
-        out << "[" << label.beat << ", \"" << json_escape(label.label) << "\"]";
-    });
+// Compact form: {"count": measures, "bits": bitset as lowercase hex}.
+static void emit_measure_flags(
+    JsonWriter& out,
+    const JsonLayout& layout,
+    const std::vector<bool>& flags,
+    MeasureEncoding measures) {
+    if (measures == MeasureEncoding::Full) {
+        emit_inline_array(out, layout, flags, [](JsonWriter& out, bool v) { out.boolean(v); });
+        return;
+    }
+    static constexpr char kHex[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char byte : measure_bits(flags)) {
+        hex.push_back(kHex[byte >> 4]);
+        hex.push_back(kHex[byte & 0x0F]);
+    }
+    out.raw('{');
+    layout.key(out, "count");
+    out.number(static_cast<int>(flags.size()));
+    out.raw(layout.item_separator());
+    layout.key(out, "bits");
+    out.string(hex);
+    out.raw('}');
 }
 
 static void print_usage() {
@@ -155,49 +179,235 @@ static void print_usage() {
         << "itgmania-reference-harness v" << kVersion << "\n"
         << "Usage:\n"
         << "  itgmania-reference-harness [--hash|-h] <simfile> [steps-type] [difficulty] [description]\n"
+        << "  itgmania-reference-harness [--hash|-h] --scan <songs-dir>\n"
         << "\n"
         << "Options:\n"
         << "  --version, -v Print the version and exit\n"
         << "  --hash, -h   Print a hash list (one line per chart), no JSON\n"
+        << "  --scan <dir> Analyze every simfile under a Songs/pack/song folder in one process\n"
+        << "  --watch <dir> Analyze every simfile under <dir>, then re-analyze simfiles as they change\n"
+        << "               (NDJSON events on stdout; runs until interrupted)\n"
+        << "  -j, --jobs N Worker threads for simfiles (--scan) and their charts (0 = one per core)\n"
         << "  --omit-tech  Omit tech_counts from JSON output\n"
+        << "  --ndjson     One compact JSON object per chart and line, written as each chart finishes\n"
+        << "  --format <json|ndjson|msgpack> Output format (msgpack: one MessagePack map per chart)\n"
+        << "  --fields a,b,... Only compute and print these JSON keys (e.g. hash,meter,peak_nps)\n"
+        << "  --baseline <file> With --scan, print only charts added, removed or changed since a previous\n"
+        << "               JSON/NDJSON output, with the changed keys' old and new values\n"
+        << "  --compact-measures Print per-measure arrays as [value, count] runs and a bitset\n"
+        << "  --shared-timing Print each distinct timing of a song once; later charts refer to it by id\n"
+        << "  --columns <dir> Write charts as memory-mappable column files under <dir> instead of stdout\n"
+        << "  --sqlite <db> Upsert charts into a SQLite database instead of stdout\n"
+        << "  --compress zstd[:level] Compress stdout into a zstd stream on a separate thread\n"
+        << "  --no-cache   Analyze every simfile instead of reading unchanged ones from the result cache\n"
+        << "  --refresh    Re-analyze every simfile and rewrite its cache entry\n"
+        << "  --cache-dir <dir> Result cache directory (default ~/.cache/itgmania-reference-harness)\n"
+        << "  --cache-size <MiB> Size bound of the result cache (default 1024)\n"
+        << "  --compile <dir> Parse the simfile (or every simfile under --scan) and write its compiled\n"
+        << "               binary form under <dir>\n"
+        << "  --compiled <dir> Load simfiles from their compiled form under <dir> when it is up to date\n"
+        << "  --sl-scripts <dir> Load the Simply Love chart parser scripts from <dir>\n"
+        << "  --sl-engine <lua|native|verify> Stream/breakdown engine (default lua; verify compares both,\n"
+        << "               reports mismatches to stderr and exits 3 if any)\n"
         << "  --dump-rows  Emit step parity row dumps to stderr\n"
         << "  --dump-notes Emit step parity note dumps to stderr\n"
         << "  --dump-path  Emit step parity path dumps to stderr\n"
         << "  --help       Show this help\n";
 }
 
-static void emit_json_stub_timing(std::ostream& out, bool trailing_comma) {
-    out << "  \"timing\": {\n";
-    out << "    \"beat0_offset_seconds\": null,\n";
-    out << "    \"beat0_group_offset_seconds\": null,\n";
-    out << "    \"bpms\": [],\n";
-    out << "    \"stops\": [],\n";
-    out << "    \"delays\": [],\n";
-    out << "    \"time_signatures\": [],\n";
-    out << "    \"warps\": [],\n";
-    out << "    \"labels\": [],\n";
-    out << "    \"tickcounts\": [],\n";
-    out << "    \"combos\": [],\n";
-    out << "    \"speeds\": [],\n";
-    out << "    \"scrolls\": [],\n";
-    out << "    \"fakes\": []\n";
-    out << "  }";
-    if (trailing_comma) {
-        out << ",\n";
+template <typename T>
+static void emit_json_number(JsonWriter& out, T value, bool null_numbers) {
+    if (null_numbers) {
+        out.null();
     } else {
-        out << "\n";
+        out.number(value);
+    }
+}
+
+static void emit_chart_json_timing(
+    JsonWriter& out,
+    const JsonLayout& layout,
+    const ChartMetrics& m,
+    const std::string& ind2,
+    bool null_numbers) {
+    const std::string ind3 = ind2 + "  ";
+    auto table = [&](std::string_view name, const std::vector<std::vector<double>>& rows) {
+        layout.member(out, ind3, false, name);
+        emit_number_table(out, layout, rows);
+    };
+
+    out.raw('{');
+    // --shared-timing: an id on every block; charts that reuse an earlier
+    // chart's timing print nothing else.
+    const bool with_id = !m.timing_id.empty();
+    if (with_id) {
+        layout.member(out, ind3, true, "id");
+        out.string(m.timing_id);
+        if (m.timing_shared) {
+            layout.close(out, ind2);
+            return;
+        }
     }
+    layout.member(out, ind3, !with_id, "beat0_offset_seconds");
+    emit_json_number(out, m.beat0_offset_seconds, null_numbers);
+    layout.member(out, ind3, false, "beat0_group_offset_seconds");
+    emit_json_number(out, m.beat0_group_offset_seconds, null_numbers);
+    table("bpms", m.timing_bpms);
+    table("stops", m.timing_stops);
+    table("delays", m.timing_delays);
+    table("time_signatures", m.timing_time_signatures);
+    table("warps", m.timing_warps);
+    layout.member(out, ind3, false, "labels");
+    emit_labels_table(out, layout, m.timing_labels);
+    table("tickcounts", m.timing_tickcounts);
+    table("combos", m.timing_combos);
+    table("speeds", m.timing_speeds);
+    table("scrolls", m.timing_scrolls);
+    table("fakes", m.timing_fakes);
+    layout.close(out, ind2);
 }
 
-static void emit_json_stub_tech_counts(std::ostream& out) {
-    out << "  \"tech_counts\": {\n";
-    out << "    \"crossovers\": 0,\n";
-    out << "    \"footswitches\": 0,\n";
-    out << "    \"sideswitches\": 0,\n";
-    out << "    \"jacks\": 0,\n";
-    out << "    \"brackets\": 0,\n";
-    out << "    \"doublesteps\": 0\n";
-    out << "  }\n";
+static void emit_chart_json_tech_counts(
+    JsonWriter& out,
+    const JsonLayout& layout,
+    const ChartMetrics& m,
+    const std::string& ind2) {
+    const std::string ind3 = ind2 + "  ";
+    const std::pair<std::string_view, int> counts[] = {
+        {"crossovers", m.tech.crossovers},
+        {"footswitches", m.tech.footswitches},
+        {"sideswitches", m.tech.sideswitches},
+        {"jacks", m.tech.jacks},
+        {"brackets", m.tech.brackets},
+        {"doublesteps", m.tech.doublesteps},
+    };
+    out.raw('{');
+    for (size_t i = 0; i < std::size(counts); ++i) {
+        layout.member(out, ind3, i == 0, counts[i].first);
+        out.number(counts[i].second);
+    }
+    layout.close(out, ind2);
+}
+
+// Writes the value of one top-level key. Stubs print null for every number
+// they could not compute.
+static void emit_chart_json_field(
+    JsonWriter& out,
+    const JsonLayout& layout,
+    const ChartMetrics& m,
+    ChartField field,
+    const std::string& ind2,
+    MeasureEncoding measures,
+    bool null_numbers) {
+    switch (field) {
+        case ChartField::Status: out.string(m.status); break;
+        case ChartField::Simfile: out.string(m.simfile); break;
+        case ChartField::Title: out.string(m.title); break;
+        case ChartField::Subtitle: out.string(m.subtitle); break;
+        case ChartField::Artist: out.string(m.artist); break;
+        case ChartField::TitleTranslated: out.string(m.title_translated); break;
+        case ChartField::SubtitleTranslated: out.string(m.subtitle_translated); break;
+        case ChartField::ArtistTranslated: out.string(m.artist_translated); break;
+        case ChartField::StepArtist: out.string(m.step_artist); break;
+        case ChartField::Description: out.string(m.description); break;
+        case ChartField::StepsType: out.string(m.steps_type); break;
+        case ChartField::Difficulty: out.string(m.difficulty); break;
+        case ChartField::Meter: emit_json_number(out, m.meter, null_numbers); break;
+        case ChartField::Bpms: out.string(m.bpms); break;
+        case ChartField::HashBpms: out.string(m.hash_bpms); break;
+        case ChartField::BpmMin: emit_json_number(out, m.bpm_min, null_numbers); break;
+        case ChartField::BpmMax: emit_json_number(out, m.bpm_max, null_numbers); break;
+        case ChartField::DisplayBpm: out.string(m.display_bpm); break;
+        case ChartField::DisplayBpmMin: emit_json_number(out, m.display_bpm_min, null_numbers); break;
+        case ChartField::DisplayBpmMax: emit_json_number(out, m.display_bpm_max, null_numbers); break;
+        case ChartField::Hash: out.string(m.hash); break;
+        case ChartField::DurationSeconds: emit_json_number(out, m.duration_seconds, null_numbers); break;
+        case ChartField::StreamsBreakdown: out.string(m.streams_breakdown); break;
+        case ChartField::StreamsBreakdownLevel1: out.string(m.streams_breakdown_level1); break;
+        case ChartField::StreamsBreakdownLevel2: out.string(m.streams_breakdown_level2); break;
+        case ChartField::StreamsBreakdownLevel3: out.string(m.streams_breakdown_level3); break;
+        case ChartField::TotalStreamMeasures: emit_json_number(out, m.total_stream_measures, null_numbers); break;
+        case ChartField::TotalBreakMeasures: emit_json_number(out, m.total_break_measures, null_numbers); break;
+        case ChartField::TotalSteps: emit_json_number(out, m.total_steps, null_numbers); break;
+        case ChartField::NotesPerMeasure: emit_measure_array(out, layout, m.notes_per_measure, measures); break;
+        case ChartField::NpsPerMeasure: emit_measure_array(out, layout, m.nps_per_measure, measures); break;
+        case ChartField::EquallySpacedPerMeasure:
+            emit_measure_flags(out, layout, m.equally_spaced_per_measure, measures);
+            break;
+        case ChartField::PeakNps: emit_json_number(out, m.peak_nps, null_numbers); break;
+        case ChartField::StreamSequences:
+            emit_inline_array(out, layout, m.stream_sequences, [&](JsonWriter& out, const StreamSequenceOut& seq) {
+                out.raw('{');
+                layout.key(out, "stream_start");
+                out.number(seq.stream_start);
+                out.raw(layout.item_separator());
+                layout.key(out, "stream_end");
+                out.number(seq.stream_end);
+                out.raw(layout.item_separator());
+                layout.key(out, "is_break");
+                out.boolean(seq.is_break);
+                out.raw('}');
+            });
+            break;
+        case ChartField::Holds: emit_json_number(out, m.holds, null_numbers); break;
+        case ChartField::Mines: emit_json_number(out, m.mines, null_numbers); break;
+        case ChartField::Rolls: emit_json_number(out, m.rolls, null_numbers); break;
+        case ChartField::TapsAndHolds: emit_json_number(out, m.taps_and_holds, null_numbers); break;
+        case ChartField::Notes: emit_json_number(out, m.notes, null_numbers); break;
+        case ChartField::Lifts: emit_json_number(out, m.lifts, null_numbers); break;
+        case ChartField::Fakes: emit_json_number(out, m.fakes, null_numbers); break;
+        case ChartField::Jumps: emit_json_number(out, m.jumps, null_numbers); break;
+        case ChartField::Hands: emit_json_number(out, m.hands, null_numbers); break;
+        case ChartField::Quads: emit_json_number(out, m.quads, null_numbers); break;
+        case ChartField::Timing: emit_chart_json_timing(out, layout, m, ind2, null_numbers); break;
+        case ChartField::TechCounts: emit_chart_json_tech_counts(out, layout, m, ind2); break;
+        case ChartField::Count: break;
+    }
+}
+
+static void emit_chart_json(
+    JsonWriter& out,
+    const ChartMetrics& m,
+    const std::string& indent,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    const JsonLayout& layout = {},
+    bool null_numbers = false) {
+    const std::string ind2 = indent + "  ";
+    out.raw(indent);
+    out.raw('{');
+    bool first = true;
+    for (size_t i = 0; i < kChartFieldCount; ++i) {
+        const ChartField field = static_cast<ChartField>(i);
+        if (!has_field(fields, field)) continue;
+        layout.member(out, ind2, first, chart_field_name(field));
+        emit_chart_json_field(out, layout, m, field, ind2, measures, null_numbers);
+        first = false;
+    }
+    layout.close(out, indent);
+}
+
+static ChartMetrics make_stub_metrics(
+    const std::string& simfile,
+    const std::string& steps_type,
+    const std::string& difficulty) {
+    ChartMetrics m;
+    m.status = "stub";
+    m.simfile = simfile;
+    m.steps_type = steps_type;
+    m.difficulty = difficulty;
+    return m;
+}
+
+static void emit_json(
+    std::ostream& out,
+    const ChartMetrics& m,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures) {
+    JsonWriter writer;
+    emit_chart_json(writer, m, "", fields, measures);
+    writer.raw("\n");
+    writer.flush_to(out);
 }
 
 static void emit_json_stub(
@@ -205,218 +415,311 @@ static void emit_json_stub(
     const std::string& simfile,
     const std::string& steps_type,
     const std::string& difficulty,
-    bool include_tech_counts) {
-    out << "{\n";
-    out << "  \"status\": \"stub\",\n";
-    out << "  \"simfile\": \"" << json_escape(simfile) << "\",\n";
-    out << "  \"title\": \"\",\n";
-    out << "  \"subtitle\": \"\",\n";
-    out << "  \"artist\": \"\",\n";
-    out << "  \"title_translated\": \"\",\n";
-    out << "  \"subtitle_translated\": \"\",\n";
-    out << "  \"artist_translated\": \"\",\n";
-    out << "  \"step_artist\": \"\",\n";
-    out << "  \"description\": \"\",\n";
-    out << "  \"steps_type\": \"" << json_escape(steps_type) << "\",\n";
-    out << "  \"difficulty\": \"" << json_escape(difficulty) << "\",\n";
-    out << "  \"meter\": null,\n";
-    out << "  \"bpms\": \"\",\n";
-    out << "  \"hash_bpms\": \"\",\n";
-    out << "  \"bpm_min\": null,\n";
-    out << "  \"bpm_max\": null,\n";
-    out << "  \"display_bpm\": \"\",\n";
-    out << "  \"display_bpm_min\": null,\n";
-    out << "  \"display_bpm_max\": null,\n";
-    out << "  \"hash\": \"\",\n";
-    out << "  \"duration_seconds\": null,\n";
-    out << "  \"streams_breakdown\": \"\",\n";
-    out << "  \"streams_breakdown_level1\": \"\",\n";
-    out << "  \"streams_breakdown_level2\": \"\",\n";
-    out << "  \"streams_breakdown_level3\": \"\",\n";
-    out << "  \"total_stream_measures\": null,\n";
-    out << "  \"total_break_measures\": null,\n";
-    out << "  \"total_steps\": null,\n";
-    out << "  \"notes_per_measure\": [],\n";
-    out << "  \"nps_per_measure\": [],\n";
-    out << "  \"equally_spaced_per_measure\": [],\n";
-    out << "  \"peak_nps\": null,\n";
-    out << "  \"stream_sequences\": [],\n";
-    out << "  \"holds\": null,\n";
-    out << "  \"mines\": null,\n";
-    out << "  \"rolls\": null,\n";
-    out << "  \"taps_and_holds\": null,\n";
-    out << "  \"notes\": null,\n";
-    out << "  \"lifts\": null,\n";
-    out << "  \"fakes\": null,\n";
-    out << "  \"jumps\": null,\n";
-    out << "  \"hands\": null,\n";
-    out << "  \"quads\": null,\n";
-    emit_json_stub_timing(out, include_tech_counts);
-    if (include_tech_counts) {
-        emit_json_stub_tech_counts(out);
-    }
-    out << "}\n";
-}
-
-static void emit_chart_json_header(std::ostream& out, const ChartMetrics& m, const std::string& ind2) {
-    out << ind2 << "\"status\": \"" << json_escape(m.status) << "\",\n";
-    out << ind2 << "\"simfile\": \"" << json_escape(m.simfile) << "\",\n";
-    out << ind2 << "\"title\": \"" << json_escape(m.title) << "\",\n";
-    out << ind2 << "\"subtitle\": \"" << json_escape(m.subtitle) << "\",\n";
-    out << ind2 << "\"artist\": \"" << json_escape(m.artist) << "\",\n";
-    out << ind2 << "\"title_translated\": \"" << json_escape(m.title_translated) << "\",\n";
-    out << ind2 << "\"subtitle_translated\": \"" << json_escape(m.subtitle_translated) << "\",\n";
-    out << ind2 << "\"artist_translated\": \"" << json_escape(m.artist_translated) << "\",\n";
-    out << ind2 << "\"step_artist\": \"" << json_escape(m.step_artist) << "\",\n";
-    out << ind2 << "\"description\": \"" << json_escape(m.description) << "\",\n";
-    out << ind2 << "\"steps_type\": \"" << json_escape(m.steps_type) << "\",\n";
-    out << ind2 << "\"difficulty\": \"" << json_escape(m.difficulty) << "\",\n";
-    out << ind2 << "\"meter\": " << m.meter << ",\n";
-    out << ind2 << "\"bpms\": \"" << json_escape(m.bpms) << "\",\n";
-    out << ind2 << "\"hash_bpms\": \"" << json_escape(m.hash_bpms) << "\",\n";
-    out << ind2 << "\"bpm_min\": " << m.bpm_min << ",\n";
-    out << ind2 << "\"bpm_max\": " << m.bpm_max << ",\n";
-    out << ind2 << "\"display_bpm\": \"" << json_escape(m.display_bpm) << "\",\n";
-    out << ind2 << "\"display_bpm_min\": " << m.display_bpm_min << ",\n";
-    out << ind2 << "\"display_bpm_max\": " << m.display_bpm_max << ",\n";
-    out << ind2 << "\"hash\": \"" << json_escape(m.hash) << "\",\n";
-    out << ind2 << "\"duration_seconds\": " << m.duration_seconds << ",\n";
-    out << ind2 << "\"streams_breakdown\": \"" << json_escape(m.streams_breakdown) << "\",\n";
-    out << ind2 << "\"streams_breakdown_level1\": \"" << json_escape(m.streams_breakdown_level1) << "\",\n";
-    out << ind2 << "\"streams_breakdown_level2\": \"" << json_escape(m.streams_breakdown_level2) << "\",\n";
-    out << ind2 << "\"streams_breakdown_level3\": \"" << json_escape(m.streams_breakdown_level3) << "\",\n";
-    out << ind2 << "\"total_stream_measures\": " << m.total_stream_measures << ",\n";
-    out << ind2 << "\"total_break_measures\": " << m.total_break_measures << ",\n";
-    out << ind2 << "\"total_steps\": " << m.total_steps << ",\n";
-}
-
-static void emit_chart_json_measure_data(std::ostream& out, const ChartMetrics& m, const std::string& ind2) {
-    out << ind2 << "\"notes_per_measure\": ";
-    emit_inline_array(out, m.notes_per_measure, [](std::ostream& out, int v) { out << v; });
-    out << ",\n";
-
-    out << ind2 << "\"nps_per_measure\": ";
-    emit_inline_array(out, m.nps_per_measure, [](std::ostream& out, double v) { out << v; });
-    out << ",\n";
-
-    out << ind2 << "\"equally_spaced_per_measure\": ";
-    emit_inline_array(out, m.equally_spaced_per_measure, [](std::ostream& out, bool v) { out << (v ? "true" : "false"); });
-    out << ",\n";
-
-    out << ind2 << "\"peak_nps\": " << m.peak_nps << ",\n";
-    out << ind2 << "\"stream_sequences\": ";
-    emit_inline_array(out, m.stream_sequences, [](std::ostream& out, const StreamSequenceOut& seq) {
-        out << "{\"stream_start\": " << seq.stream_start << ", \"stream_end\": " << seq.stream_end
-            << ", \"is_break\": " << (seq.is_break ? "true" : "false") << "}";
-    });
-    out << ",\n";
-
-    out << ind2 << "\"holds\": " << m.holds << ",\n";
-    out << ind2 << "\"mines\": " << m.mines << ",\n";
-    out << ind2 << "\"rolls\": " << m.rolls << ",\n";
-    out << ind2 << "\"taps_and_holds\": " << m.taps_and_holds << ",\n";
-    out << ind2 << "\"notes\": " << m.notes << ",\n";
-    out << ind2 << "\"lifts\": " << m.lifts << ",\n";
-    out << ind2 << "\"fakes\": " << m.fakes << ",\n";
-    out << ind2 << "\"jumps\": " << m.jumps << ",\n";
-    out << ind2 << "\"hands\": " << m.hands << ",\n";
-    out << ind2 << "\"quads\": " << m.quads << ",\n";
+    const ChartFieldSet& fields,
+    MeasureEncoding measures) {
+    JsonWriter writer;
+    emit_chart_json(
+        writer, make_stub_metrics(simfile, steps_type, difficulty), "", fields, measures, JsonLayout{}, true);
+    writer.raw("\n");
+    writer.flush_to(out);
 }
 
-static void emit_chart_json_timing(
-    std::ostream& out,
+// One compact JSON object per line (--ndjson).
+static void append_ndjson_line(
+    JsonWriter& out,
     const ChartMetrics& m,
-    const std::string& ind2,
-    bool trailing_comma) {
-    out << ind2 << "\"timing\": {\n";
-    out << ind2 << "  \"beat0_offset_seconds\": " << m.beat0_offset_seconds << ",\n";
-    out << ind2 << "  \"beat0_group_offset_seconds\": " << m.beat0_group_offset_seconds << ",\n";
-    out << ind2 << "  \"bpms\": ";
-    emit_number_table(out, m.timing_bpms);
-    out << ",\n";
-    out << ind2 << "  \"stops\": ";
-    emit_number_table(out, m.timing_stops);
-    out << ",\n";
-    out << ind2 << "  \"delays\": ";
-    emit_number_table(out, m.timing_delays);
-    out << ",\n";
-    out << ind2 << "  \"time_signatures\": ";
-    emit_number_table(out, m.timing_time_signatures);
-    out << ",\n";
-    out << ind2 << "  \"warps\": ";
-    emit_number_table(out, m.timing_warps);
-    out << ",\n";
-    out << ind2 << "  \"labels\": ";
-    emit_labels_table(out, m.timing_labels);
-    out << ",\n";
-    out << ind2 << "  \"tickcounts\": ";
-    emit_number_table(out, m.timing_tickcounts);
-    out << ",\n";
-    out << ind2 << "  \"combos\": ";
-    emit_number_table(out, m.timing_combos);
-    out << ",\n";
-    out << ind2 << "  \"speeds\": ";
-    emit_number_table(out, m.timing_speeds);
-    out << ",\n";
-    out << ind2 << "  \"scrolls\": ";
-    emit_number_table(out, m.timing_scrolls);
-    out << ",\n";
-    out << ind2 << "  \"fakes\": ";
-    emit_number_table(out, m.timing_fakes);
-    out << "\n";
-    out << ind2 << "}";
-    if (trailing_comma) {
-        out << ",\n";
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    bool null_numbers = false) {
+    emit_chart_json(out, m, "", fields, measures, JsonLayout{true}, null_numbers);
+    out.raw('\n');
+}
+
+static void msgpack_number(MsgPackWriter& out, double value, bool null_numbers) {
+    if (null_numbers) {
+        out.nil();
     } else {
-        out << "\n";
+        out.float64(value);
     }
 }
 
-static void emit_chart_json_tech_counts(std::ostream& out, const ChartMetrics& m, const std::string& indent, const std::string& ind2) {
-    out << ind2 << "\"tech_counts\": {\n";
-    out << ind2 << "  \"crossovers\": " << m.tech.crossovers << ",\n";
-    out << ind2 << "  \"footswitches\": " << m.tech.footswitches << ",\n";
-    out << ind2 << "  \"sideswitches\": " << m.tech.sideswitches << ",\n";
-    out << ind2 << "  \"jacks\": " << m.tech.jacks << ",\n";
-    out << ind2 << "  \"brackets\": " << m.tech.brackets << ",\n";
-    out << ind2 << "  \"doublesteps\": " << m.tech.doublesteps << "\n";
-    out << ind2 << "}\n";
-    out << indent << "}";
+static void msgpack_number(MsgPackWriter& out, int value, bool null_numbers) {
+    if (null_numbers) {
+        out.nil();
+    } else {
+        out.integer(value);
+    }
 }
 
-static void emit_chart_json(
-    std::ostream& out,
-    const ChartMetrics& m,
-    const std::string& indent,
-    bool include_tech_counts) {
-    const std::string ind2 = indent + "  ";
-    out << indent << "{\n";
-    emit_chart_json_header(out, m, ind2);
-    emit_chart_json_measure_data(out, m, ind2);
-    emit_chart_json_timing(out, m, ind2, include_tech_counts);
-    if (include_tech_counts) {
-        emit_chart_json_tech_counts(out, m, indent, ind2);
+template <typename T, typename EmitOneFn>
+static void msgpack_array(MsgPackWriter& out, const std::vector<T>& values, const EmitOneFn& emit_one) {
+    out.array_header(static_cast<uint32_t>(values.size()));
+    for (const T& value : values) emit_one(out, value);
+}
+
+static void msgpack_typed_array(MsgPackWriter& out, const std::vector<int>& values) {
+    out.int32_array(values);
+}
+
+static void msgpack_typed_array(MsgPackWriter& out, const std::vector<double>& values) {
+    out.float64_array(values);
+}
+
+// A timing table as one float64 array, its rows back to back (every row of a
+// table has the same width).
+static void msgpack_number_table(MsgPackWriter& out, const std::vector<std::vector<double>>& table) {
+    std::vector<double> values;
+    for (const std::vector<double>& row : table) values.insert(values.end(), row.begin(), row.end());
+    out.float64_array(values);
+}
+
+// A typed array; compact form: {"values": run values, "counts": run lengths},
+// both typed.
+template <typename T>
+static void msgpack_measure_array(MsgPackWriter& out, const std::vector<T>& values, MeasureEncoding measures) {
+    if (measures == MeasureEncoding::Full) {
+        msgpack_typed_array(out, values);
+        return;
+    }
+    std::vector<T> run_values;
+    std::vector<int> run_counts;
+    for (const std::pair<T, int>& run : measure_runs(values)) {
+        run_values.push_back(run.first);
+        run_counts.push_back(run.second);
+    }
+    out.map_header(2);
+    out.string("values");
+    msgpack_typed_array(out, run_values);
+    out.string("counts");
+    out.int32_array(run_counts);
+}
+
+// Compact form: {"count": measures, "bits": bitset as bin}.
+static void msgpack_measure_flags(MsgPackWriter& out, const std::vector<bool>& flags, MeasureEncoding measures) {
+    if (measures == MeasureEncoding::Full) {
+        msgpack_array(out, flags, [](MsgPackWriter& out, bool v) { out.boolean(v); });
+        return;
+    }
+    out.map_header(2);
+    out.string("count");
+    out.integer(static_cast<int64_t>(flags.size()));
+    out.string("bits");
+    out.binary(measure_bits(flags));
+}
+
+static void emit_chart_msgpack_timing(MsgPackWriter& out, const ChartMetrics& m, bool null_numbers) {
+    auto table = [&](std::string_view name, const std::vector<std::vector<double>>& rows) {
+        out.string(name);
+        msgpack_number_table(out, rows);
+    };
+
+    const bool with_id = !m.timing_id.empty();
+    if (m.timing_shared) {
+        out.map_header(1);
     } else {
-        out << indent << "}";
+        out.map_header(with_id ? 14 : 13);
     }
+    if (with_id) {
+        out.string("id");
+        out.string(m.timing_id);
+        if (m.timing_shared) return;
+    }
+    out.string("beat0_offset_seconds");
+    msgpack_number(out, m.beat0_offset_seconds, null_numbers);
+    out.string("beat0_group_offset_seconds");
+    msgpack_number(out, m.beat0_group_offset_seconds, null_numbers);
+    table("bpms", m.timing_bpms);
+    table("stops", m.timing_stops);
+    table("delays", m.timing_delays);
+    table("time_signatures", m.timing_time_signatures);
+    table("warps", m.timing_warps);
+    out.string("labels");
+    msgpack_array(out, m.timing_labels, [](MsgPackWriter& out, const TimingLabelOut& label) {
+        out.array_header(2);
+        out.float64(label.beat);
+        out.string(label.label);
+    });
+    table("tickcounts", m.timing_tickcounts);
+    table("combos", m.timing_combos);
+    table("speeds", m.timing_speeds);
+    table("scrolls", m.timing_scrolls);
+    table("fakes", m.timing_fakes);
 }
 
-static void emit_json(std::ostream& out, const ChartMetrics& m, bool include_tech_counts) {
-    emit_chart_json(out, m, "", include_tech_counts);
-    out << "\n";
+static void emit_chart_msgpack_tech_counts(MsgPackWriter& out, const ChartMetrics& m) {
+    const std::pair<std::string_view, int> counts[] = {
+        {"crossovers", m.tech.crossovers},
+        {"footswitches", m.tech.footswitches},
+        {"sideswitches", m.tech.sideswitches},
+        {"jacks", m.tech.jacks},
+        {"brackets", m.tech.brackets},
+        {"doublesteps", m.tech.doublesteps},
+    };
+    out.map_header(static_cast<uint32_t>(std::size(counts)));
+    for (const auto& [name, count] : counts) {
+        out.string(name);
+        out.integer(count);
+    }
 }
 
-static void emit_json_array(
-    std::ostream& out,
-    const std::vector<ChartMetrics>& charts,
-    bool include_tech_counts) {
-    out << "[\n";
-    for (size_t i = 0; i < charts.size(); ++i) {
-        emit_chart_json(out, charts[i], "  ", include_tech_counts);
-        if (i + 1 < charts.size()) out << ",";
-        out << "\n";
+// MessagePack form of emit_chart_json (--format msgpack): one map per chart
+// with the same keys. Doubles are always float64 and counts always integers;
+// the per-measure arrays and timing tables are typed arrays (ext values).
+static void emit_chart_msgpack(
+    MsgPackWriter& out,
+    const ChartMetrics& m,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    bool null_numbers = false) {
+    out.map_header(static_cast<uint32_t>(fields.count()));
+    for (size_t i = 0; i < kChartFieldCount; ++i) {
+        const ChartField field = static_cast<ChartField>(i);
+        if (!has_field(fields, field)) continue;
+        out.string(chart_field_name(field));
+        switch (field) {
+            case ChartField::Status: out.string(m.status); break;
+            case ChartField::Simfile: out.string(m.simfile); break;
+            case ChartField::Title: out.string(m.title); break;
+            case ChartField::Subtitle: out.string(m.subtitle); break;
+            case ChartField::Artist: out.string(m.artist); break;
+            case ChartField::TitleTranslated: out.string(m.title_translated); break;
+            case ChartField::SubtitleTranslated: out.string(m.subtitle_translated); break;
+            case ChartField::ArtistTranslated: out.string(m.artist_translated); break;
+            case ChartField::StepArtist: out.string(m.step_artist); break;
+            case ChartField::Description: out.string(m.description); break;
+            case ChartField::StepsType: out.string(m.steps_type); break;
+            case ChartField::Difficulty: out.string(m.difficulty); break;
+            case ChartField::Meter: msgpack_number(out, m.meter, null_numbers); break;
+            case ChartField::Bpms: out.string(m.bpms); break;
+            case ChartField::HashBpms: out.string(m.hash_bpms); break;
+            case ChartField::BpmMin: msgpack_number(out, m.bpm_min, null_numbers); break;
+            case ChartField::BpmMax: msgpack_number(out, m.bpm_max, null_numbers); break;
+            case ChartField::DisplayBpm: out.string(m.display_bpm); break;
+            case ChartField::DisplayBpmMin: msgpack_number(out, m.display_bpm_min, null_numbers); break;
+            case ChartField::DisplayBpmMax: msgpack_number(out, m.display_bpm_max, null_numbers); break;
+            case ChartField::Hash: out.string(m.hash); break;
+            case ChartField::DurationSeconds: msgpack_number(out, m.duration_seconds, null_numbers); break;
+            case ChartField::StreamsBreakdown: out.string(m.streams_breakdown); break;
+            case ChartField::StreamsBreakdownLevel1: out.string(m.streams_breakdown_level1); break;
+            case ChartField::StreamsBreakdownLevel2: out.string(m.streams_breakdown_level2); break;
+            case ChartField::StreamsBreakdownLevel3: out.string(m.streams_breakdown_level3); break;
+            case ChartField::TotalStreamMeasures: msgpack_number(out, m.total_stream_measures, null_numbers); break;
+            case ChartField::TotalBreakMeasures: msgpack_number(out, m.total_break_measures, null_numbers); break;
+            case ChartField::TotalSteps: msgpack_number(out, m.total_steps, null_numbers); break;
+            case ChartField::NotesPerMeasure:
+                msgpack_measure_array(out, m.notes_per_measure, measures);
+                break;
+            case ChartField::NpsPerMeasure:
+                msgpack_measure_array(out, m.nps_per_measure, measures);
+                break;
+            case ChartField::EquallySpacedPerMeasure:
+                msgpack_measure_flags(out, m.equally_spaced_per_measure, measures);
+                break;
+            case ChartField::PeakNps: msgpack_number(out, m.peak_nps, null_numbers); break;
+            case ChartField::StreamSequences:
+                msgpack_array(out, m.stream_sequences, [](MsgPackWriter& out, const StreamSequenceOut& seq) {
+                    out.map_header(3);
+                    out.string("stream_start");
+                    out.integer(seq.stream_start);
+                    out.string("stream_end");
+                    out.integer(seq.stream_end);
+                    out.string("is_break");
+                    out.boolean(seq.is_break);
+                });
+                break;
+            case ChartField::Holds: msgpack_number(out, m.holds, null_numbers); break;
+            case ChartField::Mines: msgpack_number(out, m.mines, null_numbers); break;
+            case ChartField::Rolls: msgpack_number(out, m.rolls, null_numbers); break;
+            case ChartField::TapsAndHolds: msgpack_number(out, m.taps_and_holds, null_numbers); break;
+            case ChartField::Notes: msgpack_number(out, m.notes, null_numbers); break;
+            case ChartField::Lifts: msgpack_number(out, m.lifts, null_numbers); break;
+            case ChartField::Fakes: msgpack_number(out, m.fakes, null_numbers); break;
+            case ChartField::Jumps: msgpack_number(out, m.jumps, null_numbers); break;
+            case ChartField::Hands: msgpack_number(out, m.hands, null_numbers); break;
+            case ChartField::Quads: msgpack_number(out, m.quads, null_numbers); break;
+            case ChartField::Timing: emit_chart_msgpack_timing(out, m, null_numbers); break;
+            case ChartField::TechCounts: emit_chart_msgpack_tech_counts(out, m); break;
+            case ChartField::Count: break;
+        }
+    }
+}
+
+enum class OutputFormat {
+    Json,
+    Ndjson,
+    MsgPack,
+};
+
+// The per-chart record of the streaming formats: an NDJSON line or a
+// MessagePack map.
+static std::string chart_record(
+    OutputFormat format,
+    const ChartMetrics& m,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    bool null_numbers = false) {
+    if (format == OutputFormat::MsgPack) {
+        MsgPackWriter writer;
+        emit_chart_msgpack(writer, m, fields, measures, null_numbers);
+        return writer.take();
     }
-    out << "]\n";
+    JsonWriter writer;
+    append_ndjson_line(writer, m, fields, measures, null_numbers);
+    return writer.take();
+}
+
+// One chart as an element of the indented JSON array.
+static std::string json_array_element(const ChartMetrics& m, const ChartFieldSet& fields, MeasureEncoding measures) {
+    JsonWriter writer;
+    emit_chart_json(writer, m, "  ", fields, measures);
+    return writer.take();
+}
+
+// Writes a JSON array one element at a time, so charts can be printed as soon
+// as they are serialized.
+class JsonArrayStream {
+public:
+    explicit JsonArrayStream(std::ostream& out) : out_(out) {
+        writer_.raw("[\n");
+    }
+
+    // element comes from json_array_element.
+    void add(std::string_view element) {
+        if (!empty_) writer_.raw(",\n");
+        writer_.raw(element);
+        empty_ = false;
+    }
+
+    // Hands everything added so far to the stream.
+    void flush() {
+        writer_.flush_to(out_);
+        out_.flush();
+    }
+
+    void finish() {
+        if (!empty_) writer_.raw("\n");
+        writer_.raw("]\n");
+        flush();
+    }
+
+private:
+    std::ostream& out_;
+    JsonWriter writer_;
+    bool empty_ = true;
+};
+
+static void emit_hash_line(std::ostream& out, const ChartMetrics& m, bool with_simfile) {
+    // No extra logic: print the parsed values directly.
+    // Hash is already produced by ITGmania/Lua and should already be 16 chars in your setup.
+    out
+        << std::left  << std::setw(20) << m.steps_type
+        << std::right << std::setw(6)  << m.meter << "  "
+        << std::left  << std::setw(18) << m.difficulty << "  "
+        << m.hash;
+    if (with_simfile) {
+        out << "  " << m.simfile;
+    }
+    out << "\n";
 }
 
 struct CliOpts {
@@ -424,9 +727,28 @@ struct CliOpts {
     bool help = false;
     bool version = false;
     bool omit_tech = false;
+    OutputFormat format = OutputFormat::Json;
+    std::optional<ChartFieldSet> fields;
+    std::string columns_dir;
+    std::string sqlite_path;
+    std::string baseline_path;
+    std::optional<int> zstd_level;
+    bool shared_timing = false;
+    bool compact_measures = false;
+    bool no_cache = false;
+    bool refresh_cache = false;
+    std::string cache_dir;
+    uint64_t cache_max_bytes = ResultCache::kDefaultMaxBytes;
     bool dump_rows = false;
     bool dump_notes = false;
     bool dump_path = false;
+    std::string scan_dir;
+    std::string watch_dir;
+    std::string compile_dir;
+    std::string compiled_dir;
+    int jobs = 1;
+    std::string sl_scripts_dir;
+    SLEngine sl_engine = SLEngine::Lua;
     std::vector<std::string> positional;
 };
 
@@ -447,6 +769,133 @@ static CliOpts parse_args(int argc, char** argv) {
             o.omit_tech = true;
             continue;
         }
+        if (a == "--no-cache") {
+            o.no_cache = true;
+            continue;
+        }
+        if (a == "--refresh") {
+            o.refresh_cache = true;
+            continue;
+        }
+        if (a == "--cache-dir") {
+            if (i + 1 >= argc) {
+                std::cerr << "--cache-dir requires a directory\n";
+                o.help = true;
+                return o;
+            }
+            o.cache_dir = argv[++i];
+            continue;
+        }
+        if (a == "--cache-size") {
+            const std::string value = i + 1 < argc ? argv[++i] : "";
+            char* end = nullptr;
+            const long long mib = std::strtoll(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || mib < 0) {
+                std::cerr << "--cache-size requires a size in MiB\n";
+                o.help = true;
+                return o;
+            }
+            o.cache_max_bytes = static_cast<uint64_t>(mib) << 20;
+            continue;
+        }
+        if (a == "--compact-measures") {
+            o.compact_measures = true;
+            continue;
+        }
+        if (a == "--shared-timing") {
+            o.shared_timing = true;
+            continue;
+        }
+        if (a == "--ndjson") {
+            o.format = OutputFormat::Ndjson;
+            continue;
+        }
+        if (a == "--format" || a.compare(0, 9, "--format=") == 0) {
+            std::string value;
+            if (a.size() > 8) {
+                value = a.substr(9);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            }
+            if (value == "json") {
+                o.format = OutputFormat::Json;
+            } else if (value == "ndjson") {
+                o.format = OutputFormat::Ndjson;
+            } else if (value == "msgpack") {
+                o.format = OutputFormat::MsgPack;
+            } else {
+                std::cerr << "--format must be one of json, ndjson, msgpack\n";
+                o.help = true;
+                return o;
+            }
+            continue;
+        }
+        if (a == "--fields" || a.compare(0, 9, "--fields=") == 0) {
+            std::string value;
+            if (a.size() > 8) {
+                value = a.substr(9);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            }
+            std::string bad_name;
+            o.fields = parse_chart_field_list(value, &bad_name);
+            if (!o.fields) {
+                std::cerr << "--fields: unknown field '" << bad_name << "'\n";
+                o.help = true;
+                return o;
+            }
+            continue;
+        }
+        if (a == "--columns") {
+            if (i + 1 >= argc) {
+                std::cerr << "--columns requires a directory\n";
+                o.help = true;
+                return o;
+            }
+            o.columns_dir = argv[++i];
+            continue;
+        }
+        if (a == "--sqlite") {
+            if (i + 1 >= argc) {
+                std::cerr << "--sqlite requires a database path\n";
+                o.help = true;
+                return o;
+            }
+            o.sqlite_path = argv[++i];
+            continue;
+        }
+        if (a == "--baseline") {
+            if (i + 1 >= argc) {
+                std::cerr << "--baseline requires a file\n";
+                o.help = true;
+                return o;
+            }
+            o.baseline_path = argv[++i];
+            continue;
+        }
+        if (a == "--compress" || a.compare(0, 11, "--compress=") == 0) {
+            std::string value;
+            if (a.size() > 10) {
+                value = a.substr(11);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            }
+            int level = ZstdOutputBuffer::kDefaultLevel;
+            bool valid = value.compare(0, 4, "zstd") == 0;
+            if (valid && value.size() > 4) {
+                const std::string digits = value.substr(5);
+                char* end = nullptr;
+                level = static_cast<int>(std::strtol(digits.c_str(), &end, 10));
+                valid = value[4] == ':' && !digits.empty() && *end == '\0';
+            }
+            if (!valid) {
+                std::cerr << "--compress must be zstd or zstd:<level>\n";
+                o.help = true;
+                return o;
+            }
+            o.zstd_level = level;
+            continue;
+        }
         if (a == "--dump-rows") {
             o.dump_rows = true;
             continue;
@@ -459,6 +908,79 @@ static CliOpts parse_args(int argc, char** argv) {
             o.dump_path = true;
             continue;
         }
+        if (a == "--scan") {
+            if (i + 1 >= argc) {
+                std::cerr << "--scan requires a directory\n";
+                o.help = true;
+                return o;
+            }
+            o.scan_dir = argv[++i];
+            continue;
+        }
+        if (a == "--watch") {
+            if (i + 1 >= argc) {
+                std::cerr << "--watch requires a directory\n";
+                o.help = true;
+                return o;
+            }
+            o.watch_dir = argv[++i];
+            continue;
+        }
+        if (a == "-j" || a == "--jobs" || (a.size() > 2 && a.compare(0, 2, "-j") == 0)) {
+            std::string value;
+            if (a.size() > 2 && a[1] == 'j') {
+                value = a.substr(2);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            }
+            char* end = nullptr;
+            const long jobs = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || jobs < 0) {
+                std::cerr << "-j/--jobs requires a non-negative worker count\n";
+                o.help = true;
+                return o;
+            }
+            o.jobs = static_cast<int>(jobs);
+            continue;
+        }
+        if (a == "--compile" || a == "--compiled") {
+            if (i + 1 >= argc) {
+                std::cerr << a << " requires a directory\n";
+                o.help = true;
+                return o;
+            }
+            (a == "--compile" ? o.compile_dir : o.compiled_dir) = argv[++i];
+            continue;
+        }
+        if (a == "--sl-scripts") {
+            if (i + 1 >= argc) {
+                std::cerr << "--sl-scripts requires a directory\n";
+                o.help = true;
+                return o;
+            }
+            o.sl_scripts_dir = argv[++i];
+            continue;
+        }
+        if (a == "--sl-engine" || a.compare(0, 12, "--sl-engine=") == 0) {
+            std::string value;
+            if (a.size() > 11) {
+                value = a.substr(12);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            }
+            if (value == "lua") {
+                o.sl_engine = SLEngine::Lua;
+            } else if (value == "native") {
+                o.sl_engine = SLEngine::Native;
+            } else if (value == "verify") {
+                o.sl_engine = SLEngine::Verify;
+            } else {
+                std::cerr << "--sl-engine must be one of lua, native, verify\n";
+                o.help = true;
+                return o;
+            }
+            continue;
+        }
         if (a == "--help") {
             o.help = true;
             continue;
@@ -478,55 +1000,606 @@ static CliOpts parse_args(int argc, char** argv) {
     return o;
 }
 
-static int run_hash_mode(const std::string& simfile) {
+// Single-file modes only need a pool when -j asks for more than one worker.
+static std::unique_ptr<WorkStealingPool> make_chart_pool(int jobs) {
+    const size_t workers = WorkStealingPool::resolve_worker_count(jobs);
+    if (workers <= 1) return nullptr;
+    return std::make_unique<WorkStealingPool>(workers);
+}
+
+static int run_hash_mode(const std::string& simfile, int jobs, ResultCache* cache) {
     init_itgmania_runtime(0, nullptr);
 
-    auto charts = parse_all_charts_with_itgmania(simfile, "", "", "");
+    const std::unique_ptr<WorkStealingPool> pool = make_chart_pool(jobs);
+    ChartParseOptions options;
+    options.hash_only = true;
+    options.cache = cache;
+    auto charts = parse_all_charts_with_itgmania(simfile, "", "", "", pool.get(), options);
     if (charts.empty()) {
         std::cerr << "No charts parsed for: " << simfile << "\n";
         return 2;
     }
 
     for (const auto& m : charts) {
-        // No extra logic: print the parsed values directly.
-        // Hash is already produced by ITGmania/Lua and should already be 16 chars in your setup.
-        std::cout
-            << std::left  << std::setw(20) << m.steps_type
-            << std::right << std::setw(6)  << m.meter << "  "
-            << std::left  << std::setw(18) << m.difficulty << "  "
-            << m.hash
-            << "\n";
+        emit_hash_line(std::cout, m, false);
     }
 
     return 0;
 }
 
-int main(int argc, char** argv) {
-    const CliOpts opts = parse_args(argc, argv);
+// Writes one streaming record and flushes it, so consumers see each chart as
+// soon as it is analyzed.
+static void write_chart_record(
+    OutputFormat format,
+    const ChartMetrics& m,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    bool null_numbers = false) {
+    const std::string record = chart_record(format, m, fields, measures, null_numbers);
+    std::cout.write(record.data(), static_cast<std::streamsize>(record.size()));
+    std::cout.flush();
+}
 
-    if (opts.version) {
-        std::cout << kVersion << "\n";
+// Destinations that take the charts instead of stdout (--columns, --sqlite).
+struct ChartStores {
+    ColumnarExport* columns = nullptr;
+    SqliteSink* sqlite = nullptr;
+
+    bool any() const { return columns || sqlite; }
+    // See SqliteSink::begin_simfile.
+    void begin_simfile(const std::string& simfile, bool complete) const {
+        if (sqlite) sqlite->begin_simfile(simfile, complete);
+    }
+    void add(const ChartMetrics& m) const {
+        if (columns) columns->add(m);
+        if (sqlite) sqlite->add(m);
+    }
+    void end_simfile() const {
+        if (sqlite) sqlite->end_simfile();
+    }
+};
+
+// A --baseline delta as an element of the JSON array or an NDJSON line.
+static std::string delta_record(OutputFormat format, const std::string& delta) {
+    return format == OutputFormat::Json ? "  " + delta : delta + "\n";
+}
+
+// What one chart becomes on stdout in batch mode with a baseline: its delta,
+// or an empty record when it is unchanged.
+static std::string baseline_record(
+    OutputFormat format,
+    const ChartMetrics& m,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    BaselineDiff& baseline,
+    size_t ordinal) {
+    JsonWriter writer;
+    emit_chart_json(writer, m, "", fields, measures, JsonLayout{true});
+    const std::string delta = baseline.compare(writer.str(), ordinal);
+    return delta.empty() ? delta : delta_record(format, delta);
+}
+
+// What one chart becomes on stdout in batch mode. Built on the worker that
+// analyzed the chart, so formatting runs in parallel like the analysis.
+static std::string scan_record(
+    bool hash_mode,
+    OutputFormat format,
+    const ChartMetrics& m,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures) {
+    if (hash_mode) {
+        std::ostringstream line;
+        emit_hash_line(line, m, true);
+        return line.str();
+    }
+    if (format == OutputFormat::Json) {
+        return json_array_element(m, fields, measures);
+    }
+    return chart_record(format, m, fields, measures);
+}
+
+// Largest files first, so a marathon pack starts early instead of being the
+// last task standing; ties keep input order.
+static std::vector<size_t> order_by_file_size_desc(const std::vector<std::string>& simfiles) {
+    std::vector<uintmax_t> sizes(simfiles.size(), 0);
+    for (size_t i = 0; i < simfiles.size(); ++i) {
+        std::error_code ec;
+        const uintmax_t size = std::filesystem::file_size(simfiles[i], ec);
+        sizes[i] = ec ? 0 : size;
+    }
+    std::vector<size_t> order(simfiles.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+    return order;
+}
+
+// Stores take the charts themselves, in input order on one thread at a time.
+// With workers, charts go through an OrderedOutput like stdout records do, so
+// charts that finish ahead of a slow earlier simfile are held as encoded
+// bytes within its memory bound and spilled beyond it. Each simfile's group
+// is framed by a begin record (its path) and an end record.
+static void scan_into_stores(
+    const std::vector<std::string>& simfiles,
+    const ChartParseOptions& options,
+    size_t workers,
+    const ChartStores& stores) {
+    if (workers <= 1) {
+        for (const std::string& simfile : simfiles) {
+            stores.begin_simfile(simfile, true);
+            for_each_chart_with_itgmania(
+                simfile, "", "", "", [&](ChartMetrics&& m) { stores.add(m); }, nullptr, options);
+            stores.end_simfile();
+        }
+        return;
+    }
+
+    constexpr char kBeginSimfile = 'b';
+    constexpr char kChart = 'c';
+    constexpr char kEndSimfile = 'e';
+    OrderedOutput output(
+        simfiles.size(),
+        [&](std::string_view record) {
+            const std::string_view body = record.substr(1);
+            if (record.front() == kBeginSimfile) {
+                stores.begin_simfile(std::string(body), true);
+            } else if (record.front() == kEndSimfile) {
+                stores.end_simfile();
+            } else {
+                ChartMetrics m;
+                if (decode_chart(body, m)) stores.add(m);
+            }
+        },
+        []() {});
+    WorkStealingPool pool(workers);
+    for (size_t index : order_by_file_size_desc(simfiles)) {
+        pool.submit([&, index]() {
+            output.put(index, 0, std::string(1, kBeginSimfile) + simfiles[index]);
+            const size_t charts = for_each_chart_unordered_with_itgmania(
+                simfiles[index], "", "", "",
+                [&](size_t item, ChartMetrics&& m) { output.put(index, item + 1, std::string(1, kChart) + encode_chart(m)); },
+                &pool, options);
+            output.put(index, charts + 1, std::string(1, kEndSimfile));
+            output.close_group(index, charts + 2);
+        });
+    }
+    output.wait();
+}
+
+// Batch mode: one long-lived process walks the whole tree, so the ITGmania
+// runtime is initialized once and results stream out chart by chart. With
+// more than one job, simfiles and their charts are analyzed and serialized
+// on a work-stealing pool, and an OrderedOutput writes the records in input
+// order as soon as every earlier chart is out. With stores, charts go to them
+// in the same order and nothing is written to stdout. With a baseline, only
+// the deltas are written, followed by the baseline charts that were not seen.
+static int run_scan_mode(
+    const std::string& root,
+    bool hash_mode,
+    OutputFormat format,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    bool shared_timing,
+    BaselineDiff* baseline,
+    ResultCache* cache,
+    int jobs,
+    const ChartStores& stores) {
+    const std::vector<std::string> simfiles = find_simfiles(root);
+    if (simfiles.empty()) {
+        std::cerr << "No simfiles found under: " << root << "\n";
+        return 2;
+    }
+
+    init_itgmania_runtime(0, nullptr);
+
+    ChartParseOptions options;
+    options.hash_only = hash_mode;
+    options.fields = fields;
+    options.share_timing = shared_timing;
+    options.cache = cache;
+    const size_t workers = WorkStealingPool::resolve_worker_count(jobs);
+
+    if (stores.any()) {
+        scan_into_stores(simfiles, options, workers, stores);
         return 0;
     }
 
-    if (opts.help || opts.positional.empty()) {
-        print_usage();
-        return opts.help ? 0 : 1;
+    std::optional<JsonArrayStream> array;
+    if (!hash_mode && format == OutputFormat::Json) {
+        array.emplace(std::cout);
+    }
+    OrderedOutput output(
+        simfiles.size(),
+        [&](std::string_view record) {
+            if (record.empty()) return;
+            if (array) {
+                array->add(record);
+            } else {
+                std::cout.write(record.data(), static_cast<std::streamsize>(record.size()));
+            }
+        },
+        [&]() {
+            if (array) {
+                array->flush();
+            } else {
+                std::cout.flush();
+            }
+        });
+    auto scan_simfile = [&](size_t index, WorkStealingPool* pool) {
+        size_t charts = 0;
+        if (baseline) {
+            // Charts of a simfile that share a key are paired with the
+            // baseline's by their order, so they are compared in song order.
+            std::map<std::string, size_t> ordinals;
+            size_t item = 0;
+            charts = for_each_chart_with_itgmania(
+                simfiles[index], "", "", "",
+                [&](ChartMetrics&& m) {
+                    const size_t ordinal = ordinals[m.steps_type + '\n' + m.difficulty + '\n' + m.description]++;
+                    output.put(index, item++, baseline_record(format, m, fields, measures, *baseline, ordinal));
+                },
+                pool, options);
+        } else {
+            charts = for_each_chart_unordered_with_itgmania(
+                simfiles[index], "", "", "",
+                [&](size_t item, ChartMetrics&& m) { output.put(index, item, scan_record(hash_mode, format, m, fields, measures)); },
+                pool, options);
+        }
+        output.close_group(index, charts);
+    };
+
+    if (workers <= 1) {
+        for (size_t index = 0; index < simfiles.size(); ++index) {
+            scan_simfile(index, nullptr);
+        }
+    } else {
+        WorkStealingPool pool(workers);
+        for (size_t index : order_by_file_size_desc(simfiles)) {
+            pool.submit([&, index]() { scan_simfile(index, &pool); });
+        }
+        output.wait();
+    }
+
+    if (baseline) {
+        for (const std::string& delta : baseline->removed()) {
+            const std::string record = delta_record(format, delta);
+            if (array) {
+                array->add(record);
+            } else {
+                std::cout.write(record.data(), static_cast<std::streamsize>(record.size()));
+            }
+        }
+        std::cout.flush();
+    }
+    if (array) {
+        array->finish();
+    }
+    return 0;
+}
+
+// Compile mode: writes the compiled form of each simfile under out_dir, so
+// later runs with --compiled skip parsing the text. Prints nothing on stdout;
+// failures and a summary go to stderr.
+static int run_compile_mode(const std::vector<std::string>& simfiles, const std::string& out_dir, int jobs) {
+    init_itgmania_runtime(0, nullptr);
+
+    std::atomic<size_t> failed{0};
+    std::mutex error_mutex;
+    auto compile = [&](const std::string& simfile) {
+        std::string error;
+        if (compile_simfile_with_itgmania(simfile, out_dir, &error)) return;
+        ++failed;
+        std::lock_guard<std::mutex> lock(error_mutex);
+        std::cerr << "--compile: " << error << "\n";
+    };
+
+    const size_t workers = WorkStealingPool::resolve_worker_count(jobs);
+    if (workers <= 1) {
+        for (const std::string& simfile : simfiles) compile(simfile);
+    } else {
+        WorkStealingPool pool(workers);
+        for (size_t index : order_by_file_size_desc(simfiles)) {
+            pool.submit([&, index]() { compile(simfiles[index]); });
+        }
+        pool.wait_idle();
+    }
+    std::cerr << "compiled " << (simfiles.size() - failed) << " of " << simfiles.size() << " simfiles into "
+              << out_dir << "\n";
+    return failed == 0 ? 0 : 1;
+}
+
+// How long a watched tree has to be quiet before changes are analyzed; long
+// enough to cover an editor's save, short enough to feel immediate.
+static constexpr std::chrono::milliseconds kWatchQuiet{150};
+
+// Watch mode: analyzes every simfile under root once, then waits for changes
+// and re-analyzes the simfiles of the folders that changed. A simfile whose
+// bytes are the same as last time is skipped. Events are NDJSON lines,
+// flushed one at a time:
+//   {"event":"charts","simfile":...,"charts":[...]}  every chart of a new or changed simfile
+//   {"event":"removed","simfile":...}                a simfile that is gone (or no longer its folder's pick)
+//   {"event":"ready","simfiles":N}                   once the initial pass is done
+// Runs until watching fails (status 1) or SIGINT/SIGTERM, which ends it
+// cleanly after the simfile being analyzed (status 0). The result cache is
+// trimmed after every batch of changes, as a run would on exit.
+static int run_watch_mode(
+    const std::string& root,
+    const ChartFieldSet& fields,
+    MeasureEncoding measures,
+    bool shared_timing,
+    ResultCache* cache,
+    int jobs) {
+    namespace fs = std::filesystem;
+
+    // Watching starts first, so nothing saved during the initial pass is missed.
+    SimfileWatcher watcher(root);
+    std::string error;
+    if (!watcher.start(&error) || !SimfileWatcher::stop_on_signals(&error)) {
+        std::cerr << "--watch: " << error << "\n";
+        return 1;
+    }
+
+    init_itgmania_runtime(0, nullptr);
+
+    ChartParseOptions options;
+    options.fields = fields;
+    options.share_timing = shared_timing;
+    options.cache = cache;
+    const std::unique_ptr<WorkStealingPool> pool = make_chart_pool(jobs);
+
+    auto write_event = [](JsonWriter& event) {
+        event.raw('\n');
+        event.flush_to(std::cout);
+        std::cout.flush();
+    };
+
+    // Simfile -> content key of the bytes last analyzed.
+    std::map<std::string, std::string> known;
+    auto analyze = [&](const std::string& simfile) {
+        // The scope also hands these exact bytes to the parser.
+        const SimfileBufferScope bytes(simfile);
+        if (!bytes.bytes()) return;
+        std::string key = content_key({*bytes.bytes()});
+        auto it = known.find(simfile);
+        if (it != known.end() && it->second == key) return;
+        known[simfile] = std::move(key);
+
+        const std::vector<ChartMetrics> charts =
+            parse_all_charts_with_itgmania(simfile, "", "", "", pool.get(), options);
+        JsonWriter event;
+        event.raw("{\"event\":\"charts\",\"simfile\":");
+        event.string(simfile);
+        event.raw(",\"charts\":[");
+        for (size_t i = 0; i < charts.size(); ++i) {
+            if (i) event.raw(',');
+            emit_chart_json(event, charts[i], "", fields, measures, JsonLayout{true});
+        }
+        event.raw("]}");
+        write_event(event);
+    };
+    // Brings every simfile under folder up to date.
+    auto rescan = [&](const std::string& folder) {
+        std::error_code ec;
+        const std::vector<std::string> current =
+            fs::is_directory(folder, ec) ? find_simfiles(folder) : std::vector<std::string>();
+        const std::string prefix = (fs::path(folder) / "").string();
+        for (auto it = known.lower_bound(prefix); it != known.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+            if (std::binary_search(current.begin(), current.end(), it->first)) {
+                ++it;
+                continue;
+            }
+            JsonWriter event;
+            event.raw("{\"event\":\"removed\",\"simfile\":");
+            event.string(it->first);
+            event.raw('}');
+            write_event(event);
+            it = known.erase(it);
+        }
+        for (const std::string& simfile : current) {
+            if (SimfileWatcher::interrupted()) return;
+            analyze(simfile);
+        }
+    };
+
+    rescan(root);
+    if (SimfileWatcher::interrupted()) return 0;
+    if (cache) cache->trim();
+    JsonWriter ready;
+    ready.raw("{\"event\":\"ready\",\"simfiles\":");
+    ready.number(static_cast<int>(known.size()));
+    ready.raw('}');
+    write_event(ready);
+
+    std::vector<std::string> folders;
+    while (watcher.wait(kWatchQuiet, folders, &error)) {
+        for (const std::string& folder : folders) rescan(folder);
+        if (cache) cache->trim();
+    }
+    if (SimfileWatcher::interrupted()) return 0;
+    std::cerr << "--watch: " << error << "\n";
+    return 1;
+}
+
+// --sl-engine=verify turns any Lua/native disagreement into a failing run so
+// it can gate a corpus check.
+static int with_sl_engine_status(int code) {
+    return code == 0 && sl_engine_mismatch_count() > 0 ? 3 : code;
+}
+
+static int run(const CliOpts& opts, int argc, char** argv) {
+    if (!opts.sl_scripts_dir.empty()) {
+        set_sl_scripts_dir(opts.sl_scripts_dir);
+    }
+    set_sl_engine(opts.sl_engine);
+    if (!opts.compiled_dir.empty()) {
+        set_compiled_simfile_dir(opts.compiled_dir);
+    }
+
+    ChartFieldSet fields = opts.fields.value_or(all_chart_fields());
+    if (opts.omit_tech) {
+        set_field(fields, ChartField::TechCounts, false);
+    }
+
+    if ((!opts.columns_dir.empty() || !opts.sqlite_path.empty()) &&
+        (opts.hash_mode || opts.format != OutputFormat::Json)) {
+        std::cerr << "--columns/--sqlite are not available with --hash/--ndjson/--format\n";
+        return 1;
+    }
+    if ((!opts.columns_dir.empty() || !opts.sqlite_path.empty()) && (opts.shared_timing || opts.compact_measures)) {
+        std::cerr << "--shared-timing/--compact-measures are not available with --columns/--sqlite\n";
+        return 1;
+    }
+    const MeasureEncoding measures = opts.compact_measures ? MeasureEncoding::Compact : MeasureEncoding::Full;
+    std::optional<BaselineDiff> baseline;
+    if (!opts.baseline_path.empty()) {
+        if (opts.scan_dir.empty()) {
+            std::cerr << "--baseline is only available with --scan\n";
+            return 1;
+        }
+        if (opts.hash_mode || opts.format == OutputFormat::MsgPack || opts.shared_timing ||
+            !opts.columns_dir.empty() || !opts.sqlite_path.empty()) {
+            std::cerr << "--baseline is not available with --hash/--format msgpack/--shared-timing/--columns/--sqlite\n";
+            return 1;
+        }
+        baseline.emplace();
+        std::string error;
+        if (!baseline->load(opts.baseline_path, &error)) {
+            std::cerr << "--baseline: " << error << "\n";
+            return 1;
+        }
+        // Charts are matched on these keys, so they are always printed.
+        set_field(fields, ChartField::Simfile);
+        set_field(fields, ChartField::StepsType);
+        set_field(fields, ChartField::Difficulty);
+        set_field(fields, ChartField::Description);
+    }
+    // Unchanged simfiles are read back from the result cache. Without an
+    // explicit --cache-dir, a missing or unusable default directory just
+    // means an uncached run.
+    std::optional<ResultCache> cache;
+    if (!opts.no_cache) {
+        const std::string cache_dir = opts.cache_dir.empty() ? ResultCache::default_dir() : opts.cache_dir;
+        if (!cache_dir.empty()) {
+            // The build id changes with any source change, so a rebuild
+            // that forgot to bump kVersion still misses old entries.
+            cache.emplace(cache_dir, "itgmania-reference-harness " + std::string(kVersion) + " " + HARNESS_BUILD_ID,
+                          opts.cache_max_bytes);
+            std::string error;
+            if (!cache->open(&error)) {
+                if (!opts.cache_dir.empty()) {
+                    std::cerr << "--cache-dir: " << error << "\n";
+                    return 1;
+                }
+                cache.reset();
+            } else {
+                cache->set_refresh(opts.refresh_cache);
+            }
+        }
+    }
+    ResultCache* const result_cache = cache ? &*cache : nullptr;
+
+    std::optional<ColumnarExport> columns;
+    std::optional<SqliteSink> sqlite;
+    ChartStores stores;
+    std::string store_error;
+    if (!opts.columns_dir.empty()) {
+        columns.emplace(opts.columns_dir, fields);
+        if (!columns->open(&store_error)) {
+            std::cerr << "--columns: " << store_error << "\n";
+            return 1;
+        }
+        stores.columns = &*columns;
+    }
+    if (!opts.sqlite_path.empty()) {
+        sqlite.emplace(opts.sqlite_path, fields, kVersion);
+        if (!sqlite->open(&store_error)) {
+            std::cerr << "--sqlite: " << store_error << "\n";
+            return 1;
+        }
+        stores.sqlite = &*sqlite;
+    }
+    // Writes schema.json / commits the last batch once every chart is in; a
+    // failure there fails the run.
+    auto finish_stores = [&](int code) {
+        if (columns && !columns->finish(kVersion, &store_error)) {
+            std::cerr << "--columns: " << store_error << "\n";
+            code = code == 0 ? 1 : code;
+        }
+        if (sqlite && !sqlite->finish(&store_error)) {
+            std::cerr << "--sqlite: " << store_error << "\n";
+            code = code == 0 ? 1 : code;
+        }
+        return code;
+    };
+
+    if (!opts.compile_dir.empty()) {
+        if (opts.positional.size() > 1 || !opts.watch_dir.empty()) {
+            std::cerr << "--compile takes --scan or a simfile, without a chart selector\n";
+            return 1;
+        }
+        if (opts.hash_mode || opts.format != OutputFormat::Json || stores.any() || baseline ||
+            opts.dump_rows || opts.dump_notes || opts.dump_path) {
+            std::cerr << "--compile does not print charts and takes no output options\n";
+            return 1;
+        }
+        if (opts.scan_dir.empty()) {
+            return run_compile_mode({opts.positional[0]}, opts.compile_dir, opts.jobs);
+        }
+        const std::vector<std::string> simfiles = find_simfiles(opts.scan_dir);
+        if (simfiles.empty()) {
+            std::cerr << "No simfiles found under: " << opts.scan_dir << "\n";
+            return 2;
+        }
+        return run_compile_mode(simfiles, opts.compile_dir, opts.jobs);
+    }
+
+    if (!opts.watch_dir.empty()) {
+        if (!opts.positional.empty() || !opts.scan_dir.empty()) {
+            std::cerr << "--watch does not take --scan, a simfile or a chart selector\n";
+            return 1;
+        }
+        if (opts.hash_mode || opts.format == OutputFormat::MsgPack || stores.any() || opts.dump_rows ||
+            opts.dump_notes || opts.dump_path) {
+            std::cerr << "--watch is not available with --hash/--format msgpack/--columns/--sqlite/--dump-*\n";
+            return 1;
+        }
+        return run_watch_mode(opts.watch_dir, fields, measures, opts.shared_timing, result_cache, opts.jobs);
+    }
+
+    if (!opts.scan_dir.empty()) {
+        if (!opts.positional.empty()) {
+            std::cerr << "--scan does not take a simfile or chart selector\n";
+            return 1;
+        }
+        if (opts.dump_rows || opts.dump_notes || opts.dump_path) {
+            std::cerr << "--dump-rows/--dump-notes/--dump-path are not available with --scan\n";
+            return 1;
+        }
+        if (opts.hash_mode && opts.format != OutputFormat::Json) {
+            std::cerr << "--ndjson/--format are not available with --hash\n";
+            return 1;
+        }
+        const int code =
+            run_scan_mode(opts.scan_dir, opts.hash_mode, opts.format, fields, measures, opts.shared_timing,
+                          baseline ? &*baseline : nullptr, result_cache, opts.jobs, stores);
+        return with_sl_engine_status(finish_stores(code));
     }
 
     const std::string simfile = opts.positional[0];
     const std::string steps_type = (opts.positional.size() >= 2) ? opts.positional[1] : "";
     const std::string difficulty = (opts.positional.size() >= 3) ? opts.positional[2] : "";
     const std::string description = (opts.positional.size() >= 4) ? opts.positional[3] : "";
-    const bool include_tech_counts = !opts.omit_tech;
     const bool wants_dump = opts.dump_rows || opts.dump_notes || opts.dump_path;
 
     if (opts.hash_mode) {
+        if (opts.format != OutputFormat::Json) {
+            std::cerr << "--ndjson/--format are not available with --hash\n";
+            return 1;
+        }
         if (wants_dump) {
             std::cerr << "--dump-rows/--dump-notes/--dump-path are not available with --hash\n";
             return 1;
         }
-        return run_hash_mode(simfile);
+        return with_sl_engine_status(run_hash_mode(simfile, opts.jobs, result_cache));
     }
 
     init_itgmania_runtime(argc, argv);
@@ -554,29 +1627,130 @@ int main(int argc, char** argv) {
         }
     }
 
+    ChartParseOptions parse_options;
+    parse_options.fields = fields;
+    parse_options.share_timing = opts.shared_timing;
+    parse_options.cache = result_cache;
+    const std::unique_ptr<WorkStealingPool> pool = make_chart_pool(opts.jobs);
+    // The per-chart formats print one record per chart instead of a JSON array.
+    const bool per_chart = opts.format != OutputFormat::Json;
+    auto emit_charts = [&](const std::string& st, const std::string& diff) {
+        if (stores.any()) {
+            stores.begin_simfile(simfile, st.empty() && diff.empty());
+            const size_t charts = for_each_chart_with_itgmania(
+                simfile, st, diff, "", [&](ChartMetrics&& m) { stores.add(m); }, pool.get(), parse_options);
+            stores.end_simfile();
+            return charts > 0;
+        }
+        // Charts are serialized on the workers and put back in order. The
+        // JSON array is opened with the first chart, so nothing is printed
+        // when none match.
+        std::optional<JsonArrayStream> array;
+        OrderedOutput output(
+            1,
+            [&](std::string_view record) {
+                if (per_chart) {
+                    std::cout.write(record.data(), static_cast<std::streamsize>(record.size()));
+                    return;
+                }
+                if (!array) array.emplace(std::cout);
+                array->add(record);
+            },
+            [&]() {
+                if (array) {
+                    array->flush();
+                } else {
+                    std::cout.flush();
+                }
+            });
+        const size_t charts = for_each_chart_unordered_with_itgmania(
+            simfile, st, diff, "",
+            [&](size_t item, ChartMetrics&& m) {
+                output.put(0, item,
+                           per_chart ? chart_record(opts.format, m, fields, measures)
+                                     : json_array_element(m, fields, measures));
+            },
+            pool.get(), parse_options);
+        output.close_group(0, charts);
+        if (array) {
+            array->finish();
+        }
+        return charts > 0;
+    };
+
     if (steps_type.empty() && difficulty.empty()) {
-        auto charts = parse_all_charts_with_itgmania(simfile, "", "", "");
-        if (!charts.empty()) {
-            emit_json_array(std::cout, charts, include_tech_counts);
-            return 0;
+        if (emit_charts("", "")) {
+            return with_sl_engine_status(finish_stores(0));
         }
     }
 
     // Edit charts can have multiple entries. If no description is provided,
     // return all edit charts matching steps_type/difficulty (as a JSON array).
     if (!steps_type.empty() && difficulty == "edit" && description.empty()) {
-        auto charts = parse_all_charts_with_itgmania(simfile, steps_type, difficulty, "");
-        if (!charts.empty()) {
-            emit_json_array(std::cout, charts, include_tech_counts);
-            return 0;
+        if (emit_charts(steps_type, difficulty)) {
+            return with_sl_engine_status(finish_stores(0));
         }
     }
 
-    if (auto parsed = parse_chart_with_itgmania(simfile, steps_type, difficulty, description)) {
-        emit_json(std::cout, *parsed, include_tech_counts);
+    if (auto parsed = parse_chart_with_itgmania(simfile, steps_type, difficulty, description, parse_options)) {
+        if (stores.any()) {
+            stores.begin_simfile(simfile, false);
+            stores.add(*parsed);
+            stores.end_simfile();
+        } else if (per_chart) {
+            write_chart_record(opts.format, *parsed, fields, measures);
+        } else {
+            emit_json(std::cout, *parsed, fields, measures);
+        }
+    } else if (stores.any()) {
+        // Stores have no stub rows, so a chart that could not be parsed is
+        // left out rather than written with placeholder numbers.
+        std::cerr << "No chart parsed for: " << simfile << "\n";
+    } else if (per_chart) {
+        write_chart_record(opts.format, make_stub_metrics(simfile, steps_type, difficulty), fields, measures, true);
     } else {
-        emit_json_stub(std::cout, simfile, steps_type, difficulty, include_tech_counts);
+        emit_json_stub(std::cout, simfile, steps_type, difficulty, fields, measures);
     }
 
-    return 0;
+    return with_sl_engine_status(finish_stores(0));
+}
+
+int main(int argc, char** argv) {
+    const CliOpts opts = parse_args(argc, argv);
+
+    if (opts.version) {
+        std::cout << kVersion << "\n";
+        return 0;
+    }
+
+    if (opts.help || (opts.positional.empty() && opts.scan_dir.empty() && opts.watch_dir.empty())) {
+        print_usage();
+        return opts.help ? 0 : 1;
+    }
+
+    if (!opts.zstd_level) {
+        return run(opts, argc, argv);
+    }
+    if (!opts.columns_dir.empty() || !opts.sqlite_path.empty()) {
+        std::cerr << "--compress applies to stdout and is not available with --columns/--sqlite\n";
+        return 1;
+    }
+
+    // Everything the modes print to std::cout goes through the compressor.
+    ZstdOutputBuffer compressed(std::cout.rdbuf(), *opts.zstd_level);
+    std::string error;
+    if (!compressed.start(&error)) {
+        std::cerr << "--compress: " << error << "\n";
+        return 1;
+    }
+    std::streambuf* const stdout_buffer = std::cout.rdbuf(&compressed);
+    int code = run(opts, argc, argv);
+    std::cout.flush();
+    std::cout.rdbuf(stdout_buffer);
+    if (!compressed.finish(&error)) {
+        std::cerr << "--compress: " << error << "\n";
+        code = code == 0 ? 1 : code;
+    }
+    std::cout.flush();
+    return code;
 }
@@ -0,0 +1,158 @@
+#include "msgpack_writer.h"
+
+#include "text_encoding.h"
+
+#include <cstring>
+#include <ostream>
+
+void MsgPackWriter::big_endian(uint64_t value, int bytes) {
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        byte(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+void MsgPackWriter::little_endian(uint64_t value, int bytes) {
+    for (int shift = 0; shift < bytes * 8; shift += 8) {
+        byte(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+// fixmap/fixarray up to fix_limit entries, then the 16- and 32-bit forms
+// (tag16 + 1 is the 32-bit tag for both).
+void MsgPackWriter::header(uint32_t size, uint8_t fix_tag, uint8_t fix_limit, uint8_t tag16) {
+    if (size <= fix_limit) {
+        byte(static_cast<uint8_t>(fix_tag | size));
+    } else if (size <= 0xffff) {
+        byte(tag16);
+        big_endian(size, 2);
+    } else {
+        byte(static_cast<uint8_t>(tag16 + 1));
+        big_endian(size, 4);
+    }
+}
+
+void MsgPackWriter::map_header(uint32_t entries) {
+    header(entries, 0x80, 15, 0xde);
+}
+
+void MsgPackWriter::array_header(uint32_t items) {
+    header(items, 0x90, 15, 0xdc);
+}
+
+void MsgPackWriter::string(std::string_view value) {
+    const std::string_view text = as_utf8(value, scratch_);
+    const size_t size = text.size();
+    if (size <= 31) {
+        byte(static_cast<uint8_t>(0xa0 | size));
+    } else if (size <= 0xff) {
+        byte(0xd9);
+        big_endian(size, 1);
+    } else if (size <= 0xffff) {
+        byte(0xda);
+        big_endian(size, 2);
+    } else {
+        byte(0xdb);
+        big_endian(size, 4);
+    }
+    buffer_.append(text);
+}
+
+void MsgPackWriter::binary(std::string_view bytes) {
+    const size_t size = bytes.size();
+    if (size <= 0xff) {
+        byte(0xc4);
+        big_endian(size, 1);
+    } else if (size <= 0xffff) {
+        byte(0xc5);
+        big_endian(size, 2);
+    } else {
+        byte(0xc6);
+        big_endian(size, 4);
+    }
+    buffer_.append(bytes);
+}
+
+// fixext for the sizes it covers, else ext 8/16/32.
+void MsgPackWriter::ext_header(int8_t type, uint32_t size) {
+    switch (size) {
+        case 1: byte(0xd4); break;
+        case 2: byte(0xd5); break;
+        case 4: byte(0xd6); break;
+        case 8: byte(0xd7); break;
+        case 16: byte(0xd8); break;
+        default:
+            if (size <= 0xff) {
+                byte(0xc7);
+                big_endian(size, 1);
+            } else if (size <= 0xffff) {
+                byte(0xc8);
+                big_endian(size, 2);
+            } else {
+                byte(0xc9);
+                big_endian(size, 4);
+            }
+    }
+    byte(static_cast<uint8_t>(type));
+}
+
+void MsgPackWriter::int32_array(const std::vector<int>& values) {
+    ext_header(kInt32ArrayExt, static_cast<uint32_t>(values.size() * 4));
+    for (int value : values) little_endian(static_cast<uint32_t>(value), 4);
+}
+
+void MsgPackWriter::float64_array(const std::vector<double>& values) {
+    ext_header(kFloat64ArrayExt, static_cast<uint32_t>(values.size() * 8));
+    for (double value : values) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(bits));
+        little_endian(bits, 8);
+    }
+}
+
+void MsgPackWriter::integer(int64_t value) {
+    if (value >= 0) {
+        if (value <= 0x7f) {
+            byte(static_cast<uint8_t>(value));
+        } else if (value <= 0xff) {
+            byte(0xcc);
+            big_endian(static_cast<uint64_t>(value), 1);
+        } else if (value <= 0xffff) {
+            byte(0xcd);
+            big_endian(static_cast<uint64_t>(value), 2);
+        } else if (value <= 0xffffffffLL) {
+            byte(0xce);
+            big_endian(static_cast<uint64_t>(value), 4);
+        } else {
+            byte(0xcf);
+            big_endian(static_cast<uint64_t>(value), 8);
+        }
+        return;
+    }
+    if (value >= -32) {
+        byte(static_cast<uint8_t>(value));
+    } else if (value >= INT8_MIN) {
+        byte(0xd0);
+        big_endian(static_cast<uint64_t>(value), 1);
+    } else if (value >= INT16_MIN) {
+        byte(0xd1);
+        big_endian(static_cast<uint64_t>(value), 2);
+    } else if (value >= INT32_MIN) {
+        byte(0xd2);
+        big_endian(static_cast<uint64_t>(value), 4);
+    } else {
+        byte(0xd3);
+        big_endian(static_cast<uint64_t>(value), 8);
+    }
+}
+
+void MsgPackWriter::float64(double value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    byte(0xcb);
+    big_endian(bits, 8);
+}
+
+void MsgPackWriter::flush_to(std::ostream& out) {
+    out.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    buffer_.clear();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Append-only MessagePack encoder. Integers use the smallest encoding that
+// holds them; doubles are always float64 so numeric arrays have one element
+// type. Strings are written as UTF-8 (see text_encoding.h for legacy bytes).
+class MsgPackWriter {
+public:
+    // Ext types of the typed arrays: the elements back to back, little-endian
+    // (like --columns), so a reader can use the payload in place.
+    static constexpr int8_t kInt32ArrayExt = 1;
+    static constexpr int8_t kFloat64ArrayExt = 2;
+
+    void map_header(uint32_t entries);
+    void array_header(uint32_t items);
+    void string(std::string_view value);
+    // Raw bytes as a bin value.
+    void binary(std::string_view bytes);
+    // Typed arrays as ext values (kInt32ArrayExt, kFloat64ArrayExt).
+    void int32_array(const std::vector<int>& values);
+    void float64_array(const std::vector<double>& values);
+    void integer(int64_t value);
+    void float64(double value);
+    void boolean(bool value) { byte(value ? 0xc3 : 0xc2); }
+    void nil() { byte(0xc0); }
+
+    const std::string& str() const { return buffer_; }
+    size_t size() const { return buffer_.size(); }
+    bool empty() const { return buffer_.empty(); }
+    void clear() { buffer_.clear(); }
+    // Moves the contents out, leaving the writer empty.
+    std::string take() { return std::exchange(buffer_, std::string()); }
+
+    // Writes the buffer to out and empties it.
+    void flush_to(std::ostream& out);
+
+private:
+    void byte(uint8_t value) { buffer_.push_back(static_cast<char>(value)); }
+    void big_endian(uint64_t value, int bytes);
+    void little_endian(uint64_t value, int bytes);
+    void ext_header(int8_t type, uint32_t size);
+    void header(uint32_t size, uint8_t fix_tag, uint8_t fix_limit, uint8_t tag16);
+
+    std::string buffer_;
+    std::string scratch_;
+};
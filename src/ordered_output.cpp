@@ -0,0 +1,110 @@
+#include "ordered_output.h"
+
+#include <cstdlib>
+#include <utility>
+
+OrderedOutput::OrderedOutput(size_t groups, Writer write, std::function<void()> flush, size_t memory_limit)
+    : write_(std::move(write)), flush_(std::move(flush)), memory_limit_(memory_limit), groups_(groups) {}
+
+OrderedOutput::~OrderedOutput() {
+    if (spill_) std::fclose(spill_);
+}
+
+OrderedOutput::Pending& OrderedOutput::slot(size_t group, size_t item) {
+    std::vector<Pending>& items = groups_[group].items;
+    if (items.size() <= item) items.resize(item + 1);
+    return items[item];
+}
+
+void OrderedOutput::put(size_t group, size_t item, std::string record) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (group == head_group_ && item == head_item_) {
+        write_(record);
+        ++head_item_;
+        drain();
+        flush_();
+        lock.unlock();
+        finished_.notify_all();
+        return;
+    }
+
+    Pending& pending = slot(group, item);
+    pending.ready = true;
+    pending.size = record.size();
+    pending.record = std::move(record);
+    if (buffered_ + pending.size > memory_limit_ && spill(pending)) return;
+    buffered_ += pending.size;
+}
+
+void OrderedOutput::close_group(size_t group, size_t items) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        groups_[group].closed = true;
+        groups_[group].count = items;
+        if (group == head_group_) {
+            drain();
+            flush_();
+        }
+    }
+    finished_.notify_all();
+}
+
+void OrderedOutput::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [&]() { return head_group_ == groups_.size(); });
+}
+
+uint64_t OrderedOutput::spilled_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return spill_end_;
+}
+
+// Writes every record that is now at the head, moving past closed groups.
+void OrderedOutput::drain() {
+    while (head_group_ < groups_.size()) {
+        Group& group = groups_[head_group_];
+        if (head_item_ < group.items.size() && group.items[head_item_].ready) {
+            emit(group.items[head_item_]);
+            ++head_item_;
+            continue;
+        }
+        if (!group.closed || head_item_ < group.count) return;
+        std::vector<Pending>().swap(group.items);
+        ++head_group_;
+        head_item_ = 0;
+    }
+}
+
+void OrderedOutput::emit(Pending& pending) {
+    if (!pending.spilled) {
+        buffered_ -= pending.record.size();
+        write_(pending.record);
+        std::string().swap(pending.record);
+        return;
+    }
+    read_buffer_.resize(pending.size);
+    if (std::fseek(spill_, static_cast<long>(pending.offset), SEEK_SET) != 0 ||
+        std::fread(read_buffer_.data(), 1, read_buffer_.size(), spill_) != read_buffer_.size()) {
+        std::fprintf(stderr, "ordered output: cannot read back spilled record\n");
+        std::abort();
+    }
+    write_(read_buffer_);
+}
+
+// Moves the record to the spill file; returns false (keeping it in memory)
+// when no temporary file is available.
+bool OrderedOutput::spill(Pending& pending) {
+    if (!spill_) {
+        spill_ = std::tmpfile();
+        if (!spill_) return false;
+    }
+    if (std::fseek(spill_, static_cast<long>(spill_end_), SEEK_SET) != 0 ||
+        std::fwrite(pending.record.data(), 1, pending.record.size(), spill_) != pending.record.size()) {
+        return false;
+    }
+    pending.spilled = true;
+    pending.offset = spill_end_;
+    spill_end_ += pending.size;
+    std::string().swap(pending.record);
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Puts records produced out of order (by pool workers) back into order.
+// Records are numbered (group, item), e.g. (simfile, chart); groups are
+// emitted in index order and items within a group in index order. The record
+// at the head of the order is written as soon as it arrives, later ones wait
+// in memory. Once waiting records exceed memory_limit bytes, new arrivals are
+// spilled to a temporary file instead, so one slow group can't make the
+// backlog grow without bound.
+class OrderedOutput {
+public:
+    using Writer = std::function<void(std::string_view record)>;
+
+    static constexpr size_t kDefaultMemoryLimit = size_t(64) << 20;
+
+    // write is called for each record in order and flush after each run of
+    // writes; both run under the internal lock, never concurrently.
+    OrderedOutput(size_t groups, Writer write, std::function<void()> flush,
+                  size_t memory_limit = kDefaultMemoryLimit);
+    ~OrderedOutput();
+
+    OrderedOutput(const OrderedOutput&) = delete;
+    OrderedOutput& operator=(const OrderedOutput&) = delete;
+
+    // Each (group, item) is put at most once, from any thread.
+    void put(size_t group, size_t item, std::string record);
+
+    // The group has exactly `items` records (all of them put before or after).
+    void close_group(size_t group, size_t items);
+
+    // Blocks until every group is closed and written.
+    void wait();
+
+    // Bytes written to the spill file so far.
+    uint64_t spilled_bytes() const;
+
+private:
+    struct Pending {
+        bool ready = false;
+        bool spilled = false;
+        std::string record;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+    struct Group {
+        std::vector<Pending> items;
+        bool closed = false;
+        size_t count = 0;
+    };
+
+    Pending& slot(size_t group, size_t item);
+    void drain();
+    void emit(Pending& pending);
+    bool spill(Pending& pending);
+
+    Writer write_;
+    std::function<void()> flush_;
+    size_t memory_limit_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable finished_;
+    std::vector<Group> groups_;
+    size_t head_group_ = 0;
+    size_t head_item_ = 0;
+    size_t buffered_ = 0;
+    std::FILE* spill_ = nullptr;
+    uint64_t spill_end_ = 0;
+    std::string read_buffer_;
+};
@@ -0,0 +1,329 @@
+#include "result_cache.h"
+
+#include "binary_archive.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[4] = {'I', 'R', 'H', 'C'};
+// Bump when ChartMetrics or the entry layout changes.
+constexpr uint32_t kFormatVersion = 2;
+constexpr std::string_view kEntryExtension = ".chart";
+// Running total of the entry bytes, so runs that stay under the bound need
+// not walk the directory to find out.
+constexpr std::string_view kSizeLedger = "size";
+// A temporary file this old belongs to a run that died before renaming it.
+constexpr auto kOrphanedTempAge = std::chrono::hours(1);
+
+template <typename Archive, typename Tech>
+void tech_members(Archive& ar, Tech& t) {
+    ar(t.crossovers);
+    ar(t.footswitches);
+    ar(t.sideswitches);
+    ar(t.jacks);
+    ar(t.brackets);
+    ar(t.doublesteps);
+}
+
+// Every ChartMetrics member, in entry order. Both archives below take the
+// same list, so reading always mirrors writing.
+template <typename Archive, typename Metrics>
+void chart_members(Archive& ar, Metrics& m) {
+    ar(m.status);
+    ar(m.simfile);
+    ar(m.hash);
+    ar(m.title);
+    ar(m.subtitle);
+    ar(m.artist);
+    ar(m.title_translated);
+    ar(m.subtitle_translated);
+    ar(m.artist_translated);
+    ar(m.step_artist);
+    ar(m.description);
+    ar(m.steps_type);
+    ar(m.difficulty);
+    ar(m.meter);
+    ar(m.bpms);
+    ar(m.hash_bpms);
+    ar(m.bpm_min);
+    ar(m.bpm_max);
+    ar(m.display_bpm);
+    ar(m.display_bpm_min);
+    ar(m.display_bpm_max);
+    ar(m.duration_seconds);
+    ar(m.streams_breakdown);
+    ar(m.streams_breakdown_level1);
+    ar(m.streams_breakdown_level2);
+    ar(m.streams_breakdown_level3);
+    ar(m.total_stream_measures);
+    ar(m.total_break_measures);
+    ar(m.total_steps);
+    ar(m.notes_per_measure);
+    ar(m.nps_per_measure);
+    ar(m.equally_spaced_per_measure);
+    ar(m.peak_nps);
+    ar.count(m.stream_sequences);
+    for (auto& seq : m.stream_sequences) {
+        ar(seq.stream_start);
+        ar(seq.stream_end);
+        ar(seq.is_break);
+    }
+    ar(m.holds);
+    ar(m.mines);
+    ar(m.rolls);
+    ar(m.taps_and_holds);
+    ar(m.notes);
+    ar(m.lifts);
+    ar(m.fakes);
+    ar(m.jumps);
+    ar(m.hands);
+    ar(m.quads);
+    tech_members(ar, m.tech);
+    ar(m.beat0_offset_seconds);
+    ar(m.beat0_group_offset_seconds);
+    ar(m.timing_bpms);
+    ar(m.timing_stops);
+    ar(m.timing_delays);
+    ar(m.timing_time_signatures);
+    ar(m.timing_warps);
+    ar.count(m.timing_labels);
+    for (auto& label : m.timing_labels) {
+        ar(label.beat);
+        ar(label.label);
+    }
+    ar(m.timing_tickcounts);
+    ar(m.timing_combos);
+    ar(m.timing_speeds);
+    ar(m.timing_scrolls);
+    ar(m.timing_fakes);
+    ar(m.timing_id);
+    ar(m.timing_shared);
+}
+
+} // namespace
+
+std::string encode_chart(const ChartMetrics& m) {
+    BinaryWriter writer;
+    chart_members(writer, m);
+    return std::move(writer.str());
+}
+
+bool decode_chart(std::string_view bytes, ChartMetrics& m) {
+    BinaryReader reader(bytes);
+    chart_members(reader, m);
+    return reader.ok() && reader.at_end();
+}
+
+ResultCache::ResultCache(std::string dir, std::string salt, uint64_t max_bytes)
+    : dir_(std::move(dir)), salt_(std::move(salt)), max_bytes_(max_bytes) {}
+
+ResultCache::~ResultCache() {
+    trim();
+}
+
+std::string ResultCache::default_dir() {
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) return (fs::path(xdg) / "itgmania-reference-harness").string();
+    const char* home = std::getenv("HOME");
+    if (home && *home) return (fs::path(home) / ".cache" / "itgmania-reference-harness").string();
+    const char* local_app_data = std::getenv("LOCALAPPDATA");
+    if (local_app_data && *local_app_data) {
+        return (fs::path(local_app_data) / "itgmania-reference-harness" / "cache").string();
+    }
+    return {};
+}
+
+bool ResultCache::open(std::string* error) {
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    if (ec || !fs::is_directory(dir_, ec)) {
+        if (error) *error = "cannot create " + dir_ + (ec ? ": " + ec.message() : std::string());
+        return false;
+    }
+    opened_ = true;
+    return true;
+}
+
+std::string ResultCache::key(std::initializer_list<std::string_view> parts) const {
+    ContentHash hash;
+    hash.add(salt_);
+    for (std::string_view part : parts) hash.add(part);
+    return hash.hex();
+}
+
+std::string ResultCache::entry_path(const std::string& key) const {
+    return (fs::path(dir_) / key.substr(0, 2) / (key + std::string(kEntryExtension))).string();
+}
+
+// An entry is the magic, the format version and its key, then the payload.
+// An entry that is damaged or was written for another key is deleted.
+bool ResultCache::read_entry(const std::string& key, std::string& payload) {
+    if (!opened_ || refresh_) return false;
+    const std::string path = entry_path(key);
+    std::string data;
+    if (!read_file(path, data)) return false;
+
+    BinaryReader reader(data);
+    char magic[sizeof(kMagic)] = {};
+    uint32_t version = 0;
+    std::string stored_key;
+    reader.raw(magic, sizeof(magic));
+    reader.raw(&version, sizeof(version));
+    reader(stored_key);
+    if (!reader.ok() || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kFormatVersion ||
+        stored_key != key) {
+        drop_entry(key);
+        return false;
+    }
+    payload.assign(data, data.size() - reader.remaining(), std::string::npos);
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+void ResultCache::drop_entry(const std::string& key) {
+    std::error_code ec;
+    fs::remove(entry_path(key), ec);
+}
+
+void ResultCache::write_entry(const std::string& key, std::string_view payload) {
+    if (!opened_) return;
+    BinaryWriter writer;
+    writer.raw(kMagic, sizeof(kMagic));
+    writer.raw(&kFormatVersion, sizeof(kFormatVersion));
+    writer(key);
+    writer.raw(payload.data(), payload.size());
+
+    if (write_file_atomically(entry_path(key), writer.str())) written_ += writer.str().size();
+}
+
+std::optional<std::vector<ChartMetrics>> ResultCache::load(const std::string& key) {
+    std::string payload;
+    if (!read_entry(key, payload)) return std::nullopt;
+    BinaryReader reader(payload);
+    // Charts are added as they are read rather than sized up front: a
+    // ChartMetrics is far larger than its smallest encoding, so a damaged
+    // count could otherwise ask for gigabytes.
+    const size_t count = reader.count();
+    std::vector<ChartMetrics> charts;
+    while (reader.ok() && charts.size() < count) chart_members(reader, charts.emplace_back());
+    if (!reader.ok() || !reader.at_end()) {
+        drop_entry(key);
+        return std::nullopt;
+    }
+    return charts;
+}
+
+void ResultCache::store(const std::string& key, const std::vector<ChartMetrics>& charts) {
+    BinaryWriter writer;
+    writer.count(charts.size());
+    for (const ChartMetrics& m : charts) chart_members(writer, m);
+    write_entry(key, writer.str());
+}
+
+std::optional<std::vector<std::string>> ResultCache::load_keys(const std::string& key) {
+    std::string payload;
+    if (!read_entry(key, payload)) return std::nullopt;
+    BinaryReader reader(payload);
+    std::vector<std::string> keys;
+    reader(keys);
+    if (!reader.ok() || !reader.at_end()) {
+        drop_entry(key);
+        return std::nullopt;
+    }
+    return keys;
+}
+
+void ResultCache::store_keys(const std::string& key, const std::vector<std::string>& keys) {
+    BinaryWriter writer;
+    writer(keys);
+    write_entry(key, writer.str());
+}
+
+std::optional<TechCountsOut> ResultCache::load_tech_counts(const std::string& key) {
+    std::string payload;
+    if (!read_entry(key, payload)) return std::nullopt;
+    BinaryReader reader(payload);
+    TechCountsOut tech;
+    tech_members(reader, tech);
+    if (!reader.ok() || !reader.at_end()) {
+        drop_entry(key);
+        return std::nullopt;
+    }
+    return tech;
+}
+
+void ResultCache::store_tech_counts(const std::string& key, const TechCountsOut& tech) {
+    BinaryWriter writer;
+    tech_members(writer, tech);
+    write_entry(key, writer.str());
+}
+
+// The ledger is a hint: runs writing concurrently can lose each other's
+// additions, and overwritten or dropped entries are not subtracted. Walking
+// the directory settles it again whenever it reports the cache over max_bytes.
+void ResultCache::trim() {
+    if (!opened_) return;
+    const uint64_t written = written_.exchange(0);
+    const std::string ledger = (fs::path(dir_) / kSizeLedger).string();
+    std::string data;
+    uint64_t total = 0;
+    bool walk = true;
+    if (read_file(ledger, data)) {
+        BinaryReader reader(data);
+        reader(total);
+        total += written;
+        walk = !reader.ok() || !reader.at_end() || total > max_bytes_;
+        if (!walk && written == 0) return;
+    }
+    if (walk) total = trim_directory();
+    BinaryWriter writer;
+    writer(total);
+    write_file_atomically(ledger, writer.str());
+}
+
+// Deletes least recently used entries until the cache fits max_bytes, and
+// temporary files left behind by killed runs; returns the bytes kept.
+uint64_t ResultCache::trim_directory() {
+    struct Entry {
+        fs::file_time_type used;
+        uint64_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    const fs::file_time_type orphaned_before = fs::file_time_type::clock::now() - kOrphanedTempAge;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        if (it->path().filename().string().find(kTempFileMarker) != std::string::npos) {
+            const fs::file_time_type modified = it->last_write_time(ec);
+            if (!ec && modified < orphaned_before) fs::remove(it->path(), ec);
+            ec.clear();
+            continue;
+        }
+        if (it->path().extension() != kEntryExtension) continue;
+        Entry entry{it->last_write_time(ec), it->file_size(ec), it->path()};
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+        total += entry.size;
+        entries.push_back(std::move(entry));
+    }
+    if (total <= max_bytes_) return total;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& entry : entries) {
+        if (total <= max_bytes_) break;
+        if (fs::remove(entry.path, ec)) total -= entry.size;
+    }
+    return total;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "itgmania_adapter.h"
+
+// One chart in the cache's entry encoding, for callers that hold charts as
+// bytes for a while (e.g. to spill them to disk). decode_chart returns false
+// on bytes encode_chart did not produce.
+std::string encode_chart(const ChartMetrics& m);
+bool decode_chart(std::string_view bytes, ChartMetrics& m);
+
+// On-disk cache of analyzed simfiles. Each chart is stored under a key of its
+// own, and a simfile's entry, keyed by a content_key over the simfile's bytes
+// and everything else that shapes the results (harness version, Simply Love
+// parser scripts, parse options), lists the keys of its charts. An unchanged
+// simfile is then read back instead of analyzed, and an edited simfile still
+// reuses its untouched charts. Tech counts are kept per note data too, so a
+// chart copied anywhere in the corpus runs step parity once. Entries are
+// files under <dir>/<2 hex digits>/, written to a temporary name and renamed,
+// so concurrent runs never see half an entry. A hit refreshes the entry's
+// modification time; when the cache is destroyed, entries beyond max_bytes
+// are deleted least recently used first. A small ledger file keeps the
+// cache's total size up to date with the bytes each run writes, so the
+// directory is only walked once that total goes over max_bytes (or the
+// ledger is missing); the walk also deletes temporary files that runs killed
+// mid-write left behind.
+class ResultCache {
+public:
+    static constexpr uint64_t kDefaultMaxBytes = uint64_t(1) << 30;
+
+    // salt is mixed into every key (the harness version and build id).
+    ResultCache(std::string dir, std::string salt, uint64_t max_bytes = kDefaultMaxBytes);
+    ~ResultCache();
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // $XDG_CACHE_HOME/itgmania-reference-harness, else ~/.cache/...; empty
+    // when neither variable is set.
+    static std::string default_dir();
+
+    // Creates the directory. On failure returns false and describes the
+    // problem in error.
+    bool open(std::string* error);
+
+    // With refresh, every lookup misses but results are still stored, so a
+    // run rebuilds the entries it touches.
+    void set_refresh(bool refresh) { refresh_ = refresh; }
+
+    // content_key over the salt and the parts.
+    std::string key(std::initializer_list<std::string_view> parts) const;
+
+    // The charts stored under key, or nullopt. A damaged entry is deleted
+    // and counts as a miss. Safe to call from several threads.
+    std::optional<std::vector<ChartMetrics>> load(const std::string& key);
+
+    // Best effort: a failed write leaves no entry behind.
+    void store(const std::string& key, const std::vector<ChartMetrics>& charts);
+
+    // The same for a list of other entries' keys, e.g. a simfile's charts.
+    std::optional<std::vector<std::string>> load_keys(const std::string& key);
+    void store_keys(const std::string& key, const std::vector<std::string>& keys);
+
+    // The same for the tech counts of one chart's note data (see
+    // ChartParseOptions::cache).
+    std::optional<TechCountsOut> load_tech_counts(const std::string& key);
+    void store_tech_counts(const std::string& key, const TechCountsOut& tech);
+
+    // Deletes least recently used entries until the cache fits max_bytes.
+    // Cheap while the ledger shows the cache under the bound.
+    void trim();
+
+private:
+    std::string entry_path(const std::string& key) const;
+    bool read_entry(const std::string& key, std::string& payload);
+    void write_entry(const std::string& key, std::string_view payload);
+    void drop_entry(const std::string& key);
+    uint64_t trim_directory();
+
+    std::string dir_;
+    std::string salt_;
+    uint64_t max_bytes_;
+    bool refresh_ = false;
+    bool opened_ = false;
+    // Entry bytes written since the last trim.
+    std::atomic<uint64_t> written_{0};
+};
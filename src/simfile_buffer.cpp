@@ -0,0 +1,101 @@
+#include "simfile_buffer.h"
+
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+struct RegisteredSimfile {
+    SimfileBytes bytes;
+    size_t scopes = 0;
+};
+
+std::mutex& registry_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::unordered_map<std::string, RegisteredSimfile>& registry() {
+    static std::unordered_map<std::string, RegisteredSimfile> simfiles;
+    return simfiles;
+}
+
+SimfileBytes read_simfile_bytes(const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return nullptr;
+    const std::streamoff size = in.tellg();
+    if (size < 0) return nullptr;
+    auto bytes = std::make_shared<std::string>(static_cast<size_t>(size), '\0');
+    in.seekg(0, std::ios::beg);
+    if (!in.read(bytes->data(), size)) return nullptr;
+    return bytes;
+}
+
+} // namespace
+
+SimfileBytes find_simfile_buffer(const std::string& path) {
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    auto it = registry().find(path);
+    return it == registry().end() ? nullptr : it->second.bytes;
+}
+
+SimfileBufferScope::SimfileBufferScope(const std::string& path) : path_(path) {
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        auto it = registry().find(path_);
+        if (it != registry().end()) {
+            ++it->second.scopes;
+            bytes_ = it->second.bytes;
+            return;
+        }
+    }
+
+    // Read outside the lock so other simfiles aren't held up behind this one.
+    SimfileBytes bytes = read_simfile_bytes(path_);
+    if (!bytes) return;
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    RegisteredSimfile& entry = registry()[path_];
+    if (!entry.bytes) entry.bytes = std::move(bytes);
+    ++entry.scopes;
+    bytes_ = entry.bytes;
+}
+
+SimfileBufferScope::~SimfileBufferScope() {
+    if (!bytes_) return;
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    auto it = registry().find(path_);
+    if (it != registry().end() && --it->second.scopes == 0) {
+        registry().erase(it);
+    }
+}
+
+SimfileBufferStreamBuf::SimfileBufferStreamBuf(SimfileBytes bytes) : bytes_(std::move(bytes)) {
+    // The get area is never written through; the cast only satisfies setg.
+    char* begin = const_cast<char*>(bytes_->data());
+    setg(begin, begin, begin + bytes_->size());
+}
+
+SimfileBufferStreamBuf::pos_type SimfileBufferStreamBuf::seekoff(
+    off_type off,
+    std::ios_base::seekdir dir,
+    std::ios_base::openmode which) {
+    if ((which & std::ios_base::in) == 0) return pos_type(off_type(-1));
+
+    off_type base = 0;
+    if (dir == std::ios_base::cur) {
+        base = gptr() - eback();
+    } else if (dir == std::ios_base::end) {
+        base = egptr() - eback();
+    }
+    const off_type target = base + off;
+    if (target < 0 || target > egptr() - eback()) return pos_type(off_type(-1));
+
+    setg(eback(), eback() + target, egptr());
+    return pos_type(target);
+}
+
+SimfileBufferStreamBuf::pos_type SimfileBufferStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <streambuf>
+#include <string>
+
+using SimfileBytes = std::shared_ptr<const std::string>;
+
+// Returns the bytes registered for path by a live SimfileBufferScope, or null.
+// Every reader of a simfile (the ITGmania loaders through RageFile, the raw
+// tag fallbacks and the Lua RageFileUtil shim) checks here before touching disk.
+SimfileBytes find_simfile_buffer(const std::string& path);
+
+// Reads a simfile once and registers it for as long as the scope lives.
+// Nested or concurrent scopes on the same path share one buffer. If the file
+// can't be read nothing is registered and readers fall back to disk.
+class SimfileBufferScope {
+public:
+    explicit SimfileBufferScope(const std::string& path);
+    ~SimfileBufferScope();
+
+    SimfileBufferScope(const SimfileBufferScope&) = delete;
+    SimfileBufferScope& operator=(const SimfileBufferScope&) = delete;
+
+    const SimfileBytes& bytes() const { return bytes_; }
+
+private:
+    std::string path_;
+    SimfileBytes bytes_;
+};
+
+// Read-only, seekable streambuf over shared simfile bytes, so std::istream
+// readers can use the buffer without copying it.
+class SimfileBufferStreamBuf : public std::streambuf {
+public:
+    explicit SimfileBufferStreamBuf(SimfileBytes bytes);
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+    SimfileBytes bytes_;
+};
@@ -0,0 +1,68 @@
+#include "simfile_scan.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <system_error>
+
+namespace {
+
+// Lower rank wins; mirrors the loader order in ITGmania's NotesLoader::LoadFromDir.
+int simfile_extension_rank(const std::filesystem::path& path) {
+    std::string ext = path.extension().string();
+    for (char& c : ext) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    if (ext == ".ssc") return 0;
+    if (ext == ".sma") return 1;
+    if (ext == ".sm") return 2;
+    if (ext == ".ats") return 3;
+    return -1;
+}
+
+struct SongFolderPick {
+    int rank = -1;
+    std::string path;
+};
+
+} // namespace
+
+bool is_simfile_name(std::string_view name) {
+    return simfile_extension_rank(std::filesystem::path(name)) >= 0;
+}
+
+std::vector<std::string> find_simfiles(const std::string& root) {
+    namespace fs = std::filesystem;
+
+    std::map<std::string, SongFolderPick> picks;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+    const fs::recursive_directory_iterator end;
+    for (; !ec && it != end; it.increment(ec)) {
+        const fs::directory_entry& entry = *it;
+        std::error_code type_ec;
+        if (!entry.is_regular_file(type_ec)) continue;
+        const int rank = simfile_extension_rank(entry.path());
+        if (rank < 0) continue;
+
+        const std::string path = entry.path().string();
+        SongFolderPick& pick = picks[entry.path().parent_path().string()];
+        if (pick.rank < 0 || rank < pick.rank || (rank == pick.rank && path < pick.path)) {
+            pick.rank = rank;
+            pick.path = path;
+        }
+    }
+    if (ec) {
+        std::fprintf(stderr, "scan error under %s: %s\n", root.c_str(), ec.message().c_str());
+    }
+
+    std::vector<std::string> out;
+    out.reserve(picks.size());
+    for (auto& kv : picks) {
+        out.push_back(std::move(kv.second.path));
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
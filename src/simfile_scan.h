@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Walks a Songs tree (a single song folder, a pack, or a directory of packs)
+// and returns one simfile per song folder, sorted by path. When a folder holds
+// several simfiles the one ITGmania would load is chosen (.ssc, then .sma,
+// then .sm, then an .ats autosave).
+std::vector<std::string> find_simfiles(const std::string& root);
+
+// True for the file names find_simfiles picks from (.ssc, .sma, .sm, .ats,
+// any case).
+bool is_simfile_name(std::string_view name);
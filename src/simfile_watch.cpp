@@ -0,0 +1,232 @@
+#include "simfile_watch.h"
+
+#include "simfile_scan.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// A tree that never goes quiet (e.g. a long copy) still reports this often.
+constexpr int kMaxBatchPeriods = 20;
+
+constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE |
+                                IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+volatile std::sig_atomic_t g_interrupted = 0;
+// Written by the signal handler so a blocked poll() wakes up.
+int g_wake_pipe[2] = {-1, -1};
+
+void on_stop_signal(int) {
+    g_interrupted = 1;
+    const int saved_errno = errno;
+    if (g_wake_pipe[1] >= 0) (void)!write(g_wake_pipe[1], "", 1);
+    errno = saved_errno;
+}
+
+} // namespace
+
+bool SimfileWatcher::stop_on_signals(std::string* error) {
+    if (g_wake_pipe[0] < 0 && pipe2(g_wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        if (error) *error = std::string("pipe: ") + std::strerror(errno);
+        return false;
+    }
+    struct sigaction action {};
+    action.sa_handler = on_stop_signal;
+    sigemptyset(&action.sa_mask);
+    // A second signal, e.g. while a large simfile is being analyzed, kills
+    // the process as usual.
+    action.sa_flags = SA_RESETHAND | SA_RESTART;
+    if (sigaction(SIGINT, &action, nullptr) != 0 || sigaction(SIGTERM, &action, nullptr) != 0) {
+        if (error) *error = std::string("sigaction: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool SimfileWatcher::interrupted() {
+    return g_interrupted != 0;
+}
+
+SimfileWatcher::SimfileWatcher(std::string root) : root_(std::move(root)) {}
+
+SimfileWatcher::~SimfileWatcher() {
+    if (fd_ >= 0) close(fd_);
+}
+
+bool SimfileWatcher::start(std::string* error) {
+    fd_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd_ < 0) {
+        if (error) *error = std::string("inotify: ") + std::strerror(errno);
+        return false;
+    }
+    if (!watch_tree(root_)) {
+        if (error) *error = "cannot watch " + root_ + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+// Drops the watches on dir and every directory below it, e.g. once dir has
+// been moved out of the tree (a move keeps the watches, so they would go on
+// reporting under the old paths).
+void SimfileWatcher::unwatch_tree(const std::string& dir) {
+    const std::string prefix = (fs::path(dir) / "").string();
+    for (auto it = dirs_.begin(); it != dirs_.end();) {
+        if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(fd_, it->first);
+            it = dirs_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Directories that vanish while being walked are skipped; their parent's
+// events report them.
+bool SimfileWatcher::watch_tree(const std::string& dir) {
+    const int wd = inotify_add_watch(fd_, dir.c_str(), kWatchMask);
+    if (wd < 0) return false;
+    dirs_[wd] = dir;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+         !ec && it != end; it.increment(ec)) {
+        std::error_code type_ec;
+        if (!it->is_directory(type_ec) || it->is_symlink(type_ec)) continue;
+        const std::string path = it->path().string();
+        const int sub = inotify_add_watch(fd_, path.c_str(), kWatchMask);
+        if (sub >= 0) dirs_[sub] = path;
+    }
+    return true;
+}
+
+bool SimfileWatcher::wait(std::chrono::milliseconds quiet, std::vector<std::string>& folders, std::string* error) {
+    folders.clear();
+    bool overflow = false;
+    alignas(inotify_event) char buffer[64 * 1024];
+
+    // Blocks for the first event, then only as long as the quiet period.
+    int timeout = -1;
+    std::chrono::steady_clock::time_point deadline;
+    for (;;) {
+        if (interrupted()) {
+            folders.clear();
+            if (error) error->clear();
+            return false;
+        }
+        pollfd pfds[2] = {{fd_, POLLIN, 0}, {g_wake_pipe[0], POLLIN, 0}};
+        const int ready = poll(pfds, g_wake_pipe[0] >= 0 ? 2 : 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            if (error) *error = std::string("poll: ") + std::strerror(errno);
+            return false;
+        }
+        if (pfds[1].revents != 0) continue;
+        if (ready == 0) {
+            if (!folders.empty() || overflow) break;
+            continue;
+        }
+
+        const ssize_t size = read(fd_, buffer, sizeof(buffer));
+        if (size < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            if (error) *error = std::string("inotify read: ") + std::strerror(errno);
+            return false;
+        }
+        for (ssize_t offset = 0; offset < size;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            const auto dir = dirs_.find(event->wd);
+            if (dir == dirs_.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                dirs_.erase(dir);
+                continue;
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                const std::string path = dir->second;
+                if (event->mask & IN_MOVE_SELF) unwatch_tree(path);
+                folders.push_back(path);
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            const std::string path = (fs::path(dir->second) / event->name).string();
+            if (event->mask & IN_ISDIR) {
+                // A new folder may arrive with its files already in place
+                // (copied or moved in), so it is reported as a whole.
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) watch_tree(path);
+                // Moved elsewhere in the tree, it is watched again under its
+                // new path by the IN_MOVED_TO that follows.
+                if (event->mask & IN_MOVED_FROM) unwatch_tree(path);
+                folders.push_back(path);
+            } else if (is_simfile_name(event->name) && !(event->mask & IN_CREATE)) {
+                // IN_CREATE is followed by IN_CLOSE_WRITE once the file is written.
+                folders.push_back(dir->second);
+            }
+        }
+        if (timeout < 0 && (!folders.empty() || overflow)) {
+            timeout = static_cast<int>(quiet.count());
+            deadline = std::chrono::steady_clock::now() + quiet * kMaxBatchPeriods;
+        } else if (timeout >= 0 && std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+    }
+
+    if (overflow) {
+        folders.assign(1, root_);
+        return true;
+    }
+    std::sort(folders.begin(), folders.end());
+    folders.erase(std::unique(folders.begin(), folders.end()), folders.end());
+    return true;
+}
+
+#else
+
+SimfileWatcher::SimfileWatcher(std::string root) : root_(std::move(root)) {}
+
+SimfileWatcher::~SimfileWatcher() = default;
+
+bool SimfileWatcher::start(std::string* error) {
+    if (error) *error = "watching needs inotify (Linux)";
+    return false;
+}
+
+bool SimfileWatcher::wait(std::chrono::milliseconds, std::vector<std::string>& folders, std::string* error) {
+    folders.clear();
+    if (error) *error = "watching needs inotify (Linux)";
+    return false;
+}
+
+bool SimfileWatcher::stop_on_signals(std::string* error) {
+    if (error) *error = "watching needs inotify (Linux)";
+    return false;
+}
+
+bool SimfileWatcher::interrupted() {
+    return false;
+}
+
+bool SimfileWatcher::watch_tree(const std::string&) {
+    return false;
+}
+
+void SimfileWatcher::unwatch_tree(const std::string&) {}
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Watches a Songs tree (every directory under the root) for simfile changes
+// with inotify. Editors save in bursts (write, rename a temporary over the
+// file, touch a backup), so wait() returns only once the tree has been quiet
+// for a while, with every folder that was touched in between.
+//
+// Linux only; elsewhere start() fails.
+class SimfileWatcher {
+public:
+    explicit SimfileWatcher(std::string root);
+    ~SimfileWatcher();
+
+    SimfileWatcher(const SimfileWatcher&) = delete;
+    SimfileWatcher& operator=(const SimfileWatcher&) = delete;
+
+    // Watches the root and every directory below it. On failure returns false
+    // and describes the problem in error.
+    bool start(std::string* error);
+
+    // Makes SIGINT and SIGTERM end wait() (returning false with an empty
+    // error) instead of the process; interrupted() is true from then on, so
+    // callers can also stop between long steps. Process-wide.
+    static bool stop_on_signals(std::string* error);
+    static bool interrupted();
+
+    // Blocks until a simfile is written, moved or deleted, or a directory is
+    // created, moved or deleted, then collects events until none arrive for
+    // `quiet` (or, in a steady stream of events, for at most 20 times
+    // that). Fills folders with the touched directories (sorted, unique);
+    // new directories are watched from then on. When the kernel dropped
+    // events, folders is just the root. Returns false on a read error or
+    // when interrupted.
+    bool wait(std::chrono::milliseconds quiet, std::vector<std::string>& folders, std::string* error);
+
+private:
+    bool watch_tree(const std::string& dir);
+    void unwatch_tree(const std::string& dir);
+
+    std::string root_;
+    int fd_ = -1;
+    // Watch descriptor -> directory path.
+    std::unordered_map<int, std::string> dirs_;
+};
@@ -0,0 +1,220 @@
+#include "sl_stream_engine.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+constexpr int kBreakdownNotesThreshold = 16;
+
+// Breaks this long or shorter are drawn as a separator (level 1) or folded
+// into the surrounding stream (level 2) when the breakdown is minimized.
+constexpr int kShortBreakMeasures = 4;
+
+std::string format_double(double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.17g", value);
+    return buf;
+}
+
+template <typename T, typename Format>
+std::string format_list(const std::vector<T>& values, Format format) {
+    std::string out = "[";
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i) out += ",";
+        out += format(values[i]);
+    }
+    out += "]";
+    return out;
+}
+
+std::string format_sequences(const std::vector<StreamSequenceOut>& sequences) {
+    return format_list(sequences, [](const StreamSequenceOut& seq) {
+        std::ostringstream ss;
+        ss << (seq.is_break ? "break" : "stream") << ":" << seq.stream_start << "-" << seq.stream_end;
+        return ss.str();
+    });
+}
+
+// NaN shows up for zero-length measures (0 notes / 0 seconds) on both sides.
+bool same_double(double a, double b) {
+    return a == b || (a != a && b != b);
+}
+
+} // namespace
+
+std::vector<StreamSequenceOut> sl_stream_sequences(const std::vector<int>& notes_per_measure, int notes_threshold) {
+    std::vector<int> stream_measures;
+    for (size_t i = 0; i < notes_per_measure.size(); ++i) {
+        if (notes_per_measure[i] >= notes_threshold) {
+            stream_measures.push_back(static_cast<int>(i + 1));
+        }
+    }
+
+    // Every measure counts, however short the stream or break.
+    const int stream_sequence_threshold = 1;
+    const int break_sequence_threshold = 1;
+
+    std::vector<StreamSequenceOut> sequences;
+    if (!stream_measures.empty()) {
+        const int break_start = 0;
+        const int break_end = stream_measures.front() - 1;
+        if (break_end - break_start >= break_sequence_threshold) {
+            sequences.push_back({break_start, break_end, true});
+        }
+    }
+
+    int counter = 1;
+    int stream_end = -1;
+    for (size_t k = 0; k < stream_measures.size(); ++k) {
+        const int cur = stream_measures[k];
+        const int next = k + 1 < stream_measures.size() ? stream_measures[k + 1] : -1;
+        if (cur + 1 == next) {
+            ++counter;
+            stream_end = cur + 1;
+            continue;
+        }
+
+        if (counter >= stream_sequence_threshold) {
+            if (stream_end < 0) stream_end = cur;
+            sequences.push_back({stream_end - counter, stream_end, false});
+        }
+
+        const int break_start = cur;
+        const int break_end = next != -1 ? next - 1 : static_cast<int>(notes_per_measure.size());
+        if (break_end - break_start >= break_sequence_threshold) {
+            sequences.push_back({break_start, break_end, true});
+        }
+        counter = 1;
+        stream_end = -1;
+    }
+    return sequences;
+}
+
+std::string sl_breakdown_text(const std::vector<int>& notes_per_measure, int minimization_level) {
+    const std::vector<StreamSequenceOut> sequences = sl_stream_sequences(notes_per_measure, kBreakdownNotesThreshold);
+
+    std::string text;
+    int total = 0;
+    int pending_sum = 0;   // level 2: streams merged across short breaks
+    bool pending_merged = false;
+
+    auto flush_pending = [&]() {
+        if (pending_sum == 0) return;
+        text += std::to_string(pending_sum);
+        if (pending_merged) text += "*";
+        pending_sum = 0;
+        pending_merged = false;
+    };
+
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        const StreamSequenceOut& seq = sequences[i];
+        const int size = seq.stream_end - seq.stream_start;
+        if (!seq.is_break) {
+            total += size;
+            if (minimization_level == 2) {
+                if (pending_sum > 0) pending_merged = true;
+                pending_sum += size;
+            } else {
+                text += std::to_string(size);
+            }
+            continue;
+        }
+
+        // Leading and trailing breaks are never part of the breakdown.
+        if (i == 0 || i + 1 == sequences.size()) continue;
+
+        if (minimization_level == 1 && size <= kShortBreakMeasures) {
+            text += size == 1 ? "-" : "/";
+        } else if (minimization_level == 2 && size <= kShortBreakMeasures) {
+            // Keep summing the stream on either side.
+        } else {
+            flush_pending();
+            text += " (" + std::to_string(size) + ") ";
+        }
+    }
+    flush_pending();
+
+    if (total == 0) return "No Streams!";
+    if (minimization_level >= 3) return std::to_string(total) + " Total";
+    return text;
+}
+
+void sl_total_stream_and_break_measures(const std::vector<int>& notes_per_measure, int& stream_measures,
+                                        int& break_measures) {
+    const std::vector<StreamSequenceOut> sequences = sl_stream_sequences(notes_per_measure, kBreakdownNotesThreshold);
+    stream_measures = 0;
+    break_measures = 0;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        const StreamSequenceOut& seq = sequences[i];
+        const int size = seq.stream_end - seq.stream_start;
+        if (!seq.is_break) {
+            stream_measures += size;
+        } else if (i > 0 && i + 1 < sequences.size()) {
+            break_measures += size;
+        }
+    }
+}
+
+void sl_fill_derived_stream_info(SLStreamInfo& info) {
+    info.stream_sequences = sl_stream_sequences(info.notes_per_measure, kBreakdownNotesThreshold);
+    info.breakdown_levels.resize(4);
+    for (int level = 0; level < 4; ++level) {
+        info.breakdown_levels[level] = sl_breakdown_text(info.notes_per_measure, level);
+    }
+    sl_total_stream_and_break_measures(info.notes_per_measure, info.stream_measures, info.break_measures);
+}
+
+std::vector<std::string> sl_stream_info_mismatches(const SLStreamInfo& lua, const SLStreamInfo& native) {
+    std::vector<std::string> out;
+    auto report = [&](const char* field, const std::string& lua_value, const std::string& native_value) {
+        out.push_back(std::string(field) + ": lua=" + lua_value + " native=" + native_value);
+    };
+    auto format_int = [](int v) { return std::to_string(v); };
+    auto format_bool = [](bool v) { return std::string(v ? "true" : "false"); };
+
+    if (lua.notes_per_measure != native.notes_per_measure) {
+        report("notes_per_measure", format_list(lua.notes_per_measure, format_int),
+               format_list(native.notes_per_measure, format_int));
+    }
+    bool nps_equal = lua.nps_per_measure.size() == native.nps_per_measure.size();
+    for (size_t i = 0; nps_equal && i < lua.nps_per_measure.size(); ++i) {
+        nps_equal = same_double(lua.nps_per_measure[i], native.nps_per_measure[i]);
+    }
+    if (!nps_equal) {
+        report("nps_per_measure", format_list(lua.nps_per_measure, format_double),
+               format_list(native.nps_per_measure, format_double));
+    }
+    if (lua.equally_spaced_per_measure != native.equally_spaced_per_measure) {
+        report("equally_spaced_per_measure", format_list(lua.equally_spaced_per_measure, format_bool),
+               format_list(native.equally_spaced_per_measure, format_bool));
+    }
+    if (!same_double(lua.peak_nps, native.peak_nps)) {
+        report("peak_nps", format_double(lua.peak_nps), format_double(native.peak_nps));
+    }
+    if (lua.stream_sequences.size() != native.stream_sequences.size()
+        || !std::equal(lua.stream_sequences.begin(), lua.stream_sequences.end(), native.stream_sequences.begin(),
+                       [](const StreamSequenceOut& a, const StreamSequenceOut& b) {
+                           return a.stream_start == b.stream_start && a.stream_end == b.stream_end
+                               && a.is_break == b.is_break;
+                       })) {
+        report("stream_sequences", format_sequences(lua.stream_sequences), format_sequences(native.stream_sequences));
+    }
+    const size_t levels = std::max(lua.breakdown_levels.size(), native.breakdown_levels.size());
+    for (size_t level = 0; level < levels; ++level) {
+        const std::string lua_text = level < lua.breakdown_levels.size() ? lua.breakdown_levels[level] : "";
+        const std::string native_text = level < native.breakdown_levels.size() ? native.breakdown_levels[level] : "";
+        if (lua_text != native_text) {
+            const std::string field = "streams_breakdown_level" + std::to_string(level);
+            report(field.c_str(), "\"" + lua_text + "\"", "\"" + native_text + "\"");
+        }
+    }
+    if (lua.stream_measures != native.stream_measures) {
+        report("total_stream_measures", format_int(lua.stream_measures), format_int(native.stream_measures));
+    }
+    if (lua.break_measures != native.break_measures) {
+        report("total_break_measures", format_int(lua.break_measures), format_int(native.break_measures));
+    }
+    return out;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "itgmania_adapter.h"
+
+// Everything the harness reads back from SL.P1.Streams and the helper
+// functions (GetStreamSequences(..., 16), GenerateBreakdownText levels 0-3,
+// GetTotalStreamAndBreakMeasures) for one chart.
+struct SLStreamInfo {
+    std::vector<int> notes_per_measure;
+    std::vector<double> nps_per_measure;
+    std::vector<bool> equally_spaced_per_measure;
+    double peak_nps = 0.0;
+    std::vector<StreamSequenceOut> stream_sequences;
+    std::vector<std::string> breakdown_levels;
+    int stream_measures = 0;
+    int break_measures = 0;
+};
+
+// Native ports of SL-ChartParserHelpers.lua. They only look at notes per
+// measure, so they work the same on Lua- or NoteData-derived counts.
+std::vector<StreamSequenceOut> sl_stream_sequences(const std::vector<int>& notes_per_measure, int notes_threshold);
+std::string sl_breakdown_text(const std::vector<int>& notes_per_measure, int minimization_level);
+void sl_total_stream_and_break_measures(const std::vector<int>& notes_per_measure, int& stream_measures,
+                                        int& break_measures);
+
+// Fills stream_sequences, breakdown_levels and the stream/break totals from
+// notes_per_measure.
+void sl_fill_derived_stream_info(SLStreamInfo& info);
+
+// One line per field where the two results differ; empty when they agree.
+std::vector<std::string> sl_stream_info_mismatches(const SLStreamInfo& lua, const SLStreamInfo& native);
@@ -0,0 +1,729 @@
+#include "sqlite_sink.h"
+
+#ifdef HARNESS_WITH_SQLITE
+
+#include "text_encoding.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace {
+
+constexpr int kSchemaVersion = 1;
+constexpr size_t kBatchCharts = 500;
+
+// chart_ordinal tells apart charts of one simfile with the same steps type,
+// difficulty and description (duplicate difficulties in .sm files, edits
+// sharing a description): 0 for the first in song order, 1 for the next, and
+// so on.
+constexpr const char* kSchemaSql = R"SQL(
+CREATE TABLE IF NOT EXISTS charts (
+  id INTEGER PRIMARY KEY,
+  simfile TEXT NOT NULL,
+  steps_type TEXT NOT NULL,
+  difficulty TEXT NOT NULL,
+  description TEXT NOT NULL,
+  chart_ordinal INTEGER NOT NULL,
+  status TEXT,
+  title TEXT,
+  subtitle TEXT,
+  artist TEXT,
+  title_translated TEXT,
+  subtitle_translated TEXT,
+  artist_translated TEXT,
+  step_artist TEXT,
+  meter INTEGER,
+  bpms TEXT,
+  hash_bpms TEXT,
+  bpm_min REAL,
+  bpm_max REAL,
+  display_bpm TEXT,
+  display_bpm_min REAL,
+  display_bpm_max REAL,
+  hash TEXT,
+  duration_seconds REAL,
+  streams_breakdown TEXT,
+  streams_breakdown_level1 TEXT,
+  streams_breakdown_level2 TEXT,
+  streams_breakdown_level3 TEXT,
+  total_stream_measures INTEGER,
+  total_break_measures INTEGER,
+  total_steps INTEGER,
+  peak_nps REAL,
+  holds INTEGER,
+  mines INTEGER,
+  rolls INTEGER,
+  taps_and_holds INTEGER,
+  notes INTEGER,
+  lifts INTEGER,
+  fakes INTEGER,
+  jumps INTEGER,
+  hands INTEGER,
+  quads INTEGER,
+  beat0_offset_seconds REAL,
+  beat0_group_offset_seconds REAL,
+  tech_crossovers INTEGER,
+  tech_footswitches INTEGER,
+  tech_sideswitches INTEGER,
+  tech_jacks INTEGER,
+  tech_brackets INTEGER,
+  tech_doublesteps INTEGER,
+  timing_digest INTEGER,
+  measures_digest INTEGER,
+  sequences_digest INTEGER,
+  harness_version TEXT,
+  updated_at TEXT,
+  UNIQUE (simfile, steps_type, difficulty, description, chart_ordinal)
+);
+CREATE INDEX IF NOT EXISTS charts_hash ON charts (hash);
+
+CREATE TABLE IF NOT EXISTS timing_segments (
+  chart_id INTEGER NOT NULL REFERENCES charts (id) ON DELETE CASCADE,
+  kind TEXT NOT NULL,
+  idx INTEGER NOT NULL,
+  beat REAL,
+  value1 REAL,
+  value2 REAL,
+  value3 REAL,
+  label TEXT,
+  PRIMARY KEY (chart_id, kind, idx)
+) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS measures (
+  chart_id INTEGER NOT NULL REFERENCES charts (id) ON DELETE CASCADE,
+  measure INTEGER NOT NULL,
+  notes INTEGER,
+  nps REAL,
+  equally_spaced INTEGER,
+  PRIMARY KEY (chart_id, measure)
+) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS stream_sequences (
+  chart_id INTEGER NOT NULL REFERENCES charts (id) ON DELETE CASCADE,
+  idx INTEGER NOT NULL,
+  stream_start INTEGER NOT NULL,
+  stream_end INTEGER NOT NULL,
+  is_break INTEGER NOT NULL,
+  PRIMARY KEY (chart_id, idx)
+) WITHOUT ROWID;
+)SQL";
+
+using ScalarMember = std::variant<
+    std::string ChartMetrics::*,
+    int ChartMetrics::*,
+    double ChartMetrics::*,
+    int TechCountsOut::*>;
+
+// A `charts` column after the key; NULL unless its field is selected.
+struct ScalarColumn {
+    const char* name;
+    ChartField field;
+    ScalarMember member;
+};
+
+const ScalarColumn kScalarColumns[] = {
+    {"status", ChartField::Status, &ChartMetrics::status},
+    {"title", ChartField::Title, &ChartMetrics::title},
+    {"subtitle", ChartField::Subtitle, &ChartMetrics::subtitle},
+    {"artist", ChartField::Artist, &ChartMetrics::artist},
+    {"title_translated", ChartField::TitleTranslated, &ChartMetrics::title_translated},
+    {"subtitle_translated", ChartField::SubtitleTranslated, &ChartMetrics::subtitle_translated},
+    {"artist_translated", ChartField::ArtistTranslated, &ChartMetrics::artist_translated},
+    {"step_artist", ChartField::StepArtist, &ChartMetrics::step_artist},
+    {"meter", ChartField::Meter, &ChartMetrics::meter},
+    {"bpms", ChartField::Bpms, &ChartMetrics::bpms},
+    {"hash_bpms", ChartField::HashBpms, &ChartMetrics::hash_bpms},
+    {"bpm_min", ChartField::BpmMin, &ChartMetrics::bpm_min},
+    {"bpm_max", ChartField::BpmMax, &ChartMetrics::bpm_max},
+    {"display_bpm", ChartField::DisplayBpm, &ChartMetrics::display_bpm},
+    {"display_bpm_min", ChartField::DisplayBpmMin, &ChartMetrics::display_bpm_min},
+    {"display_bpm_max", ChartField::DisplayBpmMax, &ChartMetrics::display_bpm_max},
+    {"hash", ChartField::Hash, &ChartMetrics::hash},
+    {"duration_seconds", ChartField::DurationSeconds, &ChartMetrics::duration_seconds},
+    {"streams_breakdown", ChartField::StreamsBreakdown, &ChartMetrics::streams_breakdown},
+    {"streams_breakdown_level1", ChartField::StreamsBreakdownLevel1, &ChartMetrics::streams_breakdown_level1},
+    {"streams_breakdown_level2", ChartField::StreamsBreakdownLevel2, &ChartMetrics::streams_breakdown_level2},
+    {"streams_breakdown_level3", ChartField::StreamsBreakdownLevel3, &ChartMetrics::streams_breakdown_level3},
+    {"total_stream_measures", ChartField::TotalStreamMeasures, &ChartMetrics::total_stream_measures},
+    {"total_break_measures", ChartField::TotalBreakMeasures, &ChartMetrics::total_break_measures},
+    {"total_steps", ChartField::TotalSteps, &ChartMetrics::total_steps},
+    {"peak_nps", ChartField::PeakNps, &ChartMetrics::peak_nps},
+    {"holds", ChartField::Holds, &ChartMetrics::holds},
+    {"mines", ChartField::Mines, &ChartMetrics::mines},
+    {"rolls", ChartField::Rolls, &ChartMetrics::rolls},
+    {"taps_and_holds", ChartField::TapsAndHolds, &ChartMetrics::taps_and_holds},
+    {"notes", ChartField::Notes, &ChartMetrics::notes},
+    {"lifts", ChartField::Lifts, &ChartMetrics::lifts},
+    {"fakes", ChartField::Fakes, &ChartMetrics::fakes},
+    {"jumps", ChartField::Jumps, &ChartMetrics::jumps},
+    {"hands", ChartField::Hands, &ChartMetrics::hands},
+    {"quads", ChartField::Quads, &ChartMetrics::quads},
+    {"beat0_offset_seconds", ChartField::Timing, &ChartMetrics::beat0_offset_seconds},
+    {"beat0_group_offset_seconds", ChartField::Timing, &ChartMetrics::beat0_group_offset_seconds},
+    {"tech_crossovers", ChartField::TechCounts, &TechCountsOut::crossovers},
+    {"tech_footswitches", ChartField::TechCounts, &TechCountsOut::footswitches},
+    {"tech_sideswitches", ChartField::TechCounts, &TechCountsOut::sideswitches},
+    {"tech_jacks", ChartField::TechCounts, &TechCountsOut::jacks},
+    {"tech_brackets", ChartField::TechCounts, &TechCountsOut::brackets},
+    {"tech_doublesteps", ChartField::TechCounts, &TechCountsOut::doublesteps},
+};
+
+// The upsert keeps the stored value wherever this run binds NULL, so a run
+// with --fields only touches the selected columns.
+std::string build_upsert_sql() {
+    std::string columns = "simfile, steps_type, difficulty, description, chart_ordinal";
+    std::string values = "?, ?, ?, ?, ?";
+    std::string updates;
+    auto add = [&](const std::string& name) {
+        columns += ", " + name;
+        values += ", ?";
+        if (!updates.empty()) updates += ", ";
+        updates += name + " = COALESCE(excluded." + name + ", " + name + ")";
+    };
+    for (const ScalarColumn& column : kScalarColumns) add(column.name);
+    add("timing_digest");
+    add("measures_digest");
+    add("sequences_digest");
+    add("harness_version");
+    columns += ", updated_at";
+    values += ", strftime('%Y-%m-%dT%H:%M:%SZ', 'now')";
+    updates += ", updated_at = excluded.updated_at";
+    return "INSERT INTO charts (" + columns + ") VALUES (" + values +
+           ") ON CONFLICT (simfile, steps_type, difficulty, description, chart_ordinal) DO UPDATE SET " + updates;
+}
+
+// FNV-1a over the child-table content, so unchanged charts skip the
+// delete-and-insert of their segment and measure rows.
+class Digest {
+public:
+    void bytes(const void* data, size_t size) {
+        const auto* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            value_ = (value_ ^ p[i]) * 1099511628211ULL;
+        }
+    }
+    void u64(uint64_t v) { bytes(&v, sizeof(v)); }
+    void f64(double v) { bytes(&v, sizeof(v)); }
+    void text(std::string_view s) {
+        u64(s.size());
+        bytes(s.data(), s.size());
+    }
+    int64_t value() const {
+        int64_t out = 0;
+        std::memcpy(&out, &value_, sizeof(out));
+        return out;
+    }
+
+private:
+    uint64_t value_ = 14695981039346656037ULL;
+};
+
+struct TimingTable {
+    const char* kind;
+    std::vector<std::vector<double>> ChartMetrics::*rows;
+};
+
+const TimingTable kTimingTables[] = {
+    {"bpms", &ChartMetrics::timing_bpms},
+    {"stops", &ChartMetrics::timing_stops},
+    {"delays", &ChartMetrics::timing_delays},
+    {"time_signatures", &ChartMetrics::timing_time_signatures},
+    {"warps", &ChartMetrics::timing_warps},
+    {"tickcounts", &ChartMetrics::timing_tickcounts},
+    {"combos", &ChartMetrics::timing_combos},
+    {"speeds", &ChartMetrics::timing_speeds},
+    {"scrolls", &ChartMetrics::timing_scrolls},
+    {"fakes", &ChartMetrics::timing_fakes},
+};
+
+int64_t timing_digest(const ChartMetrics& m) {
+    Digest d;
+    for (const TimingTable& table : kTimingTables) {
+        const auto& rows = m.*table.rows;
+        d.u64(rows.size());
+        for (const auto& row : rows) {
+            d.u64(row.size());
+            for (const double value : row) d.f64(value);
+        }
+    }
+    d.u64(m.timing_labels.size());
+    for (const TimingLabelOut& label : m.timing_labels) {
+        d.f64(label.beat);
+        d.text(label.label);
+    }
+    return d.value();
+}
+
+int64_t measures_digest(const ChartMetrics& m, const ChartFieldSet& fields) {
+    Digest d;
+    // The selection decides which measure columns are NULL, so it is part of
+    // the content.
+    d.u64(has_field(fields, ChartField::NotesPerMeasure));
+    d.u64(has_field(fields, ChartField::NpsPerMeasure));
+    d.u64(has_field(fields, ChartField::EquallySpacedPerMeasure));
+    d.u64(m.notes_per_measure.size());
+    for (const int notes : m.notes_per_measure) d.u64(static_cast<uint64_t>(notes));
+    d.u64(m.nps_per_measure.size());
+    for (const double nps : m.nps_per_measure) d.f64(nps);
+    d.u64(m.equally_spaced_per_measure.size());
+    for (const bool spaced : m.equally_spaced_per_measure) d.u64(spaced);
+    return d.value();
+}
+
+int64_t sequences_digest(const ChartMetrics& m) {
+    Digest d;
+    d.u64(m.stream_sequences.size());
+    for (const StreamSequenceOut& seq : m.stream_sequences) {
+        d.u64(static_cast<uint64_t>(seq.stream_start));
+        d.u64(static_cast<uint64_t>(seq.stream_end));
+        d.u64(seq.is_break);
+    }
+    return d.value();
+}
+
+bool wants_measures(const ChartFieldSet& fields) {
+    return has_field(fields, ChartField::NotesPerMeasure) || has_field(fields, ChartField::NpsPerMeasure) ||
+           has_field(fields, ChartField::EquallySpacedPerMeasure);
+}
+
+} // namespace
+
+struct SqliteSink::Impl {
+    std::string path;
+    ChartFieldSet fields;
+    std::string harness_version;
+
+    sqlite3* db = nullptr;
+    sqlite3_stmt* find_chart = nullptr;
+    sqlite3_stmt* upsert_chart = nullptr;
+    sqlite3_stmt* delete_timing = nullptr;
+    sqlite3_stmt* insert_timing = nullptr;
+    sqlite3_stmt* delete_measures = nullptr;
+    sqlite3_stmt* insert_measure = nullptr;
+    sqlite3_stmt* delete_sequences = nullptr;
+    sqlite3_stmt* insert_sequence = nullptr;
+    sqlite3_stmt* simfile_charts = nullptr;
+    sqlite3_stmt* delete_chart = nullptr;
+
+    // The simfile between begin_simfile and end_simfile: its savepoint is
+    // open, ordinals counts charts per (steps_type, difficulty, description)
+    // and seen holds the ids of the rows written for it.
+    bool in_simfile = false;
+    bool simfile_complete = false;
+    bool simfile_failed = false;
+    std::string simfile;
+    std::map<std::string, int> ordinals;
+    std::unordered_set<int64_t> seen;
+
+    size_t batch = 0;
+    size_t failed_simfiles = 0;
+    // A commit failed; nothing more is written.
+    bool broken = false;
+    std::string error;  // the first error
+    std::string scratch;
+
+    ~Impl() { close(); }
+
+    void close() {
+        for (sqlite3_stmt** stmt : {&find_chart, &upsert_chart, &delete_timing, &insert_timing, &delete_measures,
+                                    &insert_measure, &delete_sequences, &insert_sequence, &simfile_charts,
+                                    &delete_chart}) {
+            sqlite3_finalize(*stmt);
+            *stmt = nullptr;
+        }
+        sqlite3_close(db);
+        db = nullptr;
+    }
+
+    bool fail(const std::string& what) {
+        if (error.empty()) {
+            error = what + ": " + (db ? sqlite3_errmsg(db) : "out of memory");
+        }
+        return false;
+    }
+
+    bool exec(const char* sql) {
+        char* message = nullptr;
+        if (sqlite3_exec(db, sql, nullptr, nullptr, &message) != SQLITE_OK) {
+            if (error.empty()) error = std::string("sqlite: ") + (message ? message : "statement failed");
+            sqlite3_free(message);
+            return false;
+        }
+        return true;
+    }
+
+    bool prepare(sqlite3_stmt** stmt, const std::string& sql) {
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, stmt, nullptr) != SQLITE_OK) {
+            return fail("prepare");
+        }
+        return true;
+    }
+
+    // Runs a statement to completion and resets it for the next bind.
+    bool step(sqlite3_stmt* stmt, const char* what) {
+        const int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return (rc == SQLITE_DONE || rc == SQLITE_ROW) || fail(what);
+    }
+
+    void bind_text(sqlite3_stmt* stmt, int index, const std::string& value) {
+        const std::string_view text = as_utf8(value, scratch);
+        sqlite3_bind_text(stmt, index, text.data(), static_cast<int>(text.size()), SQLITE_TRANSIENT);
+    }
+
+    void bind_key(sqlite3_stmt* stmt, const ChartMetrics& m, int ordinal) {
+        bind_text(stmt, 1, m.simfile);
+        bind_text(stmt, 2, m.steps_type);
+        bind_text(stmt, 3, m.difficulty);
+        bind_text(stmt, 4, m.description);
+        sqlite3_bind_int(stmt, 5, ordinal);
+    }
+
+    void bind_scalar(sqlite3_stmt* stmt, int index, const ScalarColumn& column, const ChartMetrics& m) {
+        if (!has_field(fields, column.field)) {
+            sqlite3_bind_null(stmt, index);
+            return;
+        }
+        if (auto text = std::get_if<std::string ChartMetrics::*>(&column.member)) {
+            bind_text(stmt, index, m.**text);
+        } else if (auto integer = std::get_if<int ChartMetrics::*>(&column.member)) {
+            sqlite3_bind_int(stmt, index, m.**integer);
+        } else if (auto real = std::get_if<double ChartMetrics::*>(&column.member)) {
+            sqlite3_bind_double(stmt, index, m.**real);
+        } else if (auto tech = std::get_if<int TechCountsOut::*>(&column.member)) {
+            sqlite3_bind_int(stmt, index, m.tech.**tech);
+        }
+    }
+
+    bool write_timing(int64_t chart_id, const ChartMetrics& m) {
+        auto insert = [&](const char* kind, int index, double beat, const double* values, size_t count,
+                          const std::string* label) {
+            sqlite3_bind_int64(insert_timing, 1, chart_id);
+            sqlite3_bind_text(insert_timing, 2, kind, -1, SQLITE_STATIC);
+            sqlite3_bind_int(insert_timing, 3, index);
+            sqlite3_bind_double(insert_timing, 4, beat);
+            for (size_t i = 0; i < 3; ++i) {
+                if (i < count) {
+                    sqlite3_bind_double(insert_timing, static_cast<int>(5 + i), values[i]);
+                }
+            }
+            if (label) bind_text(insert_timing, 8, *label);
+            return step(insert_timing, "insert timing segment");
+        };
+
+        for (const TimingTable& table : kTimingTables) {
+            const auto& rows = m.*table.rows;
+            for (size_t i = 0; i < rows.size(); ++i) {
+                const std::vector<double>& row = rows[i];
+                if (row.empty()) continue;
+                if (!insert(table.kind, static_cast<int>(i), row[0], row.data() + 1, row.size() - 1, nullptr)) {
+                    return false;
+                }
+            }
+        }
+        for (size_t i = 0; i < m.timing_labels.size(); ++i) {
+            const TimingLabelOut& label = m.timing_labels[i];
+            if (!insert("labels", static_cast<int>(i), label.beat, nullptr, 0, &label.label)) return false;
+        }
+        return true;
+    }
+
+    bool write_measures(int64_t chart_id, const ChartMetrics& m) {
+        const bool with_notes = has_field(fields, ChartField::NotesPerMeasure);
+        const bool with_nps = has_field(fields, ChartField::NpsPerMeasure);
+        const bool with_spacing = has_field(fields, ChartField::EquallySpacedPerMeasure);
+        size_t count = 0;
+        if (with_notes) count = std::max(count, m.notes_per_measure.size());
+        if (with_nps) count = std::max(count, m.nps_per_measure.size());
+        if (with_spacing) count = std::max(count, m.equally_spaced_per_measure.size());
+
+        for (size_t i = 0; i < count; ++i) {
+            sqlite3_bind_int64(insert_measure, 1, chart_id);
+            sqlite3_bind_int(insert_measure, 2, static_cast<int>(i));
+            if (with_notes && i < m.notes_per_measure.size()) {
+                sqlite3_bind_int(insert_measure, 3, m.notes_per_measure[i]);
+            }
+            if (with_nps && i < m.nps_per_measure.size()) {
+                sqlite3_bind_double(insert_measure, 4, m.nps_per_measure[i]);
+            }
+            if (with_spacing && i < m.equally_spaced_per_measure.size()) {
+                sqlite3_bind_int(insert_measure, 5, m.equally_spaced_per_measure[i] ? 1 : 0);
+            }
+            if (!step(insert_measure, "insert measure")) return false;
+        }
+        return true;
+    }
+
+    bool write_sequences(int64_t chart_id, const ChartMetrics& m) {
+        for (size_t i = 0; i < m.stream_sequences.size(); ++i) {
+            const StreamSequenceOut& seq = m.stream_sequences[i];
+            sqlite3_bind_int64(insert_sequence, 1, chart_id);
+            sqlite3_bind_int(insert_sequence, 2, static_cast<int>(i));
+            sqlite3_bind_int(insert_sequence, 3, seq.stream_start);
+            sqlite3_bind_int(insert_sequence, 4, seq.stream_end);
+            sqlite3_bind_int(insert_sequence, 5, seq.is_break ? 1 : 0);
+            if (!step(insert_sequence, "insert stream sequence")) return false;
+        }
+        return true;
+    }
+
+    // Deletes the chart's old rows and writes the new ones when the digest
+    // differs from the stored one (or the chart is new).
+    bool replace_children(
+        int64_t chart_id,
+        bool is_new,
+        std::optional<int64_t> stored,
+        int64_t digest,
+        sqlite3_stmt* remove,
+        bool (Impl::*write)(int64_t, const ChartMetrics&),
+        const ChartMetrics& m) {
+        if (!is_new && stored == digest) return true;
+        if (!is_new) {
+            sqlite3_bind_int64(remove, 1, chart_id);
+            if (!step(remove, "delete old rows")) return false;
+        }
+        return (this->*write)(chart_id, m);
+    }
+
+    bool write_chart(const ChartMetrics& m) {
+        const int ordinal = ordinals[m.steps_type + '\n' + m.difficulty + '\n' + m.description]++;
+        const bool with_timing = has_field(fields, ChartField::Timing);
+        const bool with_measures = wants_measures(fields);
+        const bool with_sequences = has_field(fields, ChartField::StreamSequences);
+        const std::optional<int64_t> new_timing =
+            with_timing ? std::optional<int64_t>(timing_digest(m)) : std::nullopt;
+        const std::optional<int64_t> new_measures =
+            with_measures ? std::optional<int64_t>(measures_digest(m, fields)) : std::nullopt;
+        const std::optional<int64_t> new_sequences =
+            with_sequences ? std::optional<int64_t>(sequences_digest(m)) : std::nullopt;
+
+        // What is stored for this chart, if anything.
+        bool is_new = true;
+        int64_t chart_id = 0;
+        std::optional<int64_t> old_digests[3];
+        bind_key(find_chart, m, ordinal);
+        const int rc = sqlite3_step(find_chart);
+        if (rc == SQLITE_ROW) {
+            is_new = false;
+            chart_id = sqlite3_column_int64(find_chart, 0);
+            for (int i = 0; i < 3; ++i) {
+                if (sqlite3_column_type(find_chart, i + 1) != SQLITE_NULL) {
+                    old_digests[i] = sqlite3_column_int64(find_chart, i + 1);
+                }
+            }
+        }
+        sqlite3_reset(find_chart);
+        sqlite3_clear_bindings(find_chart);
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE) return fail("look up chart");
+
+        bind_key(upsert_chart, m, ordinal);
+        int index = 6;
+        for (const ScalarColumn& column : kScalarColumns) {
+            bind_scalar(upsert_chart, index++, column, m);
+        }
+        for (const std::optional<int64_t>& digest : {new_timing, new_measures, new_sequences}) {
+            if (digest) sqlite3_bind_int64(upsert_chart, index, *digest);
+            ++index;
+        }
+        sqlite3_bind_text(upsert_chart, index, harness_version.data(), static_cast<int>(harness_version.size()),
+                          SQLITE_STATIC);
+        if (!step(upsert_chart, "upsert chart")) return false;
+        if (is_new) chart_id = sqlite3_last_insert_rowid(db);
+        seen.insert(chart_id);
+
+        if (with_timing &&
+            !replace_children(chart_id, is_new, old_digests[0], *new_timing, delete_timing, &Impl::write_timing, m)) {
+            return false;
+        }
+        if (with_measures && !replace_children(chart_id, is_new, old_digests[1], *new_measures, delete_measures,
+                                               &Impl::write_measures, m)) {
+            return false;
+        }
+        if (with_sequences && !replace_children(chart_id, is_new, old_digests[2], *new_sequences,
+                                                delete_sequences, &Impl::write_sequences, m)) {
+            return false;
+        }
+        ++batch;
+        return true;
+    }
+
+    // Rows of the simfile that this run did not write: charts since removed
+    // from it. Their child rows go with them (ON DELETE CASCADE).
+    bool delete_unseen() {
+        bind_text(simfile_charts, 1, simfile);
+        std::vector<int64_t> stale;
+        int rc = SQLITE_ROW;
+        while ((rc = sqlite3_step(simfile_charts)) == SQLITE_ROW) {
+            const int64_t id = sqlite3_column_int64(simfile_charts, 0);
+            if (!seen.count(id)) stale.push_back(id);
+        }
+        sqlite3_reset(simfile_charts);
+        sqlite3_clear_bindings(simfile_charts);
+        if (rc != SQLITE_DONE) return fail("list stored charts");
+        for (const int64_t id : stale) {
+            sqlite3_bind_int64(delete_chart, 1, id);
+            if (!step(delete_chart, "delete removed chart")) return false;
+        }
+        return true;
+    }
+
+    void begin_simfile(const std::string& path, bool complete) {
+        end_simfile();
+        in_simfile = true;
+        simfile_complete = complete;
+        simfile = path;
+        ordinals.clear();
+        seen.clear();
+        simfile_failed = !exec("SAVEPOINT simfile");
+    }
+
+    void add(const ChartMetrics& m) {
+        if (!in_simfile || simfile_failed) return;
+        simfile_failed = !write_chart(m);
+    }
+
+    // Releases the simfile's savepoint, or rolls back to it when anything
+    // failed, so one bad simfile costs only its own charts. Batches are
+    // committed between simfiles.
+    void end_simfile() {
+        if (!in_simfile) return;
+        in_simfile = false;
+        if (!simfile_failed && simfile_complete) simfile_failed = !delete_unseen();
+        if (simfile_failed) {
+            ++failed_simfiles;
+            exec("ROLLBACK TO simfile; RELEASE simfile;");
+        } else if (!exec("RELEASE simfile")) {
+            ++failed_simfiles;
+        }
+        if (batch >= kBatchCharts) {
+            batch = 0;
+            broken = !exec("COMMIT; BEGIN;");
+        }
+    }
+};
+
+SqliteSink::SqliteSink(std::string path, const ChartFieldSet& fields, std::string_view harness_version)
+    : impl_(std::make_unique<Impl>()) {
+    impl_->path = std::move(path);
+    impl_->fields = fields;
+    impl_->harness_version = std::string(harness_version);
+}
+
+SqliteSink::~SqliteSink() = default;
+
+bool SqliteSink::open(std::string* error) {
+    Impl& s = *impl_;
+    const bool ok = [&]() {
+        if (sqlite3_open_v2(s.path.c_str(), &s.db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) !=
+            SQLITE_OK) {
+            return s.fail("cannot open " + s.path);
+        }
+        int version = 0;
+        sqlite3_stmt* user_version = nullptr;
+        if (!s.prepare(&user_version, "PRAGMA user_version")) return false;
+        if (sqlite3_step(user_version) == SQLITE_ROW) version = sqlite3_column_int(user_version, 0);
+        sqlite3_finalize(user_version);
+        if (version > kSchemaVersion) {
+            s.error = s.path + " was written by a newer harness (schema " + std::to_string(version) + ")";
+            return false;
+        }
+
+        return s.exec("PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL; PRAGMA foreign_keys = ON;") &&
+               s.exec(kSchemaSql) &&
+               s.exec(("PRAGMA user_version = " + std::to_string(kSchemaVersion)).c_str()) &&
+               s.prepare(&s.find_chart,
+                         "SELECT id, timing_digest, measures_digest, sequences_digest FROM charts "
+                         "WHERE simfile = ? AND steps_type = ? AND difficulty = ? AND description = ? "
+                         "AND chart_ordinal = ?") &&
+               s.prepare(&s.upsert_chart, build_upsert_sql()) &&
+               s.prepare(&s.delete_timing, "DELETE FROM timing_segments WHERE chart_id = ?") &&
+               s.prepare(&s.insert_timing,
+                         "INSERT INTO timing_segments (chart_id, kind, idx, beat, value1, value2, value3, label) "
+                         "VALUES (?, ?, ?, ?, ?, ?, ?, ?)") &&
+               s.prepare(&s.delete_measures, "DELETE FROM measures WHERE chart_id = ?") &&
+               s.prepare(&s.insert_measure,
+                         "INSERT INTO measures (chart_id, measure, notes, nps, equally_spaced) VALUES (?, ?, ?, ?, ?)") &&
+               s.prepare(&s.delete_sequences, "DELETE FROM stream_sequences WHERE chart_id = ?") &&
+               s.prepare(&s.insert_sequence,
+                         "INSERT INTO stream_sequences (chart_id, idx, stream_start, stream_end, is_break) "
+                         "VALUES (?, ?, ?, ?, ?)") &&
+               s.prepare(&s.simfile_charts, "SELECT id FROM charts WHERE simfile = ?") &&
+               s.prepare(&s.delete_chart, "DELETE FROM charts WHERE id = ?") &&
+               s.exec("BEGIN");
+    }();
+    if (!ok) {
+        if (error) *error = s.error;
+        s.close();
+    }
+    return ok;
+}
+
+void SqliteSink::begin_simfile(const std::string& simfile, bool complete) {
+    Impl& s = *impl_;
+    if (!s.db || s.broken) return;
+    s.begin_simfile(simfile, complete);
+}
+
+void SqliteSink::add(const ChartMetrics& m) {
+    Impl& s = *impl_;
+    if (!s.db || s.broken) return;
+    s.add(m);
+}
+
+void SqliteSink::end_simfile() {
+    Impl& s = *impl_;
+    if (!s.db || s.broken) return;
+    s.end_simfile();
+}
+
+bool SqliteSink::finish(std::string* error) {
+    Impl& s = *impl_;
+    if (s.db && !s.broken) {
+        s.end_simfile();
+        if (!s.broken) s.exec("COMMIT");
+    }
+    s.close();
+    if (!s.error.empty()) {
+        if (error) {
+            *error = s.failed_simfiles > 0
+                         ? std::to_string(s.failed_simfiles) + " simfile(s) not stored; first error: " + s.error
+                         : s.error;
+        }
+        return false;
+    }
+    return true;
+}
+
+#else
+
+struct SqliteSink::Impl {};
+
+SqliteSink::SqliteSink(std::string, const ChartFieldSet&, std::string_view) {}
+
+SqliteSink::~SqliteSink() = default;
+
+bool SqliteSink::open(std::string* error) {
+    if (error) *error = "this build has no SQLite support (configure with WITH_SQLITE=ON)";
+    return false;
+}
+
+void SqliteSink::begin_simfile(const std::string&, bool) {}
+
+void SqliteSink::add(const ChartMetrics&) {}
+
+void SqliteSink::end_simfile() {}
+
+bool SqliteSink::finish(std::string*) {
+    return true;
+}
+
+#endif
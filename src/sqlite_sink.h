@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "chart_fields.h"
+#include "itgmania_adapter.h"
+
+// Stores charts in a SQLite database, one row per chart in `charts` keyed by
+// (simfile, steps_type, difficulty, description, chart_ordinal), with timing
+// segments, per-measure data and stream sequences in child tables. Existing
+// rows are updated in place: keys not selected by the field set keep their
+// stored values, and child rows are only rewritten when their content
+// changed. Writes are grouped into transactions of a few hundred charts,
+// each simfile in a savepoint of its own.
+//
+// Needs a build with HARNESS_WITH_SQLITE; otherwise open() fails.
+class SqliteSink {
+public:
+    SqliteSink(std::string path, const ChartFieldSet& fields, std::string_view harness_version);
+    ~SqliteSink();
+
+    SqliteSink(const SqliteSink&) = delete;
+    SqliteSink& operator=(const SqliteSink&) = delete;
+
+    // Opens or creates the database and its tables. On failure returns false
+    // and describes the problem in error.
+    bool open(std::string* error);
+
+    // Charts are added simfile by simfile, in song order, between
+    // begin_simfile and end_simfile. With complete, they are all of the
+    // simfile's charts, and stored rows for charts it no longer has are
+    // deleted. A failed write rolls back that simfile's charts only; the
+    // rest are still stored and finish() reports the failure.
+    void begin_simfile(const std::string& simfile, bool complete);
+    void add(const ChartMetrics& m);
+    void end_simfile();
+
+    // Commits the last batch and closes the database.
+    bool finish(std::string* error);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
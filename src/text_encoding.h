@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Simfile text is usually UTF-8, but older files use Windows-1252; anything
+// that is not valid UTF-8 is read as Windows-1252.
+
+bool is_valid_utf8(std::string_view s);
+
+void append_utf8(std::string& out, unsigned int code_point);
+
+// Code point of a Windows-1252 byte (0x80-0x9F differ from Latin-1).
+unsigned int cp1252_to_unicode(unsigned char value);
+
+// Returns s itself when it is valid UTF-8, otherwise its Windows-1252 reading
+// transcoded into scratch.
+std::string_view as_utf8(std::string_view s, std::string& scratch);
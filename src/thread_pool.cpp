@@ -0,0 +1,158 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+thread_local const WorkStealingPool* tls_pool = nullptr;
+thread_local int tls_worker_index = -1;
+} // namespace
+
+WorkStealingPool::WorkStealingPool(size_t num_workers) {
+    num_workers = std::max<size_t>(num_workers, 1);
+    queues_.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; ++i) {
+        queues_.push_back(std::make_unique<WorkerQueue>());
+    }
+    workers_.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; ++i) {
+        workers_.emplace_back([this, i]() { worker_loop(i); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread& t : workers_) {
+        t.join();
+    }
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+    size_t target = 0;
+    {
+        // Count the task before it becomes visible so a worker can never
+        // finish it ahead of the bookkeeping.
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        ++queued_;
+        ++pending_;
+        if (tls_pool == this) {
+            target = static_cast<size_t>(tls_worker_index);
+        } else {
+            target = next_queue_;
+            next_queue_ = (next_queue_ + 1) % queues_.size();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    work_cv_.notify_one();
+}
+
+void WorkStealingPool::wait_idle() {
+    std::unique_lock<std::mutex> lock(state_mutex_);
+    idle_cv_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+int WorkStealingPool::current_worker_index() {
+    return tls_worker_index;
+}
+
+size_t WorkStealingPool::resolve_worker_count(int requested) {
+    if (requested > 0) return static_cast<size_t>(requested);
+    const unsigned hw = std::thread::hardware_concurrency();
+    return hw > 0 ? hw : 1;
+}
+
+bool WorkStealingPool::try_pop(size_t self, std::function<void()>& task) {
+    {
+        WorkerQueue& own = *queues_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t step = 1; step < queues_.size(); ++step) {
+        WorkerQueue& victim = *queues_[(self + step) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run_task(std::function<void()>& task) {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        --queued_;
+    }
+    task();
+    bool idle = false;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        idle = --pending_ == 0;
+    }
+    if (idle) idle_cv_.notify_all();
+}
+
+void WorkStealingPool::worker_loop(size_t index) {
+    tls_pool = this;
+    tls_worker_index = static_cast<int>(index);
+
+    for (;;) {
+        std::function<void()> task;
+        if (try_pop(index, task)) {
+            run_task(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(state_mutex_);
+        if (stopping_) return;
+        work_cv_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) return;
+    }
+}
+
+TaskGroup::TaskGroup(WorkStealingPool& pool) : pool_(pool), state_(std::make_shared<State>()) {}
+
+void TaskGroup::run(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->tasks.push_back(std::move(task));
+        ++state_->outstanding;
+    }
+    // One pool task per group task; whichever of it and wait() gets to the
+    // group's queue first runs the task, the other finds nothing to do.
+    pool_.submit([state = state_]() { run_one(*state); });
+}
+
+bool TaskGroup::run_one(State& state) {
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.tasks.empty()) return false;
+        task = std::move(state.tasks.front());
+        state.tasks.pop_front();
+    }
+    task();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (--state.outstanding == 0) state.done_cv.notify_all();
+    return true;
+}
+
+void TaskGroup::wait() {
+    while (run_one(*state_)) {
+    }
+    // The rest of this group is already running on other threads.
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->done_cv.wait(lock, [this]() { return state_->outstanding == 0; });
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size work-stealing pool. Every worker owns a task deque: it takes its
+// own tasks from the front and, once that runs dry, steals from the back of a
+// sibling's deque. Submitting tasks largest-first therefore keeps the long
+// ones at the front of each deque while idle workers mop up the short tail.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t num_workers);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    // Called from a worker, the task goes to that worker's own deque;
+    // otherwise deques are filled round-robin.
+    void submit(std::function<void()> task);
+
+    // Blocks until every submitted task has finished.
+    void wait_idle();
+
+    // Index of the calling pool worker, or -1 outside any pool.
+    static int current_worker_index();
+
+    // Resolves a -j value: 0 means one worker per hardware thread.
+    static size_t resolve_worker_count(int requested);
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool try_pop(size_t self, std::function<void()>& task);
+    void run_task(std::function<void()>& task);
+    void worker_loop(size_t index);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex state_mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    size_t queued_ = 0;   // sitting in a deque
+    size_t pending_ = 0;  // submitted and not yet finished
+    size_t next_queue_ = 0;
+    bool stopping_ = false;
+};
+
+// A batch of pool tasks that can be waited on together. The batch keeps its
+// own queue: wait() runs the batch's tasks that no worker has started yet on
+// the calling thread, and never other pool work, so a task already running
+// on the pool can fan out into the same pool without tying up its worker or
+// ending up nested under unrelated tasks.
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingPool& pool);
+    ~TaskGroup() { wait(); }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    // Shared with the pool tasks, which can outlive the group once wait() has
+    // run the task they were submitted for.
+    struct State {
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        std::deque<std::function<void()>> tasks;
+        size_t outstanding = 0;
+    };
+
+    // Runs the group's oldest unstarted task, if any.
+    static bool run_one(State& state);
+
+    WorkStealingPool& pool_;
+    std::shared_ptr<State> state_;
+};
@@ -0,0 +1,103 @@
+// sl_bytecode_compiler.cpp
+// Build-time helper: compiles the Simply Love chart parser scripts to Lua 5.1
+// bytecode and writes them into a header as char arrays, so the harness can
+// load them without compiling Lua source at runtime.
+//
+// Usage: sl_bytecode_compiler <out.h> (<symbol> <chunkname> <script.lua>)...
+//
+// Debug info is kept: the adapter finds ParseChartInfo's upvalues by name, and
+// tracebacks keep pointing at the original script lines.
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+int append_chunk(lua_State*, const void* data, size_t size, void* userdata) {
+    static_cast<std::string*>(userdata)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+
+bool compile_script(lua_State* L, const char* chunkname, const char* path, std::string& bytecode) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "sl_bytecode_compiler: cannot read %s\n", path);
+        return false;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    const std::string source = ss.str();
+
+    if (luaL_loadbuffer(L, source.data(), source.size(), chunkname) != 0) {
+        std::fprintf(stderr, "sl_bytecode_compiler: %s\n", lua_tostring(L, -1) ? lua_tostring(L, -1) : path);
+        lua_pop(L, 1);
+        return false;
+    }
+    bytecode.clear();
+    const int rc = lua_dump(L, append_chunk, &bytecode);
+    lua_pop(L, 1);
+    if (rc != 0) {
+        std::fprintf(stderr, "sl_bytecode_compiler: lua_dump failed for %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+void write_array(std::ostream& out, const std::string& symbol, const std::string& bytecode) {
+    static const char* hex = "0123456789abcdef";
+    out << "inline constexpr char " << symbol << "Data[] = {";
+    for (size_t i = 0; i < bytecode.size(); ++i) {
+        if (i % 16 == 0) out << "\n  ";
+        const unsigned char c = static_cast<unsigned char>(bytecode[i]);
+        out << "'\\x" << hex[c >> 4] << hex[c & 0x0F] << "',";
+    }
+    out << "\n};\n";
+    out << "constexpr std::string_view " << symbol << "{" << symbol << "Data, sizeof(" << symbol << "Data)};\n\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 5 || (argc - 2) % 3 != 0) {
+        std::fprintf(stderr, "usage: %s <out.h> (<symbol> <chunkname> <script.lua>)...\n", argv[0]);
+        return 2;
+    }
+
+    lua_State* L = luaL_newstate();
+    if (!L) {
+        std::fprintf(stderr, "sl_bytecode_compiler: luaL_newstate failed\n");
+        return 1;
+    }
+
+    std::ostringstream header;
+    header << "#pragma once\n\n"
+           << "// Generated by sl_bytecode_compiler; do not edit.\n\n"
+           << "#include <string_view>\n\n"
+           << "namespace embedded_lua {\n\n";
+
+    std::string bytecode;
+    for (int i = 2; i + 2 < argc; i += 3) {
+        if (!compile_script(L, argv[i + 1], argv[i + 2], bytecode)) {
+            lua_close(L);
+            return 1;
+        }
+        write_array(header, argv[i], bytecode);
+    }
+    header << "}  // namespace embedded_lua\n";
+    lua_close(L);
+
+    std::ofstream out(argv[1], std::ios::binary | std::ios::trunc);
+    out << header.str();
+    if (!out) {
+        std::fprintf(stderr, "sl_bytecode_compiler: cannot write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
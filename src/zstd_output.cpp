@@ -0,0 +1,172 @@
+#include "zstd_output.h"
+
+#ifdef HARNESS_WITH_ZSTD
+
+#include <zstd.h>
+
+namespace {
+
+constexpr size_t kChunkBytes = size_t(256) << 10;
+// Chunks that may wait for the compressor before writers block.
+constexpr size_t kMaxQueuedChunks = 8;
+
+} // namespace
+
+ZstdOutputBuffer::ZstdOutputBuffer(std::streambuf* sink, int level) : sink_(sink), level_(level) {}
+
+ZstdOutputBuffer::~ZstdOutputBuffer() {
+    finish(nullptr);
+}
+
+bool ZstdOutputBuffer::start(std::string* error) {
+    if (level_ < ZSTD_minCLevel() || level_ > ZSTD_maxCLevel()) {
+        if (error) {
+            *error = "zstd level must be between " + std::to_string(ZSTD_minCLevel()) + " and " +
+                     std::to_string(ZSTD_maxCLevel());
+        }
+        return false;
+    }
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if (!cctx || ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level_))) {
+        ZSTD_freeCCtx(cctx);
+        if (error) *error = "cannot set up the zstd compressor";
+        return false;
+    }
+    cctx_ = cctx;
+    chunk_.resize(kChunkBytes);
+    setp(chunk_.data(), chunk_.data() + chunk_.size());
+    started_ = true;
+    thread_ = std::thread([this]() { compress_loop(); });
+    return true;
+}
+
+bool ZstdOutputBuffer::finish(std::string* error) {
+    if (started_) {
+        hand_over();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        changed_.notify_all();
+        thread_.join();
+        ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(cctx_));
+        cctx_ = nullptr;
+        setp(nullptr, nullptr);
+        started_ = false;
+    }
+    if (!error_.empty()) {
+        if (error) *error = error_;
+        return false;
+    }
+    return true;
+}
+
+ZstdOutputBuffer::int_type ZstdOutputBuffer::overflow(int_type ch) {
+    if (!started_) return traits_type::eof();
+    hand_over();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int ZstdOutputBuffer::sync() {
+    if (!started_) return -1;
+    hand_over();
+    return 0;
+}
+
+// Queues the filled part of the current chunk and continues in a fresh one.
+void ZstdOutputBuffer::hand_over() {
+    const size_t used = static_cast<size_t>(pptr() - pbase());
+    if (used == 0) return;
+    chunk_.resize(used);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [&]() { return queue_.size() < kMaxQueuedChunks; });
+        queue_.push_back(std::move(chunk_));
+        if (!free_chunks_.empty()) {
+            chunk_ = std::move(free_chunks_.back());
+            free_chunks_.pop_back();
+        } else {
+            chunk_ = std::vector<char>();
+        }
+    }
+    changed_.notify_all();
+    chunk_.resize(kChunkBytes);
+    setp(chunk_.data(), chunk_.data() + chunk_.size());
+}
+
+void ZstdOutputBuffer::compress_loop() {
+    ZSTD_CCtx* cctx = static_cast<ZSTD_CCtx*>(cctx_);
+    std::vector<char> out(ZSTD_CStreamOutSize());
+
+    // Runs the compressor over input until it has taken all of it and, for a
+    // flush or end, emitted everything it holds.
+    auto compress = [&](const char* data, size_t size, ZSTD_EndDirective mode) {
+        ZSTD_inBuffer input{data, size, 0};
+        for (;;) {
+            ZSTD_outBuffer output{out.data(), out.size(), 0};
+            const size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining)) {
+                if (error_.empty()) error_ = std::string("zstd: ") + ZSTD_getErrorName(remaining);
+                return;
+            }
+            const auto written = static_cast<std::streamsize>(output.pos);
+            if (written > 0 && sink_->sputn(out.data(), written) != written) {
+                if (error_.empty()) error_ = "cannot write compressed output";
+                return;
+            }
+            const bool done = mode == ZSTD_e_continue ? input.pos == input.size : remaining == 0;
+            if (done) break;
+        }
+        if (mode != ZSTD_e_continue) sink_->pubsync();
+    };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        changed_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) break;
+        std::vector<char> chunk = std::move(queue_.front());
+        queue_.pop_front();
+        const bool caught_up = queue_.empty();
+        lock.unlock();
+        changed_.notify_all();
+
+        if (error_.empty()) {
+            compress(chunk.data(), chunk.size(), caught_up ? ZSTD_e_flush : ZSTD_e_continue);
+        }
+
+        lock.lock();
+        chunk.clear();
+        free_chunks_.push_back(std::move(chunk));
+    }
+    lock.unlock();
+    if (error_.empty()) compress(nullptr, 0, ZSTD_e_end);
+}
+
+#else
+
+ZstdOutputBuffer::ZstdOutputBuffer(std::streambuf* sink, int level) : sink_(sink), level_(level) {}
+
+ZstdOutputBuffer::~ZstdOutputBuffer() = default;
+
+bool ZstdOutputBuffer::start(std::string* error) {
+    if (error) *error = "this build has no zstd support (configure with WITH_ZSTD=ON)";
+    return false;
+}
+
+bool ZstdOutputBuffer::finish(std::string*) {
+    return true;
+}
+
+ZstdOutputBuffer::int_type ZstdOutputBuffer::overflow(int_type) {
+    return traits_type::eof();
+}
+
+int ZstdOutputBuffer::sync() {
+    return -1;
+}
+
+#endif
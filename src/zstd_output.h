@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A streambuf that compresses everything written to it into one zstd frame
+// and writes the frame to another streambuf (e.g. stdout's). Compression runs
+// on a dedicated thread: writers fill fixed-size chunks and hand them over,
+// blocking only when several chunks are already waiting. A flush of the
+// stream hands over the current chunk; the compressor flushes its own output
+// whenever it catches up, so a consumer sees data without waiting for the
+// end. The output can be read with zstdcat.
+//
+// Needs a build with HARNESS_WITH_ZSTD; otherwise start() fails.
+class ZstdOutputBuffer : public std::streambuf {
+public:
+    static constexpr int kDefaultLevel = 3;
+
+    ZstdOutputBuffer(std::streambuf* sink, int level);
+    ~ZstdOutputBuffer() override;
+
+    ZstdOutputBuffer(const ZstdOutputBuffer&) = delete;
+    ZstdOutputBuffer& operator=(const ZstdOutputBuffer&) = delete;
+
+    // Validates the level and starts the compression thread. On failure
+    // returns false and describes the problem in error.
+    bool start(std::string* error);
+
+    // Compresses what is left, ends the frame and stops the thread. Returns
+    // false if compressing or writing to the sink failed at any point.
+    bool finish(std::string* error);
+
+protected:
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    void hand_over();
+    void compress_loop();
+
+    std::streambuf* sink_;
+    int level_;
+    void* cctx_ = nullptr;
+
+    std::vector<char> chunk_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::vector<char>> queue_;
+    std::vector<std::vector<char>> free_chunks_;
+    bool stopping_ = false;
+    bool started_ = false;
+    std::string error_;
+};
@@ -0,0 +1,27 @@
+# Runs the harness on SIMFILE from its text and from its compiled form and
+# fails unless both print the same thing.
+#   cmake -DHARNESS=<exe> -DSIMFILE=<simfile> -DWORK_DIR=<scratch dir> -P compiled_parity.cmake
+file(REMOVE_RECURSE "${WORK_DIR}")
+
+execute_process(COMMAND "${HARNESS}" --compile "${WORK_DIR}" "${SIMFILE}" RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "--compile failed (${status})")
+endif()
+
+execute_process(COMMAND "${HARNESS}" --no-cache "${SIMFILE}"
+  RESULT_VARIABLE status OUTPUT_VARIABLE from_text)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "text run failed (${status})")
+endif()
+
+execute_process(COMMAND "${HARNESS}" --no-cache --compiled "${WORK_DIR}" "${SIMFILE}"
+  RESULT_VARIABLE status OUTPUT_VARIABLE from_compiled)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "--compiled run failed (${status})")
+endif()
+
+if(NOT from_text STREQUAL from_compiled)
+  file(WRITE "${WORK_DIR}/text.json" "${from_text}")
+  file(WRITE "${WORK_DIR}/compiled.json" "${from_compiled}")
+  message(FATAL_ERROR "--compiled output differs; see ${WORK_DIR}/text.json and compiled.json")
+endif()